@@ -0,0 +1,35 @@
+#!/bin/bash
+set -euo pipefail
+
+# Usage: ./bench.sh [BENCHMARK.lala...]
+# Builds the interpreter with and without threaded dispatch, runs each
+# benchmark (default: bench/*.lala) with both, and with the JIT (see
+# jit_compile), and reports instructions evaluated per second.
+# Each benchmark is expected to print "vm .instr_count" as its last line.
+
+CFLAGS="-O2 -rdynamic"
+mkdir -p bench/bin
+gcc $CFLAGS -D_NO_COMPUTED_GOTO_ -o bench/bin/lalang_switch *.c -ldl
+gcc $CFLAGS -o bench/bin/lalang_threaded *.c -ldl
+
+run() {
+    local binary="$1" benchmark="$2" jit="${3:-0}"
+    local start end instrs build
+    build=$(basename "$binary")
+    if [ "$jit" = 1 ]; then build="$build+jit"; fi
+    start=$(date +%s.%N)
+    instrs=$(QUIET=1 JIT="$jit" "$binary" < "$benchmark" | tail -n 1)
+    end=$(date +%s.%N)
+    awk -v name="$(basename "$benchmark")" -v build="$build" \
+        -v t0="$start" -v t1="$end" -v n="$instrs" \
+        'BEGIN { t = t1 - t0; printf "%-20s %-20s %8.3fs %12i instrs %10.2f M instrs/s\n", name, build, t, n, n / t / 1e6 }'
+}
+
+benchmarks=("$@")
+if [ ${#benchmarks[@]} -eq 0 ]; then benchmarks=(bench/*.lala); fi
+
+for benchmark in "${benchmarks[@]}"; do
+    run bench/bin/lalang_switch "$benchmark"
+    run bench/bin/lalang_threaded "$benchmark"
+    run bench/bin/lalang_threaded "$benchmark" 1
+done
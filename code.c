@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 
 #include "lalang.h"
 
@@ -23,6 +24,32 @@ const char *instruction_names[N_INSTRS] = {
     "GETTER",
     "SETTER",
     "RENAME_FUNC",
+    "JUMP",
+    "JUMP_IF_FALSE",
+    "CHECK_BUILTIN",
+    "ITER",
+    "FOR_ITER",
+    "POP_ITER",
+    "BREAK",
+    "CONTINUE",
+    "RETURN",
+    "LOAD_LOCAL_GETTER",
+    "STORE_LOAD_LOCAL",
+    "ADD_INT_CONST",
+    "SUB_INT_CONST",
+    "LT_INT_CONST",
+    "DUP",
+    "GETTER_METHOD",
+    "LIST_LEN",
+    "LIST_GET",
+    "STR_LEN",
+    "STR_GET",
+    "LOCAL_GETTER_METHOD",
+    "LOCAL_LIST_LEN",
+    "LOCAL_LIST_GET",
+    "LOCAL_STR_LEN",
+    "LOCAL_STR_GET",
+    "LIST_COMMA",
     "NEG",
     "ADD",
     "SUB",
@@ -43,6 +70,13 @@ const char *instruction_names[N_INSTRS] = {
     "CALL"
 };
 
+const char *inline_builtin_names[N_INLINE_BUILTINS] = {
+    "if",
+    "ifelse",
+    "while",
+    "for"
+};
+
 const char *operator_tokens[N_OPS] = {
     "~",
     "+",
@@ -85,13 +119,96 @@ int op_arities[N_OPS] = {
     1 // INSTR_CALL
 };
 
+const char *symbol_names[N_SYMS - FIRST_NAMED_SYM] = {
+    "__iter__",
+    "__next__",
+    "len",
+    "get",
+    "set",
+    "has",
+    "del",
+    "copy",
+    "slice",
+    "write",
+    "writeline",
+    "replace",
+    "times",
+    "extend",
+    "pop",
+    "push",
+    "sort",
+    "reverse",
+    "unbuild",
+    "unpair",
+    "keys",
+    "values",
+    "items",
+    "update",
+    "get_key",
+    "get_value",
+    "get_item",
+    "get_default",
+    "name",
+    "filename",
+    "to_dict",
+    "stack",
+    "locals",
+    "push_stack",
+    "set_local",
+    "print_code",
+    "to_list",
+    "to_str",
+    "split",
+    "strip",
+    "find",
+    "count",
+    "startswith",
+    "endswith",
+    "join"
+};
+
+// A perfect hash table of symbols by name: symbol_table[SYMBOL_HASH(hash)]
+// is the only place a name with that hash_string could be.
+// symbol_find finds a multiplier which makes this work the first time it's
+// called.
+#define SYMBOL_TABLE_BITS 8
+#define SYMBOL_TABLE_SIZE (1 << SYMBOL_TABLE_BITS)
+#define SYMBOL_HASH(_hash) ((unsigned)((_hash) * symbol_multiplier) >> (32 - SYMBOL_TABLE_BITS))
+static unsigned symbol_multiplier;
+static int symbol_table[SYMBOL_TABLE_SIZE];
+
+static const char *symbol_name(int sym) {
+    return sym < FIRST_NAMED_SYM? operator_tokens[sym]: symbol_names[sym - FIRST_NAMED_SYM];
+}
+
+static void symbol_init(void) {
+    for (unsigned multiplier = 2654435761u;; multiplier += 2) {
+        symbol_multiplier = multiplier;
+        for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) symbol_table[i] = -1;
+        bool ok = true;
+        for (int sym = 0; sym < N_SYMS && ok; sym++) {
+            int *entry = &symbol_table[SYMBOL_HASH(hash_string(symbol_name(sym)))];
+            if (*entry >= 0) ok = false;
+            else *entry = sym;
+        }
+        if (ok) return;
+    }
+}
+
+int symbol_find(const char *name) {
+    // returns name's symbol, or -1 if it doesn't have one
+    if (!symbol_multiplier) symbol_init();
+    int sym = symbol_table[SYMBOL_HASH(hash_string(name))];
+    return sym >= 0 && !strcmp(symbol_name(sym), name)? sym: -1;
+}
+
 int instruction_args(instruction_t instruction) {
+    if (instruction >= FIRST_QUICK_GETTER && instruction < FIRST_LOCAL_QUICK_GETTER) return 2;
+    if (instruction >= FIRST_LOCAL_QUICK_GETTER && instruction <= LAST_QUICK_GETTER) return 3;
     switch (instruction) {
         case INSTR_LOAD_INT:
         case INSTR_LOAD_STR:
         case INSTR_LOAD_FUNC:
-        case INSTR_GETTER:
-        case INSTR_SETTER:
         case INSTR_LOAD_GLOBAL:
         case INSTR_STORE_GLOBAL:
         case INSTR_CALL_GLOBAL:
@@ -99,12 +216,79 @@ int instruction_args(instruction_t instruction) {
         case INSTR_STORE_LOCAL:
         case INSTR_CALL_LOCAL:
         case INSTR_RENAME_FUNC:
+        case INSTR_JUMP:
+        case INSTR_JUMP_IF_FALSE:
+        case INSTR_FOR_ITER:
+        case INSTR_BREAK:
+        case INSTR_CONTINUE:
+        case INSTR_STORE_LOAD_LOCAL:
+        case INSTR_ADD_INT_CONST:
+        case INSTR_SUB_INT_CONST:
+        case INSTR_LT_INT_CONST:
             return 1;
+        case INSTR_GETTER:
+        case INSTR_SETTER:
+        case INSTR_ITER:
+            return 2;
+        case INSTR_CHECK_BUILTIN:
+        case INSTR_LOAD_LOCAL_GETTER:
+            return 3;
         default: return 0;
     }
 }
 
-#define CODE_SIZE 1024
+arg_kind_t instruction_arg_kind(instruction_t instruction, int j) {
+    // what instruction's j'th arg is
+    int n_args = instruction_args(instruction);
+    if (instruction_has_offset(instruction) && j == n_args - 1) return ARG_OFFSET;
+    if (instruction_has_getter_cache(instruction)) {
+        // [local,] name, cache
+        if (j == n_args - 1) return ARG_GETTER_CACHE;
+        if (j == n_args - 2) return ARG_STR;
+        return ARG_LOCAL;
+    }
+    switch (instruction) {
+        case INSTR_LOAD_STR:
+        case INSTR_LOAD_GLOBAL:
+        case INSTR_STORE_GLOBAL:
+        case INSTR_CALL_GLOBAL:
+        case INSTR_RENAME_FUNC:
+            return ARG_STR;
+        case INSTR_CHECK_BUILTIN:
+            return j == 0? ARG_STR: ARG_INT; // (the builtin's index in inline_builtin_names)
+        case INSTR_LOAD_FUNC:
+        case INSTR_ITER:
+            return ARG_CODE;
+        case INSTR_LOAD_LOCAL:
+        case INSTR_STORE_LOCAL:
+        case INSTR_CALL_LOCAL:
+        case INSTR_STORE_LOAD_LOCAL:
+            return ARG_LOCAL;
+        default:
+            return ARG_INT;
+    }
+}
+
+bool instruction_is_jump(instruction_t instruction) {
+    // whether instruction's last arg is a jump offset
+    // NOTE: BREAK and CONTINUE don't count until they're turned into JUMPs
+    return instruction >= INSTR_JUMP && instruction <= INSTR_FOR_ITER;
+}
+
+bool instruction_has_offset(instruction_t instruction) {
+    // whether instruction's last arg is an offset (see bytecode_t)
+    return instruction_is_jump(instruction) ||
+        instruction == INSTR_BREAK || instruction == INSTR_CONTINUE;
+}
+
+bool instruction_has_getter_cache(instruction_t instruction) {
+    // whether instruction's last arg is an index into code->getter_caches
+    return instruction == INSTR_GETTER || instruction == INSTR_SETTER ||
+        instruction == INSTR_LOAD_LOCAL_GETTER ||
+        (instruction >= FIRST_QUICK_GETTER && instruction <= LAST_QUICK_GETTER);
+}
+
+#define CODE_MIN_SIZE 16
 
 code_t *code_create(const char *filename, int row, int col, bool is_func) {
     code_t *code = calloc(1, sizeof *code);
@@ -120,30 +304,333 @@ code_t *code_create(const char *filename, int row, int col, bool is_func) {
 }
 
 static void code_grow(code_t *code, int len) {
-    // NOTE: the size of code->bytecodes is currently static, i.e. always CODE_SIZE
-    // TODO: allow code to be dynamically resized :P
-    if (len >= CODE_SIZE) {
-        fprintf(stderr, "Can't grow code beyond max size: %i\n", CODE_SIZE);
-        exit(1);
-    }
     if (code->len >= len) return;
-    if (!code->bytecodes) {
-        bytecode_t *bytecodes = malloc(CODE_SIZE * sizeof *bytecodes);
+    if (len > code->size) {
+        int new_size = MAX(len, code->size? code->size * 2: CODE_MIN_SIZE);
+        bytecode_t *bytecodes = realloc(code->bytecodes, new_size * sizeof *bytecodes);
         if (!bytecodes) {
             fprintf(stderr, "Failed to allocate bytecodes\n");
             exit(1);
         }
         code->bytecodes = bytecodes;
+        code->size = new_size;
     }
     code->len = len;
 }
 
-code_t *code_push_instruction(code_t *code, instruction_t instruction) {
-    code_grow(code, code->len + 1);
-    code->bytecodes[code->len - 1].instruction = instruction;
+void code_trim(code_t *code) {
+    // gives back the room we didn't use
+    if (code->size == code->len) return;
+    bytecode_t *bytecodes = realloc(code->bytecodes, code->len * sizeof *bytecodes);
+    if (code->len && !bytecodes) {
+        fprintf(stderr, "Failed to trim bytecodes\n");
+        exit(1);
+    }
+    code->bytecodes = bytecodes;
+    code->size = code->len;
 }
 
-code_t *code_push_i(code_t *code, int i) {
+void code_push_instruction(code_t *code, instruction_t instruction) {
     code_grow(code, code->len + 1);
-    code->bytecodes[code->len - 1].i = i;
+    code->bytecodes[code->len - 1] = instruction;
+}
+
+void code_push_i(code_t *code, int i) {
+    // as an int16_t if it fits (apart from CODE_WIDE_ARG itself), or else
+    // CODE_WIDE_ARG and then 4 bytes
+    int16_t arg = i > INT16_MIN && i <= INT16_MAX? i: CODE_WIDE_ARG;
+    code_grow(code, code->len + sizeof arg);
+    memcpy(&code->bytecodes[code->len - sizeof arg], &arg, sizeof arg);
+    if (arg == CODE_WIDE_ARG) code_push_offset(code, i);
+}
+
+int code_push_offset(code_t *code, int off) {
+    // returns where the offset went, for code_set_offset
+    int pos = code->len;
+    code_grow(code, pos + CODE_OFFSET_SIZE);
+    code_set_offset(code, pos, off);
+    return pos;
+}
+
+void code_set_offset(code_t *code, int pos, int off) {
+    int32_t off32 = off;
+    memcpy(&code->bytecodes[pos], &off32, sizeof off32);
+}
+
+int code_decode(code_t *code, int i, int *args) {
+    // reads the args of the instruction at i into args (if not NULL), and
+    // returns where the next instruction starts
+    instruction_t instruction = code->bytecodes[i++];
+    int n_args = instruction_args(instruction);
+    bool has_offset = instruction_has_offset(instruction);
+    for (int j = 0; j < n_args; j++) {
+        int arg = has_offset && j == n_args - 1?
+            code_read_offset(code->bytecodes, &i):
+            code_read_arg(code->bytecodes, &i);
+        if (args) args[j] = arg;
+    }
+    return i;
+}
+
+void code_append(code_t *code, code_t *src, int *str_map, int *code_map, int first_getter_cache) {
+    // Appends src's bytecodes (and loops) to code, changing the args which
+    // index into vm->str_cache and vm->code_cache to str_map[arg] and
+    // code_map[arg] (unless the map is NULL), and the getter cache ones by
+    // first_getter_cache.
+    // NOTE: since that can change the args' lengths, the jumps and loops get
+    // fixed up afterwards
+    int *new_pos = malloc((src->len + 1) * sizeof *new_pos); // by src position
+    if (!new_pos) {
+        fprintf(stderr, "Failed to allocate for code_append\n");
+        exit(1);
+    }
+    for (int i = 0; i < src->len;) {
+        instruction_t instruction = src->bytecodes[i];
+        int args[CODE_MAX_ARGS];
+        new_pos[i] = code->len;
+        i = code_decode(src, i, args);
+        code_push_instruction(code, instruction);
+        int n_args = instruction_args(instruction);
+        for (int j = 0; j < n_args; j++) {
+            int arg = args[j];
+            switch (instruction_arg_kind(instruction, j)) {
+                case ARG_STR: if (str_map) arg = str_map[arg]; break;
+                case ARG_CODE: if (code_map) arg = code_map[arg]; break;
+                case ARG_GETTER_CACHE: arg += first_getter_cache; break;
+                case ARG_OFFSET: code_push_offset(code, arg); continue;
+                default: break;
+            }
+            code_push_i(code, arg);
+        }
+    }
+    new_pos[src->len] = code->len;
+
+    for (int i = 0; i < src->len;) {
+        instruction_t instruction = src->bytecodes[i];
+        int args[CODE_MAX_ARGS];
+        i = code_decode(src, i, args);
+        if (!instruction_is_jump(instruction)) continue;
+        int new_next = new_pos[i];
+        int target = new_pos[i + args[instruction_args(instruction) - 1]];
+        code_set_offset(code, new_next - CODE_OFFSET_SIZE, target - new_next);
+    }
+    for (int j = 0; j < src->n_loops; j++) {
+        loop_t loop = src->loops[j];
+        loop.start = new_pos[loop.start];
+        loop.end = new_pos[loop.end];
+        loop.break_to = new_pos[loop.break_to];
+        loop.continue_to = new_pos[loop.continue_to];
+        *code_add_loop(code) = loop;
+    }
+    free(new_pos);
+}
+
+int code_add_getter_cache(code_t *code, const char *name) {
+    // returns the index of a new (empty) cache in code->getter_caches
+    int i = code->n_getter_caches;
+    getter_cache_t *caches = realloc(code->getter_caches, (i + 1) * sizeof *caches);
+    if (!caches) {
+        fprintf(stderr, "Failed to allocate getter caches\n");
+        exit(1);
+    }
+    caches[i] = (getter_cache_t){ .hash = hash_string(name), .sym = symbol_find(name) };
+    code->getter_caches = caches;
+    code->n_getter_caches = i + 1;
+    return i;
+}
+
+loop_t *code_add_loop(code_t *code) {
+    int i = code->n_loops;
+    loop_t *loops = realloc(code->loops, (i + 1) * sizeof *loops);
+    if (!loops) {
+        fprintf(stderr, "Failed to allocate code loops\n");
+        exit(1);
+    }
+    code->loops = loops;
+    code->n_loops = i + 1;
+    return &loops[i];
+}
+
+loop_t *code_find_loop(code_t *code, int i) {
+    // returns the innermost inlined loop containing bytecode i, or NULL
+    for (int j = 0; j < code->n_loops; j++) {
+        loop_t *loop = &code->loops[j];
+        if (i >= loop->start && i < loop->end) return loop;
+    }
+    return NULL;
+}
+
+
+/****************
+* OPTIMIZER
+****************/
+
+static bool code_fold_int_op(instruction_t instruction, int i, int j, int *result) {
+    // computes an int operator at compile time, if it's safe to
+    switch (instruction) {
+        case INSTR_DIV:
+        case INSTR_MOD:
+            // leave the error (or crash) for when the code is run
+            if (j == 0 || (j == -1 && i == INT_MIN)) return false;
+            // fall through
+        case INSTR_NEG:
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+        case INSTR_NOT:
+        case INSTR_AND:
+        case INSTR_OR:
+        case INSTR_XOR:
+            *result = int_op(instruction - FIRST_OP_INSTR, i, j);
+            return true;
+        default: return false;
+    }
+}
+
+// An instruction, decoded (see code_decode)
+struct decoded_instruction {
+    int pos; // where it was
+    instruction_t instruction;
+    int args[CODE_MAX_ARGS]; // with a jump's target (not offset) last
+};
+
+void code_optimize(code_t *code) {
+    // A peephole pass over code: fuses common sequences of instructions into
+    // superinstructions, and folds arithmetic on int constants.
+    // Nothing is fused across a jump target (or loop boundary).
+    // We decode the instructions, work on those, and then encode them
+    // again, fixing up the jump offsets and loops.
+    int len = code->len;
+    struct decoded_instruction *instrs = malloc(len * sizeof *instrs);
+    int *new_pos = malloc((len + 1) * sizeof *new_pos); // by old position
+    bool *is_target = calloc(len + 1, sizeof *is_target); // by old position
+    if (len && (!instrs || !new_pos || !is_target)) {
+        fprintf(stderr, "Failed to allocate for code_optimize\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < len;) {
+        instruction_t instruction = code->bytecodes[i];
+        int args[CODE_MAX_ARGS];
+        i = code_decode(code, i, args);
+        if (instruction_is_jump(instruction)) is_target[i + args[instruction_args(instruction) - 1]] = true;
+    }
+    for (int j = 0; j < code->n_loops; j++) {
+        loop_t *loop = &code->loops[j];
+        is_target[loop->start] = is_target[loop->end] = true;
+        is_target[loop->break_to] = is_target[loop->continue_to] = true;
+    }
+
+    int n = 0;
+    for (int i = 0; i < len;) {
+        int start = i;
+        instruction_t instruction = code->bytecodes[i];
+        int args[CODE_MAX_ARGS];
+        i = code_decode(code, i, args);
+        int n_args = instruction_args(instruction);
+        if (instruction_is_jump(instruction)) args[n_args - 1] += i;
+        bool is_op = instruction >= FIRST_OP_INSTR;
+        int arity = is_op? op_arities[instruction - FIRST_OP_INSTR]: 0;
+
+        // the instructions before us, if we can be fused with them
+        struct decoded_instruction *prev = n > 0 && !is_target[start]? &instrs[n - 1]: NULL;
+        instruction_t prev_instruction = prev? prev->instruction: N_INSTRS;
+        struct decoded_instruction *prev2 = prev && n > 1 && !is_target[prev->pos]?
+            &instrs[n - 2]: NULL;
+        instruction_t prev2_instruction = prev2? prev2->instruction: N_INSTRS;
+
+        int result;
+        if (
+            prev2_instruction == INSTR_LOAD_INT && prev_instruction == INSTR_LOAD_INT && arity == 2 &&
+            code_fold_int_op(instruction, prev2->args[0], prev->args[0], &result)
+        ) {
+            // LOAD_INT a, LOAD_INT b, op -> LOAD_INT (a op b)
+            prev2->args[0] = result;
+            n--;
+            continue;
+        }
+        if (
+            prev_instruction == INSTR_LOAD_INT && arity == 1 &&
+            code_fold_int_op(instruction, prev->args[0], 0, &result)
+        ) {
+            // LOAD_INT a, op -> LOAD_INT (op a)
+            prev->args[0] = result;
+            continue;
+        }
+        if (prev_instruction == INSTR_LOAD_INT && (
+            instruction == INSTR_ADD || instruction == INSTR_SUB || instruction == INSTR_LT
+        )) {
+            prev->instruction =
+                instruction == INSTR_ADD? INSTR_ADD_INT_CONST:
+                instruction == INSTR_SUB? INSTR_SUB_INT_CONST:
+                INSTR_LT_INT_CONST;
+            continue;
+        }
+        if (prev_instruction == INSTR_LOAD_LOCAL && instruction == INSTR_GETTER) {
+            prev->instruction = INSTR_LOAD_LOCAL_GETTER;
+            prev->args[1] = args[0];
+            prev->args[2] = args[1];
+            continue;
+        }
+        if (
+            prev_instruction == INSTR_STORE_LOCAL && instruction == INSTR_LOAD_LOCAL &&
+            prev->args[0] == args[0]
+        ) {
+            prev->instruction = INSTR_STORE_LOAD_LOCAL;
+            continue;
+        }
+        if ((
+            ((prev_instruction == INSTR_LOAD_LOCAL || prev_instruction == INSTR_STORE_LOAD_LOCAL) &&
+                instruction == INSTR_LOAD_LOCAL) ||
+            (prev_instruction == INSTR_LOAD_GLOBAL && instruction == INSTR_LOAD_GLOBAL)
+        ) && prev->args[0] == args[0]) {
+            // not fused, but at least DUP doesn't have to look anything up
+            instruction = INSTR_DUP;
+        }
+
+        // no luck, so the instruction stays as it is
+        struct decoded_instruction *instr = &instrs[n++];
+        instr->pos = start;
+        instr->instruction = instruction;
+        memcpy(instr->args, args, sizeof args);
+    }
+
+    // encode them again
+    // NOTE: targets are never fused into the instruction before them, so
+    // they're still at the start of an instruction
+    code->len = 0;
+    for (int j = 0; j < n; j++) {
+        struct decoded_instruction *instr = &instrs[j];
+        new_pos[instr->pos] = code->len;
+        code_push_instruction(code, instr->instruction);
+        int n_args = instruction_args(instr->instruction);
+        bool has_offset = instruction_has_offset(instr->instruction);
+        for (int k = 0; k < n_args; k++) {
+            if (has_offset && k == n_args - 1) {
+                // (a jump's is filled in below, once we know where
+                // everything is)
+                instr->pos = code_push_offset(code, instr->args[k]);
+            } else code_push_i(code, instr->args[k]);
+        }
+    }
+    new_pos[len] = code->len;
+
+    // point the jumps and loops at where their targets ended up
+    for (int j = 0; j < n; j++) {
+        struct decoded_instruction *instr = &instrs[j];
+        if (!instruction_is_jump(instr->instruction)) continue;
+        int target = new_pos[instr->args[instruction_args(instr->instruction) - 1]];
+        code_set_offset(code, instr->pos, target - (instr->pos + CODE_OFFSET_SIZE));
+    }
+    for (int j = 0; j < code->n_loops; j++) {
+        loop_t *loop = &code->loops[j];
+        loop->start = new_pos[loop->start];
+        loop->end = new_pos[loop->end];
+        loop->break_to = new_pos[loop->break_to];
+        loop->continue_to = new_pos[loop->continue_to];
+    }
+
+    free(instrs);
+    free(new_pos);
+    free(is_target);
 }
@@ -32,37 +32,58 @@ void compiler_print_position(compiler_t *compiler) {
 static compiler_frame_t *compiler_push_frame(compiler_t *compiler, bool is_func) {
     compiler_frame_t *frame = ++compiler->frame;
     frame->code = code_create(compiler->filename, compiler->row, compiler->col, is_func);
-    frame->n_locals = 0;
-    frame->locals = NULL;
+    frame->last_block = frame->prev_block = -1;
     if (is_func) compiler->last_func_frame = frame;
+    compiler_frame_t *last_func_frame = compiler->last_func_frame;
+    frame->code->scope = last_func_frame? last_func_frame->code: NULL;
     return frame;
 }
 
 static instruction_t compiler_process_global_ref(
-    compiler_t *compiler, instruction_t instruction, int str_cache_i
+    compiler_t *compiler, instruction_t instruction, int *i_ptr
 ) {
-    // Takes a GLOBAL instruction, plus its string cache index (i.e. the .i
-    // of the following bytecode).
+    // Takes a GLOBAL instruction, plus a pointer to its string cache index
+    // (i.e. the arg which will follow it).
     // Returns the instruction, *or* the instruction converted to LOCAL,
     // depending on whether we're in a function scope and the string is known
     // to be in that function's locals...
+    // In the latter case, *i_ptr is changed to the local's slot.
     compiler_frame_t *last_func_frame = compiler->last_func_frame;
     if (last_func_frame) {
-        for (int j = 0; j < last_func_frame->n_locals; j++) {
-            // Check whether
-            if (last_func_frame->locals[j] != str_cache_i) continue;
+        code_t *scope = last_func_frame->code;
+        for (int j = 0; j < scope->n_locals; j++) {
+            if (scope->locals[j] != *i_ptr) continue;
+            *i_ptr = j;
             return instruction + N_GLOBAL_INSTRS; // convert to LOCAL
         }
     }
     return instruction;
 }
 
+static void compiler_optimize_code(compiler_t *compiler, code_t *code, int depth) {
+    vm_t *vm = compiler->vm;
+    if (!vm->optimize) return;
+    if (vm->debug_print_code >= 2 && code->len) {
+        print_tabs(depth, stdout);
+        printf("Before optimization:\n");
+        vm_print_code(vm, code, depth);
+    }
+    code_optimize(code);
+    if (vm->debug_print_code >= 2 && code->len) {
+        // (the caller then prints the optimized code)
+        print_tabs(depth, stdout);
+        printf("After optimization:\n");
+    }
+}
+
 static compiler_frame_t *compiler_pop_frame(compiler_t *compiler) {
     if (compiler->frame < compiler->frames) {
         compiler_print_position(compiler);
         fprintf(stderr, "Tried to pop from an empty frame stack\n");
         exit(1);
     }
+    compiler_optimize_code(compiler, compiler->frame->code, compiler->frame - compiler->frames);
+    code_trim(compiler->frame->code);
     compiler_frame_t *popped_frame = compiler->frame--;
     if (popped_frame == compiler->last_func_frame) {
         // we were the last "func frame", but now we're being popped, so find
@@ -75,7 +96,6 @@ static compiler_frame_t *compiler_pop_frame(compiler_t *compiler) {
             }
         }
     }
-    free(popped_frame->locals); // currently our only use of free in this codebase... hooray?
     return popped_frame;
 }
 
@@ -126,7 +146,7 @@ static char *get_token(char *text, int *token_len_ptr) {
     return token;
 }
 
-static const char *parse_string_literal(compiler_t *compiler, const char *token, int token_len) {
+static char *parse_string_literal(compiler_t *compiler, const char *token, int token_len) {
     // NOTE: assumes token starts & ends with '"'.
 
     // Allocate at least enough to hold token, without the '"'s, plus a '\0'.
@@ -156,7 +176,8 @@ static bool is_ascii_letter(char c) {
     return c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z';
 }
 
-static const char *parse_name(compiler_t *compiler, const char *token) {
+static int parse_name(compiler_t *compiler, const char *token) {
+    // returns the index of name token in vm->str_cache
 
     // First, validate that the token looks like a name
     char first_c = *token;
@@ -180,38 +201,190 @@ static const char *parse_name(compiler_t *compiler, const char *token) {
         }
     }
 
-    const char *parsed = strdup(token);
-    if (!parsed) {
-        compiler_print_position(compiler);
-        fprintf(stderr, "Couldn't allocate name for token: [%s]\n", token);
-        exit(1);
-    }
-    return parsed;
+    // NOTE: the name is interned straight from the token (see
+    // vm_intern_str_i), so it's only copied the first time it's seen
+    return vm_intern_str_i(compiler->vm, token);
 }
 
 int parse_operator(const char *token) {
-    for (int op = 0; op < N_OPS; op++) {
-        if (!strcmp(token, operator_tokens[op])) return op;
-    }
-    return -1;
+    // operators are the first symbols
+    int sym = symbol_find(token);
+    return sym < N_OPS? sym: -1;
 }
 
-static void compiler_frame_push_local(compiler_t *compiler, compiler_frame_t *frame, int cached_str_i) {
-    // mark the indicated variable name as being local to frame->code
+static int compiler_frame_push_local(compiler_t *compiler, compiler_frame_t *frame, int cached_str_i) {
+    // mark the indicated variable name as being local to frame->code,
+    // returning its slot
     // NOTE: if we arrive here, frame->code->is_func must be true
-    for (int i = 0; i < frame->n_locals; i++) {
-        if (frame->locals[i] == cached_str_i) return; // already there
+    code_t *code = frame->code;
+    for (int i = 0; i < code->n_locals; i++) {
+        if (code->locals[i] == cached_str_i) return i; // already there
     }
-    int new_n_locals = frame->n_locals + 1;
-    int *new_locals = realloc(frame->locals, new_n_locals * sizeof *new_locals);
+    int new_n_locals = code->n_locals + 1;
+    int *new_locals = realloc(code->locals, new_n_locals * sizeof *new_locals);
     if (!new_locals) {
         compiler_print_position(compiler);
-        fprintf(stderr, "Failed to allocate compiler frame locals\n");
+        fprintf(stderr, "Failed to allocate code locals\n");
         exit(1);
     }
     new_locals[new_n_locals - 1] = cached_str_i;
-    frame->locals = new_locals;
-    frame->n_locals = new_n_locals;
+    code->locals = new_locals;
+    code->n_locals = new_n_locals;
+    return new_n_locals - 1;
+}
+
+static int find_inline_builtin(const char *name) {
+    for (int i = 0; i < N_INLINE_BUILTINS; i++) {
+        if (!strcmp(inline_builtin_names[i], name)) return i;
+    }
+    return -1;
+}
+
+static code_t *compiler_get_block(compiler_t *compiler, code_t *code, int pos) {
+    // returns the code of the block loaded by the LOAD_FUNC at pos
+    int i;
+    code_decode(code, pos, &i);
+    object_t *obj = compiler->vm->code_cache->elems[i];
+    func_t *func = obj->data.ptr;
+    return func->u.code;
+}
+
+static void compiler_push_block_code(code_t *code, code_t *block) {
+    // appends block's bytecodes to code
+    // NOTE: a block uses the locals of the function it was compiled inside
+    // of, same as the code it's inlined into, so only the getter cache
+    // indexes need to change
+    int first_cache = code->n_getter_caches;
+    for (int j = 0; j < block->n_getter_caches; j++) {
+        int k = code_add_getter_cache(code, "");
+        code->getter_caches[k] = block->getter_caches[j];
+    }
+    code_append(code, block, NULL, NULL, first_cache);
+}
+
+static int code_push_jump(code_t *code, instruction_t instruction) {
+    // pushes a jump whose offset will be filled in by code_patch_jump,
+    // returning the offset's position
+    code_push_instruction(code, instruction);
+    return code_push_offset(code, 0);
+}
+
+static void code_patch_jump(code_t *code, int pos) {
+    // makes the jump whose offset is at pos land at the end of code
+    code_set_offset(code, pos, code->len - (pos + CODE_OFFSET_SIZE));
+}
+
+static void code_push_jump_back(code_t *code, instruction_t instruction, int target) {
+    code_push_instruction(code, instruction);
+    code_push_offset(code, target - (code->len + CODE_OFFSET_SIZE));
+}
+
+static void code_push_loop(code_t *code, loop_t loop) {
+    // adds an inlined loop, turning the BREAKs and CONTINUEs in it into
+    // JUMPs (they're ours, since any loops inside were inlined first)
+    for (int i = loop.start; i < loop.end;) {
+        instruction_t instruction = code->bytecodes[i];
+        int pos = i;
+        i = code_decode(code, i, NULL);
+        if (instruction == INSTR_BREAK || instruction == INSTR_CONTINUE) {
+            int target = instruction == INSTR_BREAK? loop.break_to: loop.continue_to;
+            code->bytecodes[pos] = INSTR_JUMP;
+            code_set_offset(code, i - CODE_OFFSET_SIZE, target - i);
+        }
+    }
+    *code_add_loop(code) = loop;
+}
+
+static bool compiler_inline_builtin(compiler_t *compiler, compiler_frame_t *frame,
+    int builtin, int name_i
+) {
+    // Tries to compile a call of the given builtin (see inline_builtin_names)
+    // with its code blocks inlined into frame->code, instead of loading them
+    // and calling the global with name_i.
+    // The blocks must be literals, loaded just before the call (except for
+    // @for, whose iterable comes after its body).
+    // Returns whether it worked.
+    code_t *code = frame->code;
+    int n_blocks = builtin == INLINE_IFELSE || builtin == INLINE_WHILE? 2: 1;
+    int last = frame->last_block;
+    int prev = frame->prev_block;
+    if (last < 0) return false;
+    bool last_is_at_end = code_decode(code, last, NULL) == code->len;
+    if (builtin == INLINE_FOR) {
+        if (last_is_at_end) return false;
+    } else {
+        if (!last_is_at_end) return false;
+        if (n_blocks == 2 && (prev < 0 || code_decode(code, prev, NULL) != last)) return false;
+    }
+    code_t *block1 = compiler_get_block(compiler, code, n_blocks == 2? prev: last);
+    code_t *block2 = n_blocks == 2? compiler_get_block(compiler, code, last): NULL;
+    int body_i; // the @for body's index in vm->code_cache
+    code_decode(code, last, &body_i);
+
+    // The blocks' LOAD_FUNCs become part of the fallback, which just does
+    // the call as written.
+    // NOTE: @for's body was loaded before its iterable, so it stays where
+    // it is, and ITER checks that it's still underneath the iterable.
+    int block_is[2];
+    int n_loads = 0;
+    if (builtin != INLINE_FOR) {
+        if (n_blocks == 2) code_decode(code, prev, &block_is[n_loads++]);
+        code_decode(code, last, &block_is[n_loads++]);
+        code->len = n_blocks == 2? prev: last;
+    }
+    code_push_instruction(code, INSTR_CHECK_BUILTIN);
+    code_push_i(code, name_i);
+    code_push_i(code, builtin);
+    int check = code_push_offset(code, 0);
+    int fallback = code->len;
+    for (int j = 0; j < n_loads; j++) {
+        code_push_instruction(code, INSTR_LOAD_FUNC);
+        code_push_i(code, block_is[j]);
+    }
+    code_push_instruction(code, INSTR_CALL_GLOBAL);
+    code_push_i(code, name_i);
+    int fallback_done = code_push_jump(code, INSTR_JUMP);
+    code_patch_jump(code, check);
+
+    if (builtin == INLINE_IF) {
+        int skip = code_push_jump(code, INSTR_JUMP_IF_FALSE);
+        compiler_push_block_code(code, block1);
+        code_patch_jump(code, skip);
+    } else if (builtin == INLINE_IFELSE) {
+        int to_else = code_push_jump(code, INSTR_JUMP_IF_FALSE);
+        compiler_push_block_code(code, block1);
+        int done = code_push_jump(code, INSTR_JUMP);
+        code_patch_jump(code, to_else);
+        compiler_push_block_code(code, block2);
+        code_patch_jump(code, done);
+    } else if (builtin == INLINE_WHILE) {
+        int loop = code->len;
+        compiler_push_block_code(code, block1);
+        int done = code_push_jump(code, INSTR_JUMP_IF_FALSE);
+        compiler_push_block_code(code, block2);
+        code_push_jump_back(code, INSTR_JUMP, loop);
+        code_patch_jump(code, done);
+        code_push_loop(code, (loop_t){ .start = loop, .end = code->len,
+            .break_to = code->len, .continue_to = loop });
+    } else {
+        code_push_instruction(code, INSTR_ITER);
+        code_push_i(code, body_i);
+        code_push_offset(code, fallback - (code->len + CODE_OFFSET_SIZE));
+        int loop = code->len;
+        int done = code_push_jump(code, INSTR_FOR_ITER);
+        compiler_push_block_code(code, block1);
+        code_push_jump_back(code, INSTR_JUMP, loop);
+        int end = code->len;
+        code_push_instruction(code, INSTR_POP_ITER); // where @break goes
+        code_patch_jump(code, done);
+        code_push_loop(code, (loop_t){ .start = loop, .end = end,
+            .break_to = end, .continue_to = loop });
+    }
+    code_patch_jump(code, fallback_done);
+
+    // the blocks we knew about have been moved
+    frame->last_block = frame->prev_block = -1;
+    return true;
 }
 
 static void _compiler_compile(compiler_t *compiler, char *text, int depth) {
@@ -278,8 +451,9 @@ static void _compiler_compile(compiler_t *compiler, char *text, int depth) {
                 fprintf(stderr, "Unterminated string literal: [%s]\n", token);
                 exit(1);
             }
-            const char *s = parse_string_literal(compiler, token, token_len);
-            int i = vm_get_cached_str_i(vm, s);
+            char *s = parse_string_literal(compiler, token, token_len);
+            int i = vm_intern_str_i(vm, s);
+            free(s);
             code_push_instruction(code, INSTR_LOAD_STR);
             code_push_i(code, i);
         } else if ((op = parse_operator(token)) >= 0) {
@@ -289,22 +463,23 @@ static void _compiler_compile(compiler_t *compiler, char *text, int depth) {
             code_push_instruction(code, FIRST_OP_INSTR + op);
         } else if (first_c == '.') {
             // getter
-            const char *s = parse_name(compiler, token + 1);
-            int i = vm_get_cached_str_i(vm, s);
+            int i = parse_name(compiler, token + 1);
+            const char *s = vm->str_cache->items[i].name;
             code_push_instruction(code, INSTR_GETTER);
             code_push_i(code, i);
+            code_push_i(code, code_add_getter_cache(code, s));
         } else if (first_c == '=' && token[1] == '.') {
             // setter
-            const char *s = parse_name(compiler, token + 2);
-            int i = vm_get_cached_str_i(vm, s);
+            int i = parse_name(compiler, token + 2);
+            const char *s = vm->str_cache->items[i].name;
             code_push_instruction(code, INSTR_SETTER);
             code_push_i(code, i);
+            code_push_i(code, code_add_getter_cache(code, s));
         } else if (first_c == '\'') {
             // mark variable as local
             // TODO: get rid of this... the syntax is gross
             // and like, how do we declare a global?.. "''"?..
-            const char *s = parse_name(compiler, token + 1);
-            int i = vm_get_cached_str_i(vm, s);
+            int i = parse_name(compiler, token + 1);
             compiler_frame_t *last_func_frame = compiler->last_func_frame;
             if (!last_func_frame) {
                 compiler_print_position(compiler);
@@ -315,32 +490,43 @@ static void _compiler_compile(compiler_t *compiler, char *text, int depth) {
         } else if (first_c == '=') {
             // store global/local
             bool rename_func = token[1] == '@';
-            const char *s = parse_name(compiler, token + (rename_func? 2: 1));
-            int i = vm_get_cached_str_i(vm, s);
+            int i = parse_name(compiler, token + (rename_func? 2: 1));
             if (rename_func) {
                 code_push_instruction(code, INSTR_RENAME_FUNC);
                 code_push_i(code, i);
             }
             compiler_frame_t *last_func_frame = compiler->last_func_frame;
             if (last_func_frame) {
-                compiler_frame_push_local(compiler, last_func_frame, i);
+                i = compiler_frame_push_local(compiler, last_func_frame, i);
                 code_push_instruction(code, INSTR_STORE_LOCAL);
             } else {
                 code_push_instruction(code, INSTR_STORE_GLOBAL);
             }
             code_push_i(code, i);
+        } else if (
+            !strcmp(token, "@break") || !strcmp(token, "@continue") ||
+            !strcmp(token, "@return")
+        ) {
+            // NOTE: need to check for these before calls
+            if (token[1] == 'r') code_push_instruction(code, INSTR_RETURN);
+            else {
+                code_push_instruction(code, token[1] == 'b'? INSTR_BREAK: INSTR_CONTINUE);
+                code_push_offset(code, 0);
+            }
         } else if (first_c == '@' && token[1] != '\0') {
             // call global/local
-            const char *s = parse_name(compiler, token + 1);
-            int i = vm_get_cached_str_i(vm, s);
+            int i = parse_name(compiler, token + 1);
+            const char *s = vm->str_cache->items[i].name;
             instruction_t instruction = compiler_process_global_ref(compiler,
-                INSTR_CALL_GLOBAL, i);
-            code_push_instruction(code, instruction);
-            code_push_i(code, i);
+                INSTR_CALL_GLOBAL, &i);
+            int builtin = instruction == INSTR_CALL_GLOBAL? find_inline_builtin(s): -1;
+            if (builtin < 0 || !compiler_inline_builtin(compiler, frame, builtin, i)) {
+                code_push_instruction(code, instruction);
+                code_push_i(code, i);
+            }
         } else if (first_c == '$') {
             // rename func
-            const char *s = parse_name(compiler, token + 1);
-            int i = vm_get_cached_str_i(vm, s);
+            int i = parse_name(compiler, token + 1);
             code_push_instruction(code, INSTR_RENAME_FUNC);
             code_push_i(code, i);
         } else if (!strcmp(token, "(") || !strcmp(token, ")")) {
@@ -378,24 +564,28 @@ static void _compiler_compile(compiler_t *compiler, char *text, int depth) {
                 exit(1);
             }
             vm_push_code(vm, code);
+            int i = vm->code_cache->len - 1;
+            compiler_pop_frame(compiler);
 
             if (compiler->vm->debug_print_code) {
-                int depth = compiler->frame - compiler->frames;
-                vm_print_code(compiler->vm, compiler->frame->code, depth);
+                int depth = compiler->frame - compiler->frames + 1;
+                vm_print_code(compiler->vm, code, depth);
             }
 
-            int i = vm->code_cache->len - 1;
-            compiler_pop_frame(compiler);
             frame = compiler->frame;
             code = frame->code;
+            int pos = code->len;
             code_push_instruction(code, INSTR_LOAD_FUNC);
             code_push_i(code, i);
+            if (!was_func) {
+                frame->prev_block = frame->last_block;
+                frame->last_block = pos;
+            }
         } else {
             // load global/local
-            const char *s = parse_name(compiler, token);
-            int i = vm_get_cached_str_i(vm, s);
+            int i = parse_name(compiler, token);
             instruction_t instruction = compiler_process_global_ref(compiler,
-                INSTR_LOAD_GLOBAL, i);
+                INSTR_LOAD_GLOBAL, &i);
             code_push_instruction(code, instruction);
             code_push_i(code, i);
         }
@@ -412,10 +602,11 @@ void compiler_compile(compiler_t *compiler, char *text) {
 code_t *compiler_pop_runnable_code(compiler_t *compiler) {
     if (compiler->frame == compiler->frames) {
         code_t *code = (compiler->frame--)->code;
-        if (compiler->vm->debug_print_code && code->len) {
-            printf("Compiled top-level code:\n");
-            vm_print_code(compiler->vm, code, 1);
-        }
+        bool print_code = compiler->vm->debug_print_code && code->len;
+        if (print_code) printf("Compiled top-level code:\n");
+        compiler_optimize_code(compiler, code, 1);
+        code_trim(code);
+        if (print_code) vm_print_code(compiler->vm, code, 1);
         return code;
     } else return NULL;
 }
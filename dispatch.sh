@@ -0,0 +1,31 @@
+#!/bin/bash
+set -euo pipefail
+
+# Usage: ./dispatch.sh [PROGRAM.lala...]
+# Builds the interpreter, runs each program (default: examples/*.lala and
+# bench/*.lala) with and without the bytecode optimizer (see code_optimize),
+# and reports how many instructions were dispatched each way.
+# Programs which fail (or take longer than 10s) are skipped.
+
+CFLAGS="-O2 -rdynamic"
+mkdir -p bench/bin
+gcc $CFLAGS -o bench/bin/lalang *.c -ldl
+
+count() {
+    local optimize="$1" program="$2"
+    { cat "$program"; echo; echo "vm .instr_count @print"; } |
+        OPTIMIZE="$optimize" QUIET=1 timeout 10 bench/bin/lalang 2>/dev/null | tail -n 1
+}
+
+programs=("$@")
+if [ ${#programs[@]} -eq 0 ]; then programs=(examples/*.lala bench/*.lala); fi
+
+for program in "${programs[@]}"; do
+    if ! before=$(count 0 "$program") || ! after=$(count 1 "$program") ||
+        ! [[ "$before" =~ ^[0-9]+$ && "$after" =~ ^[0-9]+$ ]]; then
+        printf "%-28s failed\n" "$program"
+        continue
+    fi
+    awk -v name="$program" -v n0="$before" -v n1="$after" \
+        'BEGIN { printf "%-28s %12i -> %12i instrs (%5.1f%% fewer)\n", name, n0, n1, 100 * (n0 - n1) / n0 }'
+done
@@ -6,12 +6,18 @@
 #include "nlist.h"
 
 
+static void nlist_finalize(void *ptr) {
+    nlist_t *nlist = ptr;
+    free(nlist->elems);
+}
+
+static gc_kind_t nlist_gc_kind = {
+    .name = "nlist",
+    .finalize = nlist_finalize,
+};
+
 nlist_t *nlist_create(int len) {
-    nlist_t *nlist = calloc(1, sizeof *nlist);
-    if (!nlist) {
-        fprintf(stderr, "Failed to allocate nlist\n");
-        exit(1);
-    }
+    nlist_t *nlist = gc_alloc(sizeof *nlist, &nlist_gc_kind);
     int *elems = malloc(len * sizeof *elems);
     if (!elems) {
         fprintf(stderr, "Failed to allocate %i nlist elems\n", len);
@@ -82,9 +88,9 @@ void nlist_print(object_t *self) {
 bool nlist_type_getter(object_t *self, const char *name, vm_t *vm) {
     if (!strcmp(name, "@")) {
         object_t *obj = vm_pop(vm);
-        if (obj->type == &nlist_type) {
+        if (object_type(obj) == &nlist_type) {
             vm_push(vm, object_create_nlist(nlist_copy(obj->data.ptr)));
-        } else if (obj->type == &list_type) {
+        } else if (object_type(obj) == &list_type) {
             vm_push(vm, object_create_nlist(nlist_from_list(obj->data.ptr)));
         } else {
             list_t *list = list_create();
@@ -111,83 +117,118 @@ static object_t *nlist_next(iterator_t *it, vm_t *vm) {
     return vm_get_or_create_int(vm, nlist->elems[it->i]);
 }
 
-bool nlist_getter(object_t *self, const char *name, vm_t *vm) {
+static void nlist_len(object_t *self, int sym, vm_t *vm) {
     nlist_t *nlist = self->data.ptr;
-    int op;
-    if (!strcmp(name, "len")) {
-        vm_push(vm, vm_get_or_create_int(vm, nlist->len));
-    } else if (!strcmp(name, "__iter__")) {
-        iterator_t *it = iterator_create(ITER_CUSTOM, nlist->len,
-            (iterator_data_t){ .custom = { .next = nlist_next, .data = nlist } });
-        vm_push(vm, object_create_iterator(it));
-    } else if (!strcmp(name, "slice")) {
-        object_t *end_obj = vm_pop(vm);
-        int end = end_obj == &static_null? nlist->len: object_to_int(end_obj);
-        int start = object_to_int(vm_pop(vm));
-        iterator_t *it = iterator_create_slice(ITER_CUSTOM, nlist->len,
-            (iterator_data_t){ .custom = { .next = nlist_next, .data = nlist } },
-            start, end);
-        vm_push(vm, object_create_iterator(it));
-    } else if (!strcmp(name, "copy")) {
-        vm_push(vm, object_create_nlist(nlist_copy(nlist)));
-    } else if (!strcmp(name, "get")) {
-        object_t *i_obj = vm_pop(vm);
-        int i = object_to_int(i_obj);
-        vm_push(vm, vm_get_or_create_int(vm, nlist_get(nlist, i)));
-    } else if (!strcmp(name, "set")) {
-        int i = object_to_int(vm_pop(vm));
-        int value = object_to_int(vm_pop(vm));
-        nlist_set(nlist, i, value);
-    } else if (!strcmp(name, "to_list")) {
-        list_t *list = nlist_to_list(nlist, vm);
-        vm_push(vm, object_create_list(list));
-    } else if (
-        op = parse_operator(name),
-        op >= FIRST_INT_OP && op <= LAST_BOOL_OP
-    ) {
-        instruction_t instruction = FIRST_OP_INSTR + op;
-        bool is_unop = op_arities[op] == 1;
-        if (is_unop) {
+    vm_push(vm, vm_get_or_create_int(vm, nlist->len));
+}
+
+static void nlist_iter(object_t *self, int sym, vm_t *vm) {
+    nlist_t *nlist = self->data.ptr;
+    iterator_t *it = iterator_create(ITER_CUSTOM, nlist->len,
+        (iterator_data_t){ .custom = { .next = nlist_next, .data = nlist } });
+    vm_push(vm, object_create_iterator(it));
+}
+
+static void nlist_slice(object_t *self, int sym, vm_t *vm) {
+    nlist_t *nlist = self->data.ptr;
+    object_t *end_obj = vm_pop(vm);
+    int end = end_obj == &static_null? nlist->len: object_to_int(end_obj);
+    int start = object_to_int(vm_pop(vm));
+    iterator_t *it = iterator_create_slice(ITER_CUSTOM, nlist->len,
+        (iterator_data_t){ .custom = { .next = nlist_next, .data = nlist } },
+        start, end);
+    vm_push(vm, object_create_iterator(it));
+}
+
+static void nlist_copy_method(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, object_create_nlist(nlist_copy(self->data.ptr)));
+}
+
+static void nlist_get_method(object_t *self, int sym, vm_t *vm) {
+    object_t *i_obj = vm_pop(vm);
+    int i = object_to_int(i_obj);
+    vm_push(vm, vm_get_or_create_int(vm, nlist_get(self->data.ptr, i)));
+}
+
+static void nlist_set_method(object_t *self, int sym, vm_t *vm) {
+    int i = object_to_int(vm_pop(vm));
+    int value = object_to_int(vm_pop(vm));
+    nlist_set(self->data.ptr, i, value);
+}
+
+static void nlist_to_list_method(object_t *self, int sym, vm_t *vm) {
+    list_t *list = nlist_to_list(self->data.ptr, vm);
+    vm_push(vm, object_create_list(list));
+}
+
+static void nlist_op(object_t *self, int op, vm_t *vm) {
+    nlist_t *nlist = self->data.ptr;
+    bool is_unop = op_arities[op] == 1;
+    if (is_unop) {
+        int len = nlist->len;
+        for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i], 0);
+    } else {
+        object_t *other = vm_top(vm);
+        if (OBJECT_IS_INT(other)) {
+            vm->stack_top--;
+            int j = OBJECT_TO_INT(other);
             int len = nlist->len;
-            for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i], 0);
+            for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i], j);
+        } else if (object_type(other) == &list_type) {
+            vm->stack_top--;
+            list_t *other_list = other->data.ptr;
+            int len = MIN(nlist->len, other_list->len);
+            for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i],
+                object_to_int(other_list->elems[i]));
+        } else if (object_type(other) == &nlist_type) {
+            vm->stack_top--;
+            nlist_t *other_nlist = other->data.ptr;
+            int len = MIN(nlist->len, other_nlist->len);
+            for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i],
+                other_nlist->elems[i]);
         } else {
-            object_t *other = vm_top(vm);
-            if (other->type == &int_type) {
-                vm->stack_top--;
-                int j = other->data.i;
-                int len = nlist->len;
-                for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i], j);
-            } else if (other->type == &list_type) {
-                vm->stack_top--;
-                list_t *other_list = other->data.ptr;
-                int len = MIN(nlist->len, other_list->len);
-                for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i],
-                    object_to_int(other_list->elems[i]));
-            } else if (other->type == &nlist_type) {
-                vm->stack_top--;
-                nlist_t *other_nlist = other->data.ptr;
-                int len = MIN(nlist->len, other_nlist->len);
-                for (int i = 0; i < len; i++) nlist->elems[i] = int_op(op, nlist->elems[i],
-                    other_nlist->elems[i]);
-            } else {
-                int len = nlist->len;
-                object_t *obj_it = vm_iter(vm);
-                object_t *next_obj;
-                for (int i = 0; i < len && (next_obj = object_next(obj_it, vm)); i++) {
-                    nlist->elems[i] = int_op(op, nlist->elems[i], object_to_int(next_obj));
-                }
+            int len = nlist->len;
+            object_t *obj_it = vm_iter(vm);
+            object_t *next_obj;
+            for (int i = 0; i < len && (next_obj = object_next(obj_it, vm)); i++) {
+                nlist->elems[i] = int_op(op, nlist->elems[i], object_to_int(next_obj));
             }
         }
-        vm_push(vm, self);
-    } else return false;
-    return true;
+    }
+    vm_push(vm, self);
+}
+
+static method_t *nlist_methods[N_SYMS] = {
+    [SYM_LEN] = nlist_len,
+    [SYM_ITER] = nlist_iter,
+    [SYM_SLICE] = nlist_slice,
+    [SYM_COPY] = nlist_copy_method,
+    [SYM_GET] = nlist_get_method,
+    [SYM_SET] = nlist_set_method,
+    [SYM_TO_LIST] = nlist_to_list_method,
+    [SYM_NEG] = nlist_op,
+    [SYM_ADD] = nlist_op,
+    [SYM_SUB] = nlist_op,
+    [SYM_MUL] = nlist_op,
+    [SYM_DIV] = nlist_op,
+    [SYM_MOD] = nlist_op,
+    [SYM_NOT] = nlist_op,
+    [SYM_AND] = nlist_op,
+    [SYM_OR] = nlist_op,
+    [SYM_XOR] = nlist_op,
+};
+
+static void nlist_trace(object_t *self) {
+    // our elems are plain ints, so the nlist_t is all we need to keep alive
+    gc_mark(self->data.ptr);
 }
 
 type_t nlist_type = {
     .name = "nlist",
     .print = nlist_print,
+    .trace = nlist_trace,
     .type_getter = nlist_type_getter,
-    .getter = nlist_getter,
+    .methods = nlist_methods,
 };
 
 void nlist_init(vm_t *vm) {
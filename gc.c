@@ -0,0 +1,635 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+#include <limits.h>
+
+#include "lalang.h"
+
+
+/****************
+* GC
+****************/
+
+// A generational mark & sweep collector, which never moves anything.
+//
+// Small blocks are bump-allocated from chunks of an "arena" (gc.arena).
+// The chunks being allocated from are young (the "nursery"), and once
+// GC_NURSERY_CHUNKS of them are in use, we do a minor collection: we mark
+// the young blocks which are reachable, and then each young chunk is
+// either reset (if nothing in it survived) or promoted in place, i.e. it
+// becomes an old chunk.
+// Since most blocks die young, most chunks are simply reset.
+//
+// Minor collections don't trace through old blocks, except:
+// * the VM's roots (its globals, caches, etc)
+// * the remembered set, i.e. old blocks which have been made to point at
+//   young ones (see gc_write_barrier)
+// * blocks pointed at by the C stack, which may be half-initialized (we
+//   also remember these until the next minor collection, since whatever C
+//   code is holding them can store young pointers in them without a write
+//   barrier)
+//
+// Once enough bytes have become old (gc.threshold), we do a major
+// collection, which marks & sweeps everything.
+//
+// Big blocks are malloced, and are always old.
+//
+// Major collections also put the free space in old chunks (runs of dead
+// blocks, and whatever was left unused when the chunk was promoted) onto
+// free lists ("pools") by size, and gc_alloc takes blocks from these
+// before bump-allocating.
+// Blocks from the pools are in old chunks, so they're old; until the next
+// minor collection they're remembered, since they're being initialized.
+//
+// Anything on the C stack (or in registers) which looks like a pointer to
+// a block keeps it alive, so C code doesn't need to register the objects
+// it's holding onto. Other pointers (e.g. to static objects, or to strings
+// allocated by the compiler) are simply ignored.
+
+typedef struct gc_header {
+    gc_kind_t *kind; // NULL if the block has been freed
+    unsigned size;
+    bool marked;
+    bool remembered;
+} gc_header_t;
+
+// Round headers and blocks up to 16 bytes, so blocks are as aligned as
+// malloc's
+#define GC_ALIGN(_size) (((_size) + 15) & ~(size_t)15)
+#define GC_HEADER_SIZE GC_ALIGN(sizeof(gc_header_t))
+#define GC_HEADER(_ptr) ((gc_header_t *)((char *)(_ptr) - GC_HEADER_SIZE))
+#define GC_BLOCK_SIZE(_header) (GC_HEADER_SIZE + GC_ALIGN((_header)->size))
+
+#define GC_NURSERY_CHUNKS 32 // minor collection once this many are young
+#define GC_MAX_SMALL_SIZE (GC_CHUNK_SIZE / 16) // bigger blocks are malloced
+#define GC_CHUNK_STARTS_SIZE (GC_CHUNK_SIZE / 16 / 8)
+
+gc_t gc = {
+    .threshold = GC_DEFAULT_THRESHOLD,
+};
+
+typedef enum gc_phase {
+    GC_IDLE,
+    GC_MINOR_ROOTS, // marking young blocks, and tracing old roots
+    GC_MINOR, // marking young blocks
+    GC_MAJOR, // marking everything
+} gc_phase_t;
+
+static gc_phase_t gc_phase;
+
+// A growable array of blocks
+typedef struct gc_vec {
+    void **ptrs;
+    size_t len;
+    size_t size;
+} gc_vec_t;
+
+static gc_vec_t gc_mark_stack;
+static gc_vec_t gc_visited; // old blocks marked during a minor collection
+static gc_vec_t gc_remembered;
+static gc_vec_t gc_stack_blocks; // blocks found on the C stack
+static gc_vec_t gc_big_blocks; // malloced blocks
+
+// Open-addressing hash set of gc_big_blocks (NULL means empty), at most
+// half full
+static void **gc_big_set;
+static size_t gc_big_set_size; // always 0 or a power of 2
+
+// For each arena chunk, a bitmap of which 16-byte offsets hold a block,
+// so we can tell which pointers into the arena are blocks
+static unsigned char (*gc_chunk_starts)[GC_CHUNK_STARTS_SIZE];
+static int gc_chunk_used[GC_N_CHUNKS]; // bytes allocated from each chunk
+static int gc_chunk_live[GC_N_CHUNKS]; // live blocks in each old chunk
+static int gc_n_young_chunks;
+
+// The chunk we're bump-allocating from
+static char *gc_bump;
+static char *gc_bump_end;
+static int gc_bump_chunk;
+
+// Free blocks in old chunks, indexed by GC_POOL; each block's data holds
+// a pointer to the next one
+#define GC_POOL(_size) ((_size) / 16 < GC_N_POOLS - 1? (_size) / 16: GC_N_POOLS - 1)
+#define GC_MIN_POOLED_SIZE 16 // room for the next pointer
+#define GC_POOL_WORDS ((GC_N_POOLS + 63) / 64)
+static void *gc_pools[GC_N_POOLS];
+static uint64_t gc_pools_nonempty[GC_POOL_WORDS]; // bitmap
+
+#ifdef __GLIBC__
+// The top of the main thread's stack, as found by glibc at startup
+extern void *__libc_stack_end;
+#endif
+
+gc_kind_t str_gc_kind = {
+    .name = "str",
+};
+
+static void gc_vec_push(gc_vec_t *vec, void *ptr) {
+    if (vec->len >= vec->size) {
+        size_t new_size = vec->size? vec->size * 2: 256;
+        void **new_ptrs = realloc(vec->ptrs, new_size * sizeof *new_ptrs);
+        if (!new_ptrs) {
+            fprintf(stderr, "Failed to grow GC array to %zu\n", new_size);
+            exit(1);
+        }
+        vec->ptrs = new_ptrs;
+        vec->size = new_size;
+    }
+    vec->ptrs[vec->len++] = ptr;
+}
+
+static size_t gc_hash(void *ptr) {
+    uintptr_t i = (uintptr_t)ptr >> 4;
+    return (size_t)(i * 0x9E3779B97F4A7C15ULL);
+}
+
+static void **gc_find_big_block(void **set, size_t size, void *ptr) {
+    // returns the entry of set holding ptr, or the empty one where it
+    // would go
+    size_t mask = size - 1;
+    for (size_t i = gc_hash(ptr) & mask;; i = (i + 1) & mask) {
+        void **entry = &set[i];
+        if (!*entry || *entry == ptr) return entry;
+    }
+}
+
+static void gc_rebuild_big_set(void) {
+    size_t size = 1024;
+    while (size < gc_big_blocks.len * 4) size *= 2;
+    void **set = calloc(size, sizeof *set);
+    if (!set) {
+        fprintf(stderr, "Failed to allocate GC table of size %zu\n", size);
+        exit(1);
+    }
+    for (size_t i = 0; i < gc_big_blocks.len; i++) {
+        void *ptr = gc_big_blocks.ptrs[i];
+        *gc_find_big_block(set, size, ptr) = ptr;
+    }
+    free(gc_big_set);
+    gc_big_set = set;
+    gc_big_set_size = size;
+}
+
+static int gc_chunk_index(void *ptr) {
+    // returns the arena chunk ptr points into, or -1
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)gc.arena;
+    if (!gc.arena || offset >= (uintptr_t)GC_N_CHUNKS * GC_CHUNK_SIZE) return -1;
+    return offset / GC_CHUNK_SIZE;
+}
+
+static int gc_start_index(void *ptr, int chunk) {
+    // returns the index into gc_chunk_starts[chunk] for a block at ptr, or
+    // -1 if there couldn't be one there
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)gc.arena - (uintptr_t)chunk * GC_CHUNK_SIZE;
+    if (offset % 16 || offset < GC_HEADER_SIZE) return -1;
+    return (offset - GC_HEADER_SIZE) / 16;
+}
+
+static bool gc_is_block(void *ptr) {
+    int chunk = gc_chunk_index(ptr);
+    if (chunk >= 0) {
+        int i = gc_start_index(ptr, chunk);
+        return i >= 0 && gc_chunk_starts[chunk][i / 8] & (1 << i % 8);
+    } else {
+        return gc_big_set_size && *gc_find_big_block(gc_big_set, gc_big_set_size, ptr) == ptr;
+    }
+}
+
+static void gc_set_start(void *ptr, bool start) {
+    // NOTE: ptr must be a block in the arena
+    int chunk = gc_chunk_index(ptr);
+    int i = gc_start_index(ptr, chunk);
+    if (start) gc_chunk_starts[chunk][i / 8] |= 1 << i % 8;
+    else gc_chunk_starts[chunk][i / 8] &= ~(1 << i % 8);
+}
+
+static void gc_init_arena(void) {
+    // NOTE: the OS won't actually give us memory for chunks until we use them
+    gc.arena = malloc((size_t)GC_N_CHUNKS * GC_CHUNK_SIZE);
+    gc_chunk_starts = calloc(GC_N_CHUNKS, sizeof *gc_chunk_starts);
+    if (!gc.arena || !gc_chunk_starts) {
+        fprintf(stderr, "Failed to allocate GC arena\n");
+        exit(1);
+    }
+}
+
+static bool gc_next_chunk(void) {
+    // start bump-allocating from a free chunk, returning false if there
+    // aren't any
+    if (gc_n_young_chunks >= GC_NURSERY_CHUNKS && gc.vms && gc_phase == GC_IDLE) {
+        gc_minor_collect();
+    }
+    gc_bump = gc_bump_end = NULL;
+    for (int chunk = 0; chunk < GC_N_CHUNKS; chunk++) {
+        if (gc.chunk_states[chunk] != GC_CHUNK_FREE) continue;
+        gc.chunk_states[chunk] = GC_CHUNK_YOUNG;
+        gc_chunk_used[chunk] = 0;
+        gc_n_young_chunks++;
+        gc_bump_chunk = chunk;
+        gc_bump = gc.arena + (size_t)chunk * GC_CHUNK_SIZE;
+        gc_bump_end = gc_bump + GC_CHUNK_SIZE;
+        return true;
+    }
+    return false;
+}
+
+static void *gc_alloc_big(size_t size, gc_kind_t *kind) {
+    if (
+        gc.allocated >= gc.threshold &&
+        gc.allocated >= gc.live - gc.allocated &&
+        gc.vms && gc_phase == GC_IDLE
+    ) gc_collect();
+
+    gc_header_t *header = calloc(1, GC_HEADER_SIZE + size);
+    if (!header) {
+        fprintf(stderr, "Failed to allocate %zu bytes for %s\n", size, kind->name);
+        exit(1);
+    }
+    header->kind = kind;
+    header->size = size;
+    void *ptr = (char *)header + GC_HEADER_SIZE;
+
+    gc_vec_push(&gc_big_blocks, ptr);
+    if (gc_big_blocks.len * 2 > gc_big_set_size) gc_rebuild_big_set();
+    else *gc_find_big_block(gc_big_set, gc_big_set_size, ptr) = ptr;
+    gc.n_blocks++;
+    gc.allocated += GC_BLOCK_SIZE(header);
+    gc.live += GC_BLOCK_SIZE(header);
+    return ptr;
+}
+
+static void gc_pool_push(gc_header_t *header) {
+    // NOTE: header->kind should be NULL
+    int pool = GC_POOL(header->size);
+    void **ptr = (void **)((char *)header + GC_HEADER_SIZE);
+    *ptr = gc_pools[pool];
+    gc_pools[pool] = ptr;
+    gc_pools_nonempty[pool / 64] |= (uint64_t)1 << pool % 64;
+    gc.pool_blocks[pool]++;
+    gc.pool_bytes += GC_BLOCK_SIZE(header);
+}
+
+static void *gc_pool_pop(int pool) {
+    void **ptr = gc_pools[pool];
+    gc_pools[pool] = *ptr;
+    if (!*ptr) gc_pools_nonempty[pool / 64] &= ~((uint64_t)1 << pool % 64);
+    gc.pool_blocks[pool]--;
+    gc.pool_bytes -= GC_BLOCK_SIZE(GC_HEADER(ptr));
+    return ptr;
+}
+
+static int gc_find_pool(int pool) {
+    // returns the first nonempty pool from pool onwards, or -1
+    for (int i = pool / 64; i < GC_POOL_WORDS; i++) {
+        uint64_t bits = gc_pools_nonempty[i];
+        if (i == pool / 64) bits &= ~(uint64_t)0 << pool % 64;
+        if (bits) return i * 64 + __builtin_ctzll(bits);
+    }
+    return -1;
+}
+
+static void gc_clear_pools(void) {
+    memset(gc_pools, 0, sizeof gc_pools);
+    memset(gc_pools_nonempty, 0, sizeof gc_pools_nonempty);
+    memset(gc.pool_blocks, 0, sizeof gc.pool_blocks);
+    gc.pool_bytes = 0;
+}
+
+static void *gc_alloc_pooled(size_t size, gc_kind_t *kind) {
+    // allocates from the pools, returning NULL if there's nothing big enough
+    size_t aligned_size = GC_ALIGN(size);
+    int pool = gc_find_pool(GC_POOL(aligned_size));
+    if (pool < 0) return NULL;
+    void *ptr = gc_pool_pop(pool);
+    gc_header_t *header = GC_HEADER(ptr);
+
+    // pools hold blocks of a range of sizes, and the last one holds
+    // everything too big for the others, so split off what we don't need
+    size_t spare = header->size - aligned_size;
+    if (spare >= GC_HEADER_SIZE + GC_MIN_POOLED_SIZE) {
+        gc_header_t *rest = (gc_header_t *)((char *)ptr + aligned_size);
+        rest->kind = NULL;
+        rest->size = spare - GC_HEADER_SIZE;
+        gc_pool_push(rest);
+    } else {
+        // the block keeps its size, so we can still walk the chunk
+        size = header->size;
+    }
+
+    memset(header, 0, GC_HEADER_SIZE + GC_ALIGN(size));
+    header->kind = kind;
+    header->size = size;
+    header->remembered = true;
+    gc_vec_push(&gc_remembered, ptr);
+    gc_set_start(ptr, true);
+    gc_chunk_live[gc_chunk_index(ptr)]++;
+    gc.n_blocks++;
+    gc.allocated += GC_BLOCK_SIZE(header);
+    gc.live += GC_BLOCK_SIZE(header);
+    return ptr;
+}
+
+void *gc_alloc(size_t size, gc_kind_t *kind) {
+    // allocates a zeroed block, which will be freed once it's no longer
+    // reachable from any VM's roots or the C stack
+    if (size > GC_MAX_SMALL_SIZE) return gc_alloc_big(size, kind);
+    if (!gc.arena) gc_init_arena();
+
+    if (gc.pool_bytes) {
+        void *ptr = gc_alloc_pooled(size, kind);
+        if (ptr) return ptr;
+    }
+
+    size_t block_size = GC_HEADER_SIZE + GC_ALIGN(size);
+    if (gc_bump + block_size > gc_bump_end && !gc_next_chunk()) {
+        // the arena is full
+        return gc_alloc_big(size, kind);
+    }
+    gc_header_t *header = (gc_header_t *)gc_bump;
+    gc_bump += block_size;
+    gc_chunk_used[gc_bump_chunk] += block_size;
+    memset(header, 0, block_size);
+    header->kind = kind;
+    header->size = size;
+    void *ptr = (char *)header + GC_HEADER_SIZE;
+    gc_set_start(ptr, true);
+    return ptr;
+}
+
+char *gc_strdup(const char *s) {
+    size_t size = strlen(s) + 1;
+    char *s2 = gc_alloc(size, &str_gc_kind);
+    memcpy(s2, s, size);
+    return s2;
+}
+
+void gc_add_vm(vm_t *vm) {
+    // start treating the VM's stack, globals, etc as roots
+    vm->gc_next = gc.vms;
+    gc.vms = vm;
+    if (!gc.stack_base) {
+#ifdef __GLIBC__
+        gc.stack_base = __libc_stack_end;
+#else
+        // hopefully we were called from somewhere near the bottom of the
+        // stack, e.g. main -> vm_create
+        gc.stack_base = __builtin_frame_address(0);
+#endif
+    }
+}
+
+void gc_remember(void *ptr) {
+    // called by gc_write_barrier when ptr (which isn't young) has been
+    // made to point at a young block
+    if (!gc_is_block(ptr)) return;
+    gc_header_t *header = GC_HEADER(ptr);
+    if (header->remembered) return;
+    header->remembered = true;
+    gc_vec_push(&gc_remembered, ptr);
+}
+
+static void gc_mark_block(void *ptr) {
+    gc_header_t *header = GC_HEADER(ptr);
+    if (header->marked) return;
+    header->marked = true;
+    if (header->kind->trace) gc_vec_push(&gc_mark_stack, ptr);
+}
+
+void gc_mark(void *ptr) {
+    // marks ptr as reachable, if it's one of our blocks
+    // NOTE: only has an effect while collecting, e.g. from gc_kind_t.trace
+    if (!ptr || OBJECT_IS_INT(ptr) || gc_phase == GC_IDLE) return;
+    if (!gc_is_block(ptr)) return;
+    if (gc_phase == GC_MAJOR || gc_is_young(ptr)) {
+        gc_mark_block(ptr);
+    } else if (gc_phase == GC_MINOR_ROOTS && !GC_HEADER(ptr)->marked) {
+        // an old root: trace it, in case it points at young blocks
+        gc_mark_block(ptr);
+        gc_vec_push(&gc_visited, ptr);
+    }
+}
+
+static void gc_mark_range(void **start, void **end) {
+    for (void **p = start; p < end; p++) {
+        void *ptr = *p;
+        if (!ptr || OBJECT_IS_INT(ptr) || !gc_is_block(ptr)) continue;
+        gc_vec_push(&gc_stack_blocks, ptr);
+        gc_mark(ptr);
+    }
+}
+
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+static void gc_mark_c_stack_above(void) {
+    // marks everything on the C stack, from our caller's frame (which has
+    // the registers spilled into it) up to the base
+    void *top = NULL;
+    void **start = (void **)((uintptr_t)&top & ~(uintptr_t)(sizeof top - 1));
+    gc_mark_range(start, gc.stack_base);
+}
+
+static void gc_mark_c_stack(void) {
+    // make sure pointers which are only held in registers are on the stack
+    jmp_buf regs;
+#ifdef __GNUC__
+    __builtin_unwind_init();
+#endif
+    setjmp(regs);
+    gc_mark_range((void **)&regs, (void **)(&regs + 1));
+    gc_mark_c_stack_above();
+}
+
+static void gc_mark_roots(void) {
+    gc_stack_blocks.len = 0;
+    for (vm_t *vm = gc.vms; vm; vm = vm->gc_next) vm_gc_mark_roots(vm);
+    gc_mark_c_stack();
+}
+
+static void gc_drain(void) {
+    while (gc_mark_stack.len) {
+        void *ptr = gc_mark_stack.ptrs[--gc_mark_stack.len];
+        GC_HEADER(ptr)->kind->trace(ptr);
+    }
+}
+
+static long gc_free_block(gc_header_t *header) {
+    // finalizes & frees a block, returning its size
+    void *ptr = (char *)header + GC_HEADER_SIZE;
+    long size = GC_BLOCK_SIZE(header);
+    if (header->kind->finalize) header->kind->finalize(ptr);
+    header->kind = NULL;
+    if (gc_chunk_index(ptr) >= 0) gc_set_start(ptr, false);
+    else free(header);
+    return size;
+}
+
+static void gc_reset_chunk(int chunk) {
+    gc.chunk_states[chunk] = GC_CHUNK_FREE;
+    memset(gc_chunk_starts[chunk], 0, GC_CHUNK_STARTS_SIZE);
+}
+
+static void gc_pool_run(char *start, char *end) {
+    // turns a run of free blocks into a single one, and pools it
+    gc_header_t *header = (gc_header_t *)start;
+    header->kind = NULL;
+    header->size = end - start - GC_HEADER_SIZE;
+    if (header->size >= GC_MIN_POOLED_SIZE) gc_pool_push(header);
+}
+
+static void gc_pool_chunk(int chunk) {
+    // pools the free space in an old chunk
+    char *start = gc.arena + (size_t)chunk * GC_CHUNK_SIZE;
+    char *end = start + gc_chunk_used[chunk];
+    char *run = NULL;
+    for (char *p = start; p < end;) {
+        gc_header_t *header = (gc_header_t *)p;
+        if (header->kind) {
+            if (run) gc_pool_run(run, p);
+            run = NULL;
+        } else if (!run) run = p;
+        p += GC_BLOCK_SIZE(header);
+    }
+
+    // the part of the chunk we never got round to using
+    // NOTE: end is never past chunk_end, so its distance fits in a size_t
+    char *chunk_end = start + GC_CHUNK_SIZE;
+    if ((size_t)(chunk_end - end) >= GC_HEADER_SIZE + GC_MIN_POOLED_SIZE) {
+        if (!run) run = end;
+        end = chunk_end;
+        gc_chunk_used[chunk] = GC_CHUNK_SIZE;
+    }
+    if (run) gc_pool_run(run, end);
+}
+
+void gc_minor_collect(void) {
+    // Mark the young blocks reachable from the roots, the C stack, and the
+    // remembered set
+    gc_phase = GC_MINOR_ROOTS;
+    gc_mark_roots();
+    for (size_t i = 0; i < gc_remembered.len; i++) {
+        void *ptr = gc_remembered.ptrs[i];
+        GC_HEADER(ptr)->remembered = false;
+        gc_mark(ptr);
+    }
+    gc_remembered.len = 0;
+    gc_phase = GC_MINOR;
+    gc_drain();
+
+    // Sweep the young chunks, promoting the ones with survivors
+    long freed = 0;
+    for (int chunk = 0; chunk < GC_N_CHUNKS; chunk++) {
+        if (gc.chunk_states[chunk] != GC_CHUNK_YOUNG) continue;
+        char *start = gc.arena + (size_t)chunk * GC_CHUNK_SIZE;
+        char *end = start + gc_chunk_used[chunk];
+        int n_live = 0;
+        long live = 0;
+        for (char *p = start; p < end;) {
+            gc_header_t *header = (gc_header_t *)p;
+            p += GC_BLOCK_SIZE(header);
+            if (header->marked) {
+                header->marked = false;
+                n_live++;
+                live += GC_BLOCK_SIZE(header);
+            } else freed += gc_free_block(header);
+        }
+        if (n_live) {
+            gc.chunk_states[chunk] = GC_CHUNK_OLD;
+            gc_chunk_live[chunk] = n_live;
+            gc.n_blocks += n_live;
+            gc.live += live;
+            gc.allocated += live;
+        } else gc_reset_chunk(chunk);
+    }
+    gc_n_young_chunks = 0;
+    gc_bump = gc_bump_end = NULL;
+
+    for (size_t i = 0; i < gc_visited.len; i++) GC_HEADER(gc_visited.ptrs[i])->marked = false;
+    gc_visited.len = 0;
+
+    // Blocks pointed at by the C stack may be in the middle of being
+    // initialized, so keep an eye on them until the next minor collection
+    for (size_t i = 0; i < gc_stack_blocks.len; i++) gc_remember(gc_stack_blocks.ptrs[i]);
+
+    gc_phase = GC_IDLE;
+    gc.minor_collections++;
+    gc.reclaimed += freed;
+
+    if (
+        gc.allocated >= gc.threshold &&
+        gc.allocated >= gc.live - gc.allocated
+    ) gc_collect();
+}
+
+void gc_collect(void) {
+    // A major collection
+
+    // Start with a minor collection, so everything is old
+    if (gc_n_young_chunks) {
+        long threshold = gc.threshold;
+        gc.threshold = LONG_MAX; // ...without it calling us back
+        gc_minor_collect();
+        gc.threshold = threshold;
+    }
+
+    gc_phase = GC_MAJOR;
+    gc_mark_roots();
+    gc_drain();
+
+    // Forget remembered blocks which are about to be freed
+    size_t n_remembered = 0;
+    for (size_t i = 0; i < gc_remembered.len; i++) {
+        void *ptr = gc_remembered.ptrs[i];
+        if (GC_HEADER(ptr)->marked) gc_remembered.ptrs[n_remembered++] = ptr;
+    }
+    gc_remembered.len = n_remembered;
+
+    // Sweep the old chunks, rebuilding the pools
+    gc_clear_pools();
+    long freed = 0;
+    long n_freed = 0;
+    for (int chunk = 0; chunk < GC_N_CHUNKS; chunk++) {
+        if (gc.chunk_states[chunk] != GC_CHUNK_OLD) continue;
+        char *start = gc.arena + (size_t)chunk * GC_CHUNK_SIZE;
+        char *end = start + gc_chunk_used[chunk];
+        for (char *p = start; p < end;) {
+            gc_header_t *header = (gc_header_t *)p;
+            p += GC_BLOCK_SIZE(header);
+            if (!header->kind) continue; // freed already
+            if (header->marked) header->marked = false;
+            else {
+                freed += gc_free_block(header);
+                n_freed++;
+                gc_chunk_live[chunk]--;
+            }
+        }
+        if (!gc_chunk_live[chunk]) gc_reset_chunk(chunk);
+        else gc_pool_chunk(chunk);
+    }
+
+    // Sweep the big blocks
+    size_t n_big_blocks = 0;
+    for (size_t i = 0; i < gc_big_blocks.len; i++) {
+        void *ptr = gc_big_blocks.ptrs[i];
+        gc_header_t *header = GC_HEADER(ptr);
+        if (header->marked) {
+            header->marked = false;
+            gc_big_blocks.ptrs[n_big_blocks++] = ptr;
+        } else {
+            freed += gc_free_block(header);
+            n_freed++;
+        }
+    }
+    gc_big_blocks.len = n_big_blocks;
+    gc_rebuild_big_set();
+
+    gc_phase = GC_IDLE;
+    gc.n_blocks -= n_freed;
+    gc.live -= freed;
+    gc.reclaimed += freed;
+    gc.collections++;
+    gc.allocated = 0;
+}
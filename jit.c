@@ -0,0 +1,823 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lalang.h"
+
+
+/****************
+* JIT
+****************/
+
+// A baseline JIT for x86-64: once a code_t is hot (see VM_JIT_THRESHOLD),
+// vm_eval has jit_compile paste together a template of machine code for
+// each of its instructions.
+// Jumps are real jumps, and trivial instructions (e.g. LOAD_LOCAL, or ADD
+// with two ints) are done right there; anything else calls the
+// instruction's helper below.
+// The machine code runs until it gets to something only vm_eval can do,
+// i.e. calling a function with bytecode, or @break, @continue or @return
+// (or unwinding from one of them), and then returns where vm_eval should
+// carry on from.
+
+struct jit {
+    unsigned char *mem; // the machine code, starting with jit_run's stub
+    size_t size;
+
+    // where the machine code for each bytecode position starts (NULL if
+    // it's not the start of an instruction), up to and including code->len
+    unsigned char **entries;
+
+    struct jit_op *ops; // the instructions, decoded for the helpers
+};
+
+// An instruction, as its helper sees it
+struct jit_op {
+    instruction_t instruction;
+    int i; // where it is in code->bytecodes
+    int next; // ...and where the next one is
+    int args[CODE_MAX_ARGS];
+};
+
+#if defined(__x86_64__)
+
+// A helper gets its instruction, decoded, and returns JIT_NEXT to carry on,
+// JIT_JUMP if the instruction is a jump which is taken, or else the position
+// vm_eval should carry on from.
+#define JIT_NEXT -1
+#define JIT_JUMP -2
+typedef int jit_helper_t(vm_t *vm, struct jit_op *op);
+
+// after anything which may have run a code block doing @break, @continue
+// or @return: vm_eval unwinds from after the instruction
+#define JIT_DONE() return vm->unwind? op->next: JIT_NEXT
+
+static object_t *jit_get_global(vm_t *vm, int j) {
+    dict_item_t *item = vm_get_global_item(vm, j);
+    if (!item) {
+        fprintf(stderr, "Global variable not found: %s\n", vm->str_cache->items[j].name);
+        exit(1);
+    }
+    return item->value;
+}
+
+static object_t *jit_get_local(vm_t *vm, int j) {
+    call_frame_t *call = vm->frames_top;
+    if (!call->locals) {
+        fprintf(stderr, "Tried to load local variable '%s', but there are no locals\n",
+            vm_get_local_name(vm, call->code->scope, j));
+        exit(1);
+    }
+    object_t *obj = call->locals->slots[j];
+    if (!obj) {
+        fprintf(stderr, "Local variable not found: %s\n", vm_get_local_name(vm, call->code->scope, j));
+        exit(1);
+    }
+    return obj;
+}
+
+static void jit_set_local(vm_t *vm, int j, object_t *obj) {
+    call_frame_t *call = vm->frames_top;
+    if (!call->locals) {
+        fprintf(stderr, "Tried to store to local variable '%s', but there are no locals\n",
+            vm_get_local_name(vm, call->code->scope, j));
+        exit(1);
+    }
+    call->locals->slots[j] = obj;
+}
+
+static int jit_call(vm_t *vm, struct jit_op *op, object_t *callee) {
+    // functions (and code blocks) with bytecode get a new frame, which is
+    // up to vm_eval, so we leave the instruction to it (and let it count it)
+    if (object_type(callee) == &func_type && !((func_t *)callee->data.ptr)->is_c_code) {
+        vm->instr_count--;
+        return op->i;
+    }
+    object_method(callee, SYM_CALL, "@", vm);
+    JIT_DONE();
+}
+
+static int jit_LOAD_INT(vm_t *vm, struct jit_op *op) {
+    vm_push(vm, vm_get_or_create_int(vm, op->args[0]));
+    return JIT_NEXT;
+}
+
+static int jit_LOAD_STR(vm_t *vm, struct jit_op *op) {
+    vm_push(vm, vm->str_cache->items[op->args[0]].value);
+    return JIT_NEXT;
+}
+
+static int jit_LOAD_FUNC(vm_t *vm, struct jit_op *op) {
+    object_t *obj = vm->code_cache->elems[op->args[0]];
+    func_t *func = obj->data.ptr;
+    locals_t *frame = vm->frames_top->locals;
+    if (frame && !func->u.code->is_func) frame->has_blocks = true;
+    vm_push(vm, obj);
+    return JIT_NEXT;
+}
+
+static int jit_LOAD_GLOBAL(vm_t *vm, struct jit_op *op) {
+    vm_push(vm, jit_get_global(vm, op->args[0]));
+    return JIT_NEXT;
+}
+
+static int jit_STORE_GLOBAL(vm_t *vm, struct jit_op *op) {
+    int j = op->args[0];
+    object_t *obj = vm_pop(vm);
+    dict_item_t *item = vm_get_global_item(vm, j);
+    if (item) dict_set_item(vm->globals, item, obj);
+    else dict_set(vm->globals, vm->str_cache->items[j].name, obj);
+    return JIT_NEXT;
+}
+
+static int jit_CALL_GLOBAL(vm_t *vm, struct jit_op *op) {
+    return jit_call(vm, op, jit_get_global(vm, op->args[0]));
+}
+
+static int jit_LOAD_LOCAL(vm_t *vm, struct jit_op *op) {
+    vm_push(vm, jit_get_local(vm, op->args[0]));
+    return JIT_NEXT;
+}
+
+static int jit_STORE_LOCAL(vm_t *vm, struct jit_op *op) {
+    jit_set_local(vm, op->args[0], vm_pop(vm));
+    return JIT_NEXT;
+}
+
+static int jit_CALL_LOCAL(vm_t *vm, struct jit_op *op) {
+    return jit_call(vm, op, jit_get_local(vm, op->args[0]));
+}
+
+static int jit_GETTER(vm_t *vm, struct jit_op *op) {
+    getter_cache_t *cache = &vm->frames_top->code->getter_caches[op->args[1]];
+    object_cached_getter(vm_pop(vm), vm->str_cache->items[op->args[0]].name, cache, vm);
+    JIT_DONE();
+}
+
+static int jit_SETTER(vm_t *vm, struct jit_op *op) {
+    getter_cache_t *cache = &vm->frames_top->code->getter_caches[op->args[1]];
+    object_cached_setter(vm_pop(vm), vm->str_cache->items[op->args[0]].name, cache, vm);
+    JIT_DONE();
+}
+
+static int jit_RENAME_FUNC(vm_t *vm, struct jit_op *op) {
+    object_t *obj = vm_top(vm);
+    if (object_type(obj) != &func_type) {
+        fprintf(stderr, "Can't use '$' with object of type '%s'\n", object_type(obj)->name);
+        exit(1);
+    }
+    func_t *func = obj->data.ptr;
+    func->name = vm->str_cache->items[op->args[0]].name;
+    return JIT_NEXT;
+}
+
+static int jit_JUMP_IF_FALSE(vm_t *vm, struct jit_op *op) {
+    (void)op; // (every jit_helper_t gets its op, whether it needs it or not)
+    return object_to_bool(vm_pop(vm))? JIT_NEXT: JIT_JUMP;
+}
+
+static int jit_CHECK_BUILTIN(vm_t *vm, struct jit_op *op) {
+    dict_item_t *item = vm_get_global_item(vm, op->args[0]);
+    return item && item->value == vm->inline_builtins[op->args[1]]? JIT_JUMP: JIT_NEXT;
+}
+
+static int jit_ITER(vm_t *vm, struct jit_op *op) {
+    if (vm->stack_top <= vm->stack || vm->stack_top[-1] != vm->code_cache->elems[op->args[0]]) {
+        return JIT_JUMP;
+    }
+    object_t *obj = vm_pop(vm);
+    vm->stack_top--; // drop the body
+    object_method(obj, SYM_ITER, "__iter__", vm);
+    if (vm->unwind) return op->next;
+    if (vm->iters_top >= vm->iters + VM_ITERS_SIZE - 1) {
+        fprintf(stderr, "Too many nested @for loops!\n");
+        exit(1);
+    }
+    *++vm->iters_top = vm_pop(vm);
+    return JIT_NEXT;
+}
+
+static int jit_FOR_ITER(vm_t *vm, struct jit_op *op) {
+    object_t *next_obj = object_next(*vm->iters_top, vm);
+    if (vm->unwind) return op->next;
+    if (next_obj) {
+        vm_push(vm, next_obj);
+        return JIT_NEXT;
+    }
+    vm->iters_top--;
+    return JIT_JUMP;
+}
+
+static int jit_POP_ITER(vm_t *vm, struct jit_op *op) {
+    (void)op;
+    vm->iters_top--;
+    return JIT_NEXT;
+}
+
+static int jit_LOAD_LOCAL_GETTER(vm_t *vm, struct jit_op *op) {
+    object_t *obj = jit_get_local(vm, op->args[0]);
+    getter_cache_t *cache = &vm->frames_top->code->getter_caches[op->args[2]];
+    object_cached_getter(obj, vm->str_cache->items[op->args[1]].name, cache, vm);
+    JIT_DONE();
+}
+
+static int jit_STORE_LOAD_LOCAL(vm_t *vm, struct jit_op *op) {
+    jit_set_local(vm, op->args[0], vm_top(vm));
+    return JIT_NEXT;
+}
+
+static int jit_DUP(vm_t *vm, struct jit_op *op) {
+    (void)op;
+    vm_push(vm, vm_top(vm));
+    return JIT_NEXT;
+}
+
+// Quickened GETTERs (see vm_quicken_getter) which were quickened when we
+// compiled them: we don't rewrite the bytecodes, so if the guard fails,
+// they just do what GETTER would have.
+// NOTE: GETTER_METHOD's cache may have been deopted and started counting
+// hits again since, so its method is only for quick_type once it's quickened.
+#define JIT_QUICK_GETTER_BODY(GUARD, BODY) { \
+    getter_cache_t *cache = &vm->frames_top->code->getter_caches[args[1]]; \
+    if (!(GUARD)) { \
+        object_cached_getter(obj, vm->str_cache->items[args[0]].name, cache, vm); \
+        JIT_DONE(); \
+    } \
+    BODY \
+    JIT_DONE(); \
+}
+#define JIT_QUICK_GETTER(X, GUARD, BODY) \
+static int jit_##X(vm_t *vm, struct jit_op *op) { \
+    object_t *obj = vm_pop(vm); \
+    int *args = op->args; \
+    JIT_QUICK_GETTER_BODY(GUARD, BODY) \
+} \
+static int jit_LOCAL_##X(vm_t *vm, struct jit_op *op) { \
+    object_t *obj = jit_get_local(vm, op->args[0]); \
+    int *args = op->args + 1; \
+    JIT_QUICK_GETTER_BODY(GUARD, BODY) \
+}
+JIT_QUICK_GETTER(GETTER_METHOD,
+    object_type(obj) == cache->quick_type && cache->hits >= VM_QUICKEN_HITS, {
+    cache->method(obj, cache->sym, vm);
+})
+JIT_QUICK_GETTER(LIST_LEN, object_type(obj) == &list_type, {
+    list_t *list = obj->data.ptr;
+    vm_push(vm, vm_get_or_create_int(vm, list->len));
+})
+JIT_QUICK_GETTER(LIST_GET, object_type(obj) == &list_type, {
+    int k = object_to_int(vm_pop(vm));
+    vm_push(vm, list_get(obj->data.ptr, k));
+})
+JIT_QUICK_GETTER(STR_LEN, object_type(obj) == &str_type, {
+    vm_push(vm, vm_get_or_create_int(vm, str_get_len(obj)));
+})
+JIT_QUICK_GETTER(STR_GET, object_type(obj) == &str_type, {
+    const char *s = obj->data.ptr;
+    int k = get_index(object_to_int(vm_pop(vm)), str_get_len(obj), "str");
+    vm_push(vm, vm_get_char_str(vm, s[k]));
+})
+#undef JIT_QUICK_GETTER_BODY
+#undef JIT_QUICK_GETTER
+
+// Operators and comparisons, on two ints (or two bools) right here, and
+// on anything else with vm_op and vm_cmp, as in vm_eval
+#define BOTH_INTS(a, b) (OBJECT_IS_INT(a) && OBJECT_IS_INT(b))
+#define BOTH_BOOLS(a, b) (((a) == &static_true || (a) == &static_false) && \
+    ((b) == &static_true || (b) == &static_false))
+#define JIT_INT_CMP(X, OP) \
+static int jit_##X(vm_t *vm, struct jit_op *op) { \
+    object_t **top = vm->stack_top; \
+    if (top > vm->stack && BOTH_INTS(top[-1], top[0])) { \
+        top[-1] = object_create_bool(OBJECT_TO_INT(top[-1]) OP OBJECT_TO_INT(top[0])); \
+        vm->stack_top = top - 1; \
+        return JIT_NEXT; \
+    } \
+    vm_cmp(vm, INSTR_##X); \
+    JIT_DONE(); \
+}
+#define JIT_INT_BINOP(X, OP) \
+static int jit_##X(vm_t *vm, struct jit_op *op) { \
+    object_t **top = vm->stack_top; \
+    if (top > vm->stack && BOTH_INTS(top[-1], top[0])) { \
+        top[-1] = OBJECT_FROM_INT(OBJECT_TO_INT(top[-1]) OP OBJECT_TO_INT(top[0])); \
+        vm->stack_top = top - 1; \
+        return JIT_NEXT; \
+    } \
+    vm_op(vm, INSTR_##X); \
+    JIT_DONE(); \
+}
+#define JIT_INT_OR_BOOL_BINOP(X, OP) \
+static int jit_##X(vm_t *vm, struct jit_op *op) { \
+    object_t **top = vm->stack_top; \
+    if (top > vm->stack && BOTH_INTS(top[-1], top[0])) { \
+        top[-1] = OBJECT_FROM_INT(OBJECT_TO_INT(top[-1]) OP OBJECT_TO_INT(top[0])); \
+        vm->stack_top = top - 1; \
+        return JIT_NEXT; \
+    } \
+    if (top > vm->stack && BOTH_BOOLS(top[-1], top[0])) { \
+        top[-1] = object_create_bool(top[-1]->data.i OP top[0]->data.i); \
+        vm->stack_top = top - 1; \
+        return JIT_NEXT; \
+    } \
+    vm_op(vm, INSTR_##X); \
+    JIT_DONE(); \
+}
+#define JIT_INT_CONST_OP(X, INSTRUCTION, EXPR, GENERIC) \
+static int jit_##X(vm_t *vm, struct jit_op *op) { \
+    int j = op->args[0]; \
+    object_t **top = vm->stack_top; \
+    if (top >= vm->stack && OBJECT_IS_INT(top[0])) { \
+        int i = OBJECT_TO_INT(top[0]); \
+        top[0] = EXPR; \
+        return JIT_NEXT; \
+    } \
+    vm_push(vm, vm_get_or_create_int(vm, j)); \
+    GENERIC(vm, INSTRUCTION); \
+    JIT_DONE(); \
+}
+JIT_INT_CONST_OP(ADD_INT_CONST, INSTR_ADD, OBJECT_FROM_INT(i + j), vm_op)
+JIT_INT_CONST_OP(SUB_INT_CONST, INSTR_SUB, OBJECT_FROM_INT(i - j), vm_op)
+JIT_INT_CONST_OP(LT_INT_CONST, INSTR_LT, object_create_bool(i < j), vm_cmp)
+JIT_INT_CMP(EQ, ==)
+JIT_INT_CMP(NE, !=)
+JIT_INT_CMP(LT, <)
+JIT_INT_CMP(LE, <=)
+JIT_INT_CMP(GT, >)
+JIT_INT_CMP(GE, >=)
+JIT_INT_BINOP(ADD, +)
+JIT_INT_BINOP(SUB, -)
+JIT_INT_BINOP(MUL, *)
+JIT_INT_BINOP(DIV, /)
+JIT_INT_BINOP(MOD, %)
+JIT_INT_OR_BOOL_BINOP(AND, &)
+JIT_INT_OR_BOOL_BINOP(OR, |)
+JIT_INT_OR_BOOL_BINOP(XOR, ^)
+#undef BOTH_INTS
+#undef BOTH_BOOLS
+#undef JIT_INT_CMP
+#undef JIT_INT_BINOP
+#undef JIT_INT_OR_BOOL_BINOP
+#undef JIT_INT_CONST_OP
+
+static int jit_NEG(vm_t *vm, struct jit_op *op) {
+    object_t **top = vm->stack_top;
+    if (top >= vm->stack && OBJECT_IS_INT(top[0])) {
+        top[0] = OBJECT_FROM_INT(-OBJECT_TO_INT(top[0]));
+        return JIT_NEXT;
+    }
+    vm_op(vm, INSTR_NEG);
+    JIT_DONE();
+}
+
+static int jit_NOT(vm_t *vm, struct jit_op *op) {
+    object_t **top = vm->stack_top;
+    if (top >= vm->stack && (*top == &static_true || *top == &static_false)) {
+        *top = object_create_bool(!(*top)->data.i);
+        return JIT_NEXT;
+    }
+    if (top >= vm->stack && OBJECT_IS_INT(top[0])) {
+        top[0] = OBJECT_FROM_INT(~OBJECT_TO_INT(top[0]));
+        return JIT_NEXT;
+    }
+    vm_op(vm, INSTR_NOT);
+    JIT_DONE();
+}
+
+static int jit_COMMA(vm_t *vm, struct jit_op *op) {
+    // (and LIST_COMMA)
+    object_t **top = vm->stack_top;
+    if (top > vm->stack && object_type(top[-1]) == &list_type) {
+        list_push(top[-1]->data.ptr, top[0]);
+        vm->stack_top = top - 1;
+        return JIT_NEXT;
+    }
+    vm_op(vm, INSTR_COMMA);
+    JIT_DONE();
+}
+
+static int jit_CALL(vm_t *vm, struct jit_op *op) {
+    object_t *callee = vm_pop(vm);
+    int next = jit_call(vm, op, callee);
+    // if vm_eval is doing the call, it pops the callee itself
+    if (next == op->i) vm_push(vm, callee);
+    return next;
+}
+
+// NOTE: JUMP, BREAK, CONTINUE and RETURN have no helper (see jit_compile)
+static jit_helper_t *jit_helpers[N_INSTRS] = {
+    [INSTR_LOAD_INT] = jit_LOAD_INT,
+    [INSTR_LOAD_STR] = jit_LOAD_STR,
+    [INSTR_LOAD_FUNC] = jit_LOAD_FUNC,
+    [INSTR_LOAD_GLOBAL] = jit_LOAD_GLOBAL,
+    [INSTR_STORE_GLOBAL] = jit_STORE_GLOBAL,
+    [INSTR_CALL_GLOBAL] = jit_CALL_GLOBAL,
+    [INSTR_LOAD_LOCAL] = jit_LOAD_LOCAL,
+    [INSTR_STORE_LOCAL] = jit_STORE_LOCAL,
+    [INSTR_CALL_LOCAL] = jit_CALL_LOCAL,
+    [INSTR_GETTER] = jit_GETTER,
+    [INSTR_SETTER] = jit_SETTER,
+    [INSTR_RENAME_FUNC] = jit_RENAME_FUNC,
+    [INSTR_JUMP_IF_FALSE] = jit_JUMP_IF_FALSE,
+    [INSTR_CHECK_BUILTIN] = jit_CHECK_BUILTIN,
+    [INSTR_ITER] = jit_ITER,
+    [INSTR_FOR_ITER] = jit_FOR_ITER,
+    [INSTR_POP_ITER] = jit_POP_ITER,
+    [INSTR_LOAD_LOCAL_GETTER] = jit_LOAD_LOCAL_GETTER,
+    [INSTR_STORE_LOAD_LOCAL] = jit_STORE_LOAD_LOCAL,
+    [INSTR_ADD_INT_CONST] = jit_ADD_INT_CONST,
+    [INSTR_SUB_INT_CONST] = jit_SUB_INT_CONST,
+    [INSTR_LT_INT_CONST] = jit_LT_INT_CONST,
+    [INSTR_DUP] = jit_DUP,
+    [INSTR_GETTER_METHOD] = jit_GETTER_METHOD,
+    [INSTR_LIST_LEN] = jit_LIST_LEN,
+    [INSTR_LIST_GET] = jit_LIST_GET,
+    [INSTR_STR_LEN] = jit_STR_LEN,
+    [INSTR_STR_GET] = jit_STR_GET,
+    [INSTR_LOCAL_GETTER_METHOD] = jit_LOCAL_GETTER_METHOD,
+    [INSTR_LOCAL_LIST_LEN] = jit_LOCAL_LIST_LEN,
+    [INSTR_LOCAL_LIST_GET] = jit_LOCAL_LIST_GET,
+    [INSTR_LOCAL_STR_LEN] = jit_LOCAL_STR_LEN,
+    [INSTR_LOCAL_STR_GET] = jit_LOCAL_STR_GET,
+    [INSTR_LIST_COMMA] = jit_COMMA,
+    [INSTR_NEG] = jit_NEG,
+    [INSTR_ADD] = jit_ADD,
+    [INSTR_SUB] = jit_SUB,
+    [INSTR_MUL] = jit_MUL,
+    [INSTR_DIV] = jit_DIV,
+    [INSTR_MOD] = jit_MOD,
+    [INSTR_NOT] = jit_NOT,
+    [INSTR_AND] = jit_AND,
+    [INSTR_OR] = jit_OR,
+    [INSTR_XOR] = jit_XOR,
+    [INSTR_EQ] = jit_EQ,
+    [INSTR_NE] = jit_NE,
+    [INSTR_LT] = jit_LT,
+    [INSTR_LE] = jit_LE,
+    [INSTR_GT] = jit_GT,
+    [INSTR_GE] = jit_GE,
+    [INSTR_COMMA] = jit_COMMA,
+    [INSTR_CALL] = jit_CALL,
+};
+
+// Machine code
+// While it runs, rbx holds the vm_t *, r12 holds vm->stack_top (which is
+// only stored back before calling a helper, or returning), and r13 holds the
+// slots of the frame's locals (or NULL if it has none).
+// Trivial instructions have a "fast path" right there in the machine code,
+// which jumps to a "slow path" calling the helper if it can't handle
+// something (e.g. an ADD of anything but two ints); the slow paths are put
+// out of the way after all the fast paths.
+
+// The most machine code any instruction's fast or slow path needs
+#define JIT_MAX_TEMPLATE_SIZE 128
+
+#define EMIT(P, BYTES) P = jit_emit(P, BYTES, sizeof BYTES - 1)
+#define EMIT_I32(P, X) P = jit_emit_i32(P, X)
+#define EMIT_I64(P, X) P = jit_emit_i64(P, (int64_t)(intptr_t)(X))
+#define EMIT_REL32(P, TARGET) P = jit_emit_i32(P, (TARGET) - ((P) + 4))
+
+static unsigned char *jit_emit(unsigned char *p, const char *bytes, int n) {
+    memcpy(p, bytes, n);
+    return p + n;
+}
+
+static unsigned char *jit_emit_i32(unsigned char *p, int32_t x) {
+    memcpy(p, &x, sizeof x);
+    return p + sizeof x;
+}
+
+static unsigned char *jit_emit_i64(unsigned char *p, int64_t x) {
+    memcpy(p, &x, sizeof x);
+    return p + sizeof x;
+}
+
+static unsigned char *jit_emit_check_stack(unsigned char *p, unsigned char *slow,
+    int n_objs, bool push) {
+    // jumps to slow unless there are n_objs (1 or 2) on the stack, and (if
+    // push) room for another one
+    int32_t stack = offsetof(vm_t, stack);
+    if (n_objs) {
+        // lea rcx, [rbx + stack]; cmp r12, rcx; jb/jbe slow
+        EMIT(p, "\x48\x8d\x8b"); EMIT_I32(p, stack);
+        EMIT(p, "\x49\x39\xcc");
+        if (n_objs == 1) EMIT(p, "\x0f\x82"); else EMIT(p, "\x0f\x86");
+        EMIT_REL32(p, slow);
+    }
+    if (push) {
+        // lea rcx, [rbx + last slot of stack]; cmp r12, rcx; jae slow
+        EMIT(p, "\x48\x8d\x8b"); EMIT_I32(p, stack + (VM_STACK_SIZE - 1) * sizeof(object_t *));
+        EMIT(p, "\x49\x39\xcc\x0f\x83"); EMIT_REL32(p, slow);
+    }
+    return p;
+}
+
+static unsigned char *jit_emit_push_rax(unsigned char *p) {
+    // add r12, 8; mov [r12], rax
+    EMIT(p, "\x49\x83\xc4\x08\x49\x89\x04\x24");
+    return p;
+}
+
+static unsigned char *jit_emit_int_operands(unsigned char *p, unsigned char *slow) {
+    // the two ints on top of the stack into eax and edx, or jump to slow:
+    // mov rax, [r12 - 8]; mov rdx, [r12]
+    EMIT(p, "\x49\x8b\x44\x24\xf8\x49\x8b\x14\x24");
+    // mov ecx, eax; and ecx, edx; test cl, 1; jz slow
+    EMIT(p, "\x89\xc1\x21\xd1\xf6\xc1\x01\x0f\x84"); EMIT_REL32(p, slow);
+    // sar rax, 1; sar rdx, 1
+    EMIT(p, "\x48\xd1\xf8\x48\xd1\xfa");
+    return p;
+}
+
+static unsigned char *jit_emit_int_result(unsigned char *p) {
+    // the int in eax into rax as an object (see OBJECT_FROM_INT):
+    // movsxd rax, eax; lea rax, [rax + rax + 1]
+    EMIT(p, "\x48\x63\xc0\x48\x8d\x44\x00\x01");
+    return p;
+}
+
+static unsigned char *jit_emit_bool_result(unsigned char *p, const char *cmov) {
+    // rax = &static_false, or &static_true if cmov's condition holds:
+    // mov rax, &static_false; mov rdx, &static_true; cmovcc rax, rdx
+    EMIT(p, "\x48\xb8"); EMIT_I64(p, &static_false);
+    EMIT(p, "\x48\xba"); EMIT_I64(p, &static_true);
+    return jit_emit(p, cmov, 4);
+}
+
+static const char *jit_cmovs[N_INSTRS] = {
+    [INSTR_EQ] = "\x48\x0f\x44\xc2",
+    [INSTR_NE] = "\x48\x0f\x45\xc2",
+    [INSTR_LT] = "\x48\x0f\x4c\xc2",
+    [INSTR_LE] = "\x48\x0f\x4e\xc2",
+    [INSTR_GT] = "\x48\x0f\x4f\xc2",
+    [INSTR_GE] = "\x48\x0f\x4d\xc2",
+    [INSTR_LT_INT_CONST] = "\x48\x0f\x4c\xc2",
+};
+
+static unsigned char *jit_emit_fast_path(unsigned char *p, struct jit_op *op, unsigned char *slow) {
+    // Emits instruction op's fast path, which carries on at the end of it,
+    // or jumps to slow; returns NULL if it has none.
+    int32_t j = op->args[0];
+    instruction_t instruction = op->instruction;
+    switch (instruction) {
+        case INSTR_LOAD_INT:
+            p = jit_emit_check_stack(p, slow, 0, true);
+            // mov rax, OBJECT_FROM_INT(j)
+            EMIT(p, "\x48\xb8"); EMIT_I64(p, OBJECT_FROM_INT(j));
+            return jit_emit_push_rax(p);
+        case INSTR_LOAD_LOCAL:
+            // test r13, r13; jz slow; mov rax, [r13 + 8 * j]; test rax, rax; jz slow
+            EMIT(p, "\x4d\x85\xed\x0f\x84"); EMIT_REL32(p, slow);
+            EMIT(p, "\x49\x8b\x85"); EMIT_I32(p, j * sizeof(object_t *));
+            EMIT(p, "\x48\x85\xc0\x0f\x84"); EMIT_REL32(p, slow);
+            p = jit_emit_check_stack(p, slow, 0, true);
+            return jit_emit_push_rax(p);
+        case INSTR_STORE_LOCAL:
+        case INSTR_STORE_LOAD_LOCAL:
+            // test r13, r13; jz slow
+            EMIT(p, "\x4d\x85\xed\x0f\x84"); EMIT_REL32(p, slow);
+            p = jit_emit_check_stack(p, slow, 1, false);
+            // mov rax, [r12]; mov [r13 + 8 * j], rax
+            EMIT(p, "\x49\x8b\x04\x24\x49\x89\x85"); EMIT_I32(p, j * sizeof(object_t *));
+            // sub r12, 8
+            if (instruction == INSTR_STORE_LOCAL) EMIT(p, "\x49\x83\xec\x08");
+            return p;
+        case INSTR_DUP:
+            p = jit_emit_check_stack(p, slow, 1, true);
+            // mov rax, [r12]
+            EMIT(p, "\x49\x8b\x04\x24");
+            return jit_emit_push_rax(p);
+        case INSTR_POP_ITER:
+            // sub qword [rbx + iters_top], 8
+            EMIT(p, "\x48\x83\xab"); EMIT_I32(p, offsetof(vm_t, iters_top)); EMIT(p, "\x08");
+            return p;
+        case INSTR_ADD:
+        case INSTR_SUB:
+        case INSTR_MUL:
+            p = jit_emit_check_stack(p, slow, 2, false);
+            p = jit_emit_int_operands(p, slow);
+            // add/sub/imul eax, edx
+            if (instruction == INSTR_ADD) EMIT(p, "\x01\xd0");
+            else if (instruction == INSTR_SUB) EMIT(p, "\x29\xd0");
+            else EMIT(p, "\x0f\xaf\xc2");
+            p = jit_emit_int_result(p);
+            // sub r12, 8; mov [r12], rax
+            EMIT(p, "\x49\x83\xec\x08\x49\x89\x04\x24");
+            return p;
+        case INSTR_EQ:
+        case INSTR_NE:
+        case INSTR_LT:
+        case INSTR_LE:
+        case INSTR_GT:
+        case INSTR_GE:
+            p = jit_emit_check_stack(p, slow, 2, false);
+            p = jit_emit_int_operands(p, slow);
+            // cmp eax, edx
+            EMIT(p, "\x39\xd0");
+            p = jit_emit_bool_result(p, jit_cmovs[instruction]);
+            // sub r12, 8; mov [r12], rax
+            EMIT(p, "\x49\x83\xec\x08\x49\x89\x04\x24");
+            return p;
+        case INSTR_ADD_INT_CONST:
+        case INSTR_SUB_INT_CONST:
+        case INSTR_LT_INT_CONST:
+            p = jit_emit_check_stack(p, slow, 1, false);
+            // mov rax, [r12]; test al, 1; jz slow; sar rax, 1
+            EMIT(p, "\x49\x8b\x04\x24\xa8\x01\x0f\x84"); EMIT_REL32(p, slow);
+            EMIT(p, "\x48\xd1\xf8");
+            // add/sub/cmp eax, j
+            if (instruction == INSTR_ADD_INT_CONST) EMIT(p, "\x05");
+            else if (instruction == INSTR_SUB_INT_CONST) EMIT(p, "\x2d");
+            else EMIT(p, "\x3d");
+            EMIT_I32(p, j);
+            if (instruction == INSTR_LT_INT_CONST) {
+                p = jit_emit_bool_result(p, jit_cmovs[instruction]);
+            } else p = jit_emit_int_result(p);
+            // mov [r12], rax
+            EMIT(p, "\x49\x89\x04\x24");
+            return p;
+        default:
+            return NULL;
+    }
+}
+
+static unsigned char *jit_emit_call_helper(unsigned char *p, struct jit_op *op) {
+    // mov [rbx + stack_top], r12
+    EMIT(p, "\x4c\x89\xa3"); EMIT_I32(p, offsetof(vm_t, stack_top));
+    // mov rdi, rbx; mov rsi, op; mov rax, helper; call rax
+    EMIT(p, "\x48\x89\xdf\x48\xbe"); EMIT_I64(p, op);
+    EMIT(p, "\x48\xb8"); EMIT_I64(p, jit_helpers[op->instruction]);
+    EMIT(p, "\xff\xd0");
+    // mov r12, [rbx + stack_top]
+    EMIT(p, "\x4c\x8b\xa3"); EMIT_I32(p, offsetof(vm_t, stack_top));
+    return p;
+}
+
+static unsigned char *jit_emit_exit(unsigned char *p, int i, unsigned char *epilogue) {
+    // mov eax, i; jmp epilogue
+    EMIT(p, "\xb8"); EMIT_I32(p, i);
+    EMIT(p, "\xe9"); EMIT_REL32(p, epilogue);
+    return p;
+}
+
+jit_t *jit_compile(code_t *code) {
+    // Returns NULL if code can't be compiled, in which case vm_eval just
+    // carries on interpreting it.
+    int len = code->len;
+    size_t half_size = (size_t)(len + 2) * JIT_MAX_TEMPLATE_SIZE;
+    size_t size = 2 * half_size;
+    unsigned char *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    unsigned char **entries = calloc(len + 1, sizeof *entries);
+    struct jit_op *ops = malloc(len * sizeof *ops); // (at most one per byte)
+    // where each jump's rel32 is, and which bytecode it jumps to
+    unsigned char **fixups = calloc(2 * len, sizeof *fixups);
+    int *fixup_targets = calloc(2 * len, sizeof *fixup_targets);
+    jit_t *jit = malloc(sizeof *jit);
+    if (!entries || (len && !ops) || !fixups || !fixup_targets || !jit) {
+        fprintf(stderr, "Failed to allocate JIT\n");
+        exit(1);
+    }
+    int n_fixups = 0;
+    #define EMIT_FIXUP(P, TARGET) { \
+        fixups[n_fixups] = P; \
+        fixup_targets[n_fixups++] = TARGET; \
+        EMIT_I32(P, 0); \
+    }
+
+    // jit_run calls this with the vm and where to start:
+    // push rbx; push r12; push r13; mov rbx, rdi; mov r12, [rbx + stack_top]
+    unsigned char *p = mem;
+    EMIT(p, "\x53\x41\x54\x41\x55\x48\x89\xfb\x4c\x8b\xa3"); EMIT_I32(p, offsetof(vm_t, stack_top));
+    // mov rax, [rbx + frames_top]; mov r13, [rax + locals]
+    EMIT(p, "\x48\x8b\x83"); EMIT_I32(p, offsetof(vm_t, frames_top));
+    EMIT(p, "\x4c\x8b\xa8"); EMIT_I32(p, offsetof(call_frame_t, locals));
+    // test r13, r13; jz +7; mov r13, [r13 + slots]; jmp rsi
+    EMIT(p, "\x4d\x85\xed\x74\x07\x4d\x8b\xad"); EMIT_I32(p, offsetof(locals_t, slots));
+    EMIT(p, "\xff\xe6");
+    // ...and everything returns through here:
+    // mov [rbx + stack_top], r12; pop r13; pop r12; pop rbx; ret
+    unsigned char *epilogue = p;
+    EMIT(p, "\x4c\x89\xa3"); EMIT_I32(p, offsetof(vm_t, stack_top));
+    EMIT(p, "\x41\x5d\x41\x5c\x5b\xc3");
+
+    // the slow paths go in the second half
+    unsigned char *q = mem + half_size;
+
+    struct jit_op *op = ops;
+    for (int i = 0, next; i < len; i = next, op++) {
+        entries[i] = p;
+        instruction_t instruction = code->bytecodes[i];
+        next = code_decode(code, i, op->args);
+        op->instruction = instruction;
+        op->i = i;
+        op->next = next;
+        int n_args = instruction_args(instruction);
+        int target = instruction_is_jump(instruction)? next + op->args[n_args - 1]: -1;
+
+        if (instruction == INSTR_BREAK || instruction == INSTR_CONTINUE ||
+            instruction == INSTR_RETURN) {
+            // up to vm_eval (which counts them)
+            p = jit_emit_exit(p, i, epilogue);
+            continue;
+        }
+
+        // inc qword [rbx + instr_count]
+        EMIT(p, "\x48\xff\x83"); EMIT_I32(p, offsetof(vm_t, instr_count));
+
+        if (instruction == INSTR_JUMP) {
+            // jmp target
+            EMIT(p, "\xe9"); EMIT_FIXUP(p, target);
+            continue;
+        }
+        if (instruction == INSTR_JUMP_IF_FALSE) {
+            // fast path for bools:
+            // mov rax, [r12]; mov rdx, &static_true; cmp rax, rdx; jne +9
+            unsigned char *slow = q;
+            p = jit_emit_check_stack(p, slow, 1, false);
+            EMIT(p, "\x49\x8b\x04\x24\x48\xba"); EMIT_I64(p, &static_true);
+            EMIT(p, "\x48\x39\xd0\x75\x09");
+            // sub r12, 8; jmp next
+            EMIT(p, "\x49\x83\xec\x08\xe9"); EMIT_FIXUP(p, next);
+            // mov rdx, &static_false; cmp rax, rdx; jne slow
+            EMIT(p, "\x48\xba"); EMIT_I64(p, &static_false);
+            EMIT(p, "\x48\x39\xd0\x0f\x85"); EMIT_REL32(p, slow);
+            // sub r12, 8; jmp target
+            EMIT(p, "\x49\x83\xec\x08\xe9"); EMIT_FIXUP(p, target);
+        }
+
+        // the slow path goes in the second half if there's a fast path,
+        // otherwise it's all there is
+        unsigned char *fast_end = instruction == INSTR_JUMP_IF_FALSE? p:
+            jit_emit_fast_path(p, op, q);
+        unsigned char **slow = fast_end? &q: &p;
+        if (fast_end) p = fast_end;
+        *slow = jit_emit_call_helper(*slow, op);
+        if (target >= 0) {
+            // cmp eax, JIT_JUMP; je target
+            EMIT(*slow, "\x83\xf8\xfe\x0f\x84"); EMIT_FIXUP(*slow, target);
+        }
+        // cmp eax, JIT_NEXT; jne epilogue
+        EMIT(*slow, "\x83\xf8\xff\x0f\x85"); EMIT_REL32(*slow, epilogue);
+        // jmp next
+        if (fast_end) {
+            EMIT(q, "\xe9"); EMIT_FIXUP(q, next);
+        }
+    }
+    entries[len] = p;
+    p = jit_emit_exit(p, len, epilogue);
+    #undef EMIT_FIXUP
+
+    for (int j = 0; j < n_fixups; j++) {
+        unsigned char *at = fixups[j];
+        EMIT_REL32(at, entries[fixup_targets[j]]);
+    }
+    free(fixups);
+    free(fixup_targets);
+
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC)) {
+        munmap(mem, size);
+        free(entries);
+        free(ops);
+        free(jit);
+        return NULL;
+    }
+    jit->mem = mem;
+    jit->size = size;
+    jit->entries = entries;
+    jit->ops = ops;
+    return jit;
+}
+
+#undef EMIT
+#undef EMIT_I32
+#undef EMIT_I64
+#undef EMIT_REL32
+
+int jit_run(vm_t *vm, jit_t *jit, int i) {
+    // runs jit's machine code from bytecode i, and returns where vm_eval
+    // should carry on from
+    if (!jit->entries[i]) return i;
+    int (*enter)(vm_t *vm, unsigned char *entry) = (void *)jit->mem;
+    return enter(vm, jit->entries[i]);
+}
+
+#else
+
+// NOTE: there's only machine code for x86-64, so elsewhere, vm .jit does
+// nothing
+
+jit_t *jit_compile(code_t *code) {
+    return NULL;
+}
+
+int jit_run(vm_t *vm, jit_t *jit, int i) {
+    return i;
+}
+
+#endif
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lalang.h"
+
+
+/****************
+* LALAC
+****************/
+
+// A cache of the compiled code of an included file, written next to it
+// (e.g. "stdlib.lala" -> "stdlib.lalac"), so that vm_include can skip
+// compiler_compile next time.
+// The file is:
+//   * a lalac_header
+//   * n_strs strs, each an int32_t length, then its chars and a '\0'
+//   * n_codes codes (the top-level code last), each a lalac_code, then
+//     its locals (str indexes), getter cache names (str indexes, or -1),
+//     loops (4 int32_t's each), and bytecodes
+// Args which index into vm->str_cache or vm->code_cache are written as
+// indexes into the file's strs or codes instead (see code_append).
+// NOTE: everything is native-endian, so caches aren't portable between
+// machines (though the header's checksum should stop us loading one)
+
+#define LALAC_MAGIC "LALAC\0\0\0"
+#define LALAC_VERSION 3
+
+struct lalac_header {
+    char magic[8];
+    int32_t version;
+    int32_t n_instrs; // N_INSTRS, in case the instruction set changed
+    int32_t optimize; // vm->optimize when we were compiled
+    file_stamp_t source;
+    int32_t n_strs;
+    int32_t n_codes;
+    uint32_t checksum; // hash_chars of the rest of the file
+};
+
+struct lalac_code {
+    int32_t row;
+    int32_t col;
+    int32_t is_func;
+    int32_t scope; // an index into the file's codes, or -1
+    int32_t n_locals;
+    int32_t n_getter_caches;
+    int32_t n_loops;
+    int32_t len;
+};
+
+static char *lalac_path(const char *filename) {
+    // returns e.g. "stdlib.lalac" for "stdlib.lala"
+    size_t len = strlen(filename);
+    char *path = malloc(len + 2);
+    if (!path) {
+        fprintf(stderr, "Failed to allocate lalac path for '%s'\n", filename);
+        exit(1);
+    }
+    strcpy(path, filename);
+    strcpy(path + len, "c");
+    return path;
+}
+
+static bool lalac_set_header(struct lalac_header *header, vm_t *vm, const char *filename, const char *text) {
+    // returns false if filename can't be read
+    // NOTE: headers get memcmp'd, so zero any padding too
+    memset(header, 0, sizeof *header);
+    memcpy(header->magic, LALAC_MAGIC, sizeof header->magic);
+    header->version = LALAC_VERSION;
+    header->n_instrs = N_INSTRS;
+    header->optimize = vm->optimize;
+    return file_stamp_set(&header->source, filename, text);
+}
+
+
+/****************
+* LALAC WRITE
+****************/
+
+static int lalac_add_str(vm_t *vm, buf_t *strs, int *str_map, int *n_strs, int i) {
+    // returns the file's index for vm->str_cache's i'th str
+    if (str_map[i] < 0) {
+        const char *s = vm->str_cache->items[i].name;
+        int32_t len = strlen(s);
+        buf_push_i(strs, len);
+        buf_push(strs, s, len + 1);
+        str_map[i] = (*n_strs)++;
+    }
+    return str_map[i];
+}
+
+static bool lalac_push_code(vm_t *vm, buf_t *codes, buf_t *strs,
+        int *str_map, int *n_strs, int *code_map, code_t *code, int scope) {
+    // returns false if code refers to a code which isn't ours
+    for (int i = 0; i < code->len;) {
+        instruction_t instruction = code->bytecodes[i];
+        int args[CODE_MAX_ARGS];
+        i = code_decode(code, i, args);
+        int n_args = instruction_args(instruction);
+        for (int j = 0; j < n_args; j++) {
+            arg_kind_t kind = instruction_arg_kind(instruction, j);
+            if (kind == ARG_STR) lalac_add_str(vm, strs, str_map, n_strs, args[j]);
+            else if (kind == ARG_CODE && code_map[args[j]] < 0) return false;
+        }
+    }
+
+    // our getter caches don't keep their names, so find them again from
+    // the instructions using them
+    int *cache_names = malloc((code->n_getter_caches + 1) * sizeof *cache_names);
+    if (!cache_names) {
+        fprintf(stderr, "Failed to allocate lalac getter cache names\n");
+        exit(1);
+    }
+    for (int j = 0; j < code->n_getter_caches; j++) cache_names[j] = -1;
+    for (int i = 0; i < code->len;) {
+        instruction_t instruction = code->bytecodes[i];
+        int args[CODE_MAX_ARGS];
+        i = code_decode(code, i, args);
+        if (!instruction_has_getter_cache(instruction)) continue;
+        int n_args = instruction_args(instruction);
+        cache_names[args[n_args - 1]] = str_map[args[n_args - 2]];
+    }
+
+    code_t *encoded = code_create(NULL, 0, 0, false);
+    code_append(encoded, code, str_map, code_map, 0);
+
+    struct lalac_code header = {
+        .row = code->row,
+        .col = code->col,
+        .is_func = code->is_func,
+        .scope = scope,
+        .n_locals = code->n_locals,
+        .n_getter_caches = code->n_getter_caches,
+        .n_loops = encoded->n_loops,
+        .len = encoded->len,
+    };
+    buf_push(codes, &header, sizeof header);
+    for (int j = 0; j < code->n_locals; j++) {
+        buf_push_i(codes, lalac_add_str(vm, strs, str_map, n_strs, code->locals[j]));
+    }
+    for (int j = 0; j < code->n_getter_caches; j++) buf_push_i(codes, cache_names[j]);
+    for (int j = 0; j < encoded->n_loops; j++) {
+        loop_t *loop = &encoded->loops[j];
+        buf_push_i(codes, loop->start);
+        buf_push_i(codes, loop->end);
+        buf_push_i(codes, loop->break_to);
+        buf_push_i(codes, loop->continue_to);
+    }
+    buf_push(codes, encoded->bytecodes, encoded->len);
+
+    free(cache_names);
+    free(encoded->bytecodes);
+    free(encoded->loops);
+    free(encoded);
+    return true;
+}
+
+static code_t *lalac_get_code(vm_t *vm, code_t *top, int first_code, int j) {
+    // the file's j'th code
+    if (first_code + j == vm->code_cache->len) return top;
+    func_t *func = vm->code_cache->elems[first_code + j]->data.ptr;
+    return func->u.code;
+}
+
+void lalac_write(vm_t *vm, const char *filename, const char *text, code_t *top, int first_code) {
+    // writes the cache for filename, whose code (compiled from text) is
+    // top, plus vm->code_cache from first_code onwards
+    // NOTE: if we can't, never mind, we'll just compile it again next time
+    struct lalac_header header;
+    if (!lalac_set_header(&header, vm, filename, text)) return;
+
+    int n_codes = vm->code_cache->len - first_code + 1;
+    int *code_map = malloc((vm->code_cache->len + 1) * sizeof *code_map);
+    int *str_map = malloc((vm->str_cache->len + 1) * sizeof *str_map);
+    if (!code_map || !str_map) {
+        fprintf(stderr, "Failed to allocate lalac maps\n");
+        exit(1);
+    }
+    for (int j = 0; j < vm->code_cache->len; j++) {
+        code_map[j] = j < first_code? -1: j - first_code;
+    }
+    for (int i = 0; i < vm->str_cache->len; i++) str_map[i] = -1;
+
+    buf_t strs = {0};
+    buf_t codes = {0};
+    int n_strs = 0;
+    bool ok = true;
+    for (int j = 0; ok && j < n_codes; j++) {
+        code_t *code = lalac_get_code(vm, top, first_code, j);
+        int scope = -1;
+        if (code->scope) {
+            // scope is one of ours, if it's anything
+            // NOTE: a function is pushed onto vm->code_cache once it's
+            // compiled, i.e. after the blocks inside of it, so look forwards
+            for (int k = j; scope < 0 && k < n_codes; k++) {
+                if (lalac_get_code(vm, top, first_code, k) == code->scope) scope = k;
+            }
+            if (scope < 0) ok = false;
+        }
+        ok = ok && lalac_push_code(vm, &codes, &strs, str_map, &n_strs, code_map, code, scope);
+    }
+
+    if (ok) {
+        // the codes come after the strs
+        if (codes.len) buf_push(&strs, codes.data, codes.len);
+        header.n_strs = n_strs;
+        header.n_codes = n_codes;
+        header.checksum = hash_chars(HASH_INIT, strs.data, strs.len);
+        char *path = lalac_path(filename);
+        write_file_atomically(path, &header, sizeof header, &strs);
+        free(path);
+    }
+
+    free(strs.data);
+    free(codes.data);
+    free(str_map);
+    free(code_map);
+}
+
+
+/****************
+* LALAC LOAD
+****************/
+
+typedef struct lalac_reader {
+    const char *pos;
+    const char *end;
+} lalac_reader_t;
+
+static const void *lalac_read(lalac_reader_t *r, size_t size) {
+    // returns the next size bytes, or NULL if we ran out
+    if ((size_t)(r->end - r->pos) < size) return NULL;
+    const void *data = r->pos;
+    r->pos += size;
+    return data;
+}
+
+static bool lalac_read_i(lalac_reader_t *r, int32_t *i) {
+    const void *data = lalac_read(r, sizeof *i);
+    if (data) memcpy(i, data, sizeof *i);
+    return data;
+}
+
+static bool lalac_check_code(code_t *src, int n_strs, int n_codes, code_t *code) {
+    // whether src's args are in range, i.e. the file isn't nonsense
+    for (int i = 0; i < src->len;) {
+        instruction_t instruction = src->bytecodes[i];
+        if (instruction >= N_INSTRS) return false;
+        int args[CODE_MAX_ARGS];
+        i = code_decode(src, i, args);
+        if (i > src->len) return false;
+        int n_args = instruction_args(instruction);
+        for (int j = 0; j < n_args; j++) {
+            int arg = args[j];
+            switch (instruction_arg_kind(instruction, j)) {
+                case ARG_STR: if (arg < 0 || arg >= n_strs) return false; break;
+                case ARG_CODE: if (arg < 0 || arg >= n_codes - 1) return false; break;
+                case ARG_GETTER_CACHE: if (arg < 0 || arg >= code->n_getter_caches) return false; break;
+                case ARG_LOCAL: if (!code->scope || arg < 0 || arg >= code->scope->n_locals) return false; break;
+                case ARG_OFFSET: if (i + arg < 0 || i + arg > src->len) return false; break;
+                default: break;
+            }
+        }
+    }
+    return true;
+}
+
+static bool lalac_load_code(vm_t *vm, lalac_reader_t *r, const int *str_map,
+        int n_strs, const int *code_map, int n_codes, code_t *code, const struct lalac_code *header) {
+    // reads the rest of code (after its lalac_code)
+    code->n_locals = header->n_locals;
+    code->locals = malloc((header->n_locals + 1) * sizeof *code->locals);
+    if (!code->locals) {
+        fprintf(stderr, "Failed to allocate lalac locals\n");
+        exit(1);
+    }
+    for (int j = 0; j < header->n_locals; j++) {
+        int32_t i;
+        if (!lalac_read_i(r, &i) || i < 0 || i >= n_strs) return false;
+        code->locals[j] = str_map[i];
+    }
+    for (int j = 0; j < header->n_getter_caches; j++) {
+        int32_t i;
+        if (!lalac_read_i(r, &i) || i < -1 || i >= n_strs) return false;
+        const char *name = i < 0? "": vm->str_cache->items[str_map[i]].name;
+        code_add_getter_cache(code, name);
+    }
+
+    code_t src = {0};
+    for (int j = 0; j < header->n_loops; j++) {
+        int32_t loop[4];
+        for (int k = 0; k < 4; k++) {
+            if (!lalac_read_i(r, &loop[k]) || loop[k] < 0 || loop[k] > header->len) return false;
+        }
+        *code_add_loop(&src) = (loop_t){loop[0], loop[1], loop[2], loop[3]};
+    }
+    src.len = header->len;
+    src.bytecodes = (bytecode_t *)lalac_read(r, header->len);
+    bool ok = src.bytecodes && lalac_check_code(&src, n_strs, n_codes, code);
+
+    if (ok) {
+        code_append(code, &src, (int *)str_map, (int *)code_map, 0);
+        code_trim(code);
+    }
+    free(src.loops);
+    return ok;
+}
+
+code_t *lalac_load(vm_t *vm, const char *filename, const char *text) {
+    // returns filename's code (compiled from text) from its cache, or NULL
+    // if it doesn't have an up to date one
+    struct lalac_header expected;
+    if (!lalac_set_header(&expected, vm, filename, text)) return NULL;
+    char *path = lalac_path(filename);
+    size_t size;
+    const char *mem = map_file(path, sizeof expected, &size);
+    free(path);
+    if (!mem) return NULL;
+
+    lalac_reader_t r = { .pos = mem, .end = mem + size };
+    struct lalac_header header;
+    memcpy(&header, lalac_read(&r, sizeof header), sizeof header);
+    expected.n_strs = header.n_strs;
+    expected.n_codes = header.n_codes;
+    expected.checksum = hash_chars(HASH_INIT, r.pos, r.end - r.pos);
+    if (memcmp(&header, &expected, sizeof header) || header.n_strs < 0 || header.n_codes < 1) {
+        unmap_file(mem, size);
+        return NULL;
+    }
+
+    // strs
+    int n_strs = header.n_strs;
+    int *str_map = malloc((n_strs + 1) * sizeof *str_map);
+    if (!str_map) {
+        fprintf(stderr, "Failed to allocate lalac str map\n");
+        exit(1);
+    }
+    bool ok = true;
+    for (int i = 0; ok && i < n_strs; i++) {
+        int32_t len;
+        const char *s;
+        ok = lalac_read_i(&r, &len) && len >= 0 && (s = lalac_read(&r, len + 1)) && s[len] == '\0';
+        if (!ok) break;
+        dict_item_t *item = dict_get_item(vm->str_cache, s);
+        if (item) str_map[i] = item - vm->str_cache->items;
+        else {
+            char *s2 = strdup(s);
+            if (!s2) {
+                fprintf(stderr, "Failed to allocate lalac str\n");
+                exit(1);
+            }
+            str_map[i] = vm_get_cached_str_i(vm, s2);
+        }
+    }
+
+    // codes
+    // NOTE: we create them all up front, since any of them may be another's
+    // scope; if the file turns out to be broken after all, the ones pushed
+    // onto vm->code_cache are just left empty
+    int n_codes = header.n_codes;
+    int first_code = vm->code_cache->len;
+    const struct lalac_code **code_headers = malloc(n_codes * sizeof *code_headers);
+    code_t **codes = malloc(n_codes * sizeof *codes);
+    int *code_map = malloc(n_codes * sizeof *code_map); // they're pushed in order
+    if (!code_headers || !codes || !code_map) {
+        fprintf(stderr, "Failed to allocate lalac codes\n");
+        exit(1);
+    }
+    for (int j = 0; ok && j < n_codes; j++) {
+        // the headers are spread out, so find them all first
+        struct lalac_code code_header;
+        const void *data = lalac_read(&r, sizeof code_header);
+        ok = data != NULL;
+        if (!ok) break;
+        memcpy(&code_header, data, sizeof code_header);
+        code_headers[j] = data;
+        size_t rest = (size_t)(code_header.n_locals + code_header.n_getter_caches
+            + 4 * code_header.n_loops) * sizeof(int32_t) + code_header.len;
+        ok = code_header.n_locals >= 0 && code_header.n_getter_caches >= 0
+            && code_header.n_loops >= 0 && code_header.len >= 0
+            && code_header.scope >= -1 && code_header.scope < n_codes
+            && lalac_read(&r, rest);
+        if (ok) {
+            codes[j] = code_create(filename, code_header.row, code_header.col, code_header.is_func);
+            if (j < n_codes - 1) vm_push_code(vm, codes[j]);
+            code_map[j] = first_code + j;
+        }
+    }
+    ok = ok && r.pos == r.end;
+    for (int j = 0; ok && j < n_codes; j++) {
+        struct lalac_code code_header;
+        memcpy(&code_header, code_headers[j], sizeof code_header);
+        if (code_header.scope >= 0) codes[j]->scope = codes[code_header.scope];
+        // (lalac_check_code needs to know how many locals a scope has)
+        codes[j]->n_locals = code_header.n_locals;
+    }
+    for (int j = 0; ok && j < n_codes; j++) {
+        struct lalac_code code_header;
+        memcpy(&code_header, code_headers[j], sizeof code_header);
+        r.pos = (const char *)code_headers[j] + sizeof code_header;
+        ok = lalac_load_code(vm, &r, str_map, n_strs, code_map, n_codes, codes[j], &code_header);
+    }
+
+    code_t *top = ok? codes[n_codes - 1]: NULL;
+    free(code_headers);
+    free(codes);
+    free(code_map);
+    free(str_map);
+    unmap_file(mem, size);
+    return top;
+}
@@ -27,17 +27,43 @@ int main(int n_args, char **args) {
     bool quiet = getenv_int("QUIET", false);
     bool eval = getenv_int("EVAL", true);
     bool stdlib = getenv_int("STDLIB", true);
+    bool optimize = getenv_int("OPTIMIZE", true);
+    bool jit = getenv_int("JIT", false);
+    bool lalac = getenv_int("LALAC", false);
+    bool stdlib_snapshot = getenv_int("STDLIB_SNAPSHOT", false);
+    const char *snapshot = getenv("SNAPSHOT");
     int print_tokens = getenv_int("PRINT_TOKENS", 0);
     int print_code = getenv_int("PRINT_CODE", 0);
     int print_stack = getenv_int("PRINT_STACK", 0);
     int print_eval = getenv_int("PRINT_EVAL", 0);
 
-    vm_t *vm = vm_create();
+    // maybe start from a snapshot (see vm_create_from_snapshot): either the
+    // one given by SNAPSHOT, or with STDLIB_SNAPSHOT=1, the stdlib's, which
+    // gets written next to stdlib.lala the first time, and whenever
+    // stdlib.lala changes
+    vm_t *vm = NULL;
+    if (snapshot && snapshot[0] != '\0') {
+        vm = vm_create_from_snapshot(snapshot, NULL, optimize);
+        if (!vm) {
+            fprintf(stderr, "Could not load snapshot '%s'\n", snapshot);
+            exit(1);
+        }
+    } else if (stdlib && stdlib_snapshot) {
+        vm = vm_create_from_snapshot("stdlib.snap", "stdlib.lala", optimize);
+    }
+    bool restored = vm;
+    if (!vm) vm = vm_create();
     compiler_t *compiler = compiler_create(vm, "<stdin>");
+    vm->optimize = optimize;
+    vm->jit = jit;
+    vm->lalac = lalac;
 
     // NOTE: include stdlib *before* turning on any debug print stuff!..
     // we can debug the stdlib itself separately
-    if (stdlib) vm_include(vm, "stdlib.lala");
+    if (stdlib && !restored) {
+        vm_include(vm, "stdlib.lala", true);
+        if (stdlib_snapshot) snapshot_write(vm, "stdlib.snap", "stdlib.lala", false);
+    }
 
     vm->debug_print_tokens = print_tokens;
     vm->debug_print_code = print_code;
@@ -49,6 +75,7 @@ int main(int n_args, char **args) {
     bool continuing_line = false;
     while (true) {
         if (eval && !quiet) fputs(continuing_line? "... ": ">>> ", stdout);
+        errno = 0; // (e.g. vm_include may have left it set)
         if (getline(&line, &line_size, stdin) < 0) {
             if (errno) {
                 fprintf(stderr, "Error getting line from stdin: ");
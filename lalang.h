@@ -2,6 +2,8 @@
 #define _LALANG_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 
 /************************************
@@ -9,9 +11,13 @@
 ************************************/
 
 typedef enum instruction instruction_t;
+typedef enum arg_kind arg_kind_t;
 typedef enum cmp_result cmp_result_t;
 typedef struct type type_t;
 typedef struct object object_t;
+typedef struct str str_t;
+typedef struct strview strview_t;
+typedef struct strbuf strbuf_t;
 typedef struct list list_t;
 typedef struct dict_item dict_item_t;
 typedef struct dict dict_t;
@@ -19,10 +25,21 @@ typedef enum iteration iteration_t;
 typedef union iterator_data iterator_data_t;
 typedef struct custom_iterator custom_iterator_t;
 typedef struct iterator iterator_t;
-typedef union bytecode bytecode_t;
 typedef struct code code_t;
+typedef struct getter_cache getter_cache_t;
+typedef struct loop loop_t;
+typedef struct jit jit_t;
 typedef struct func func_t;
 typedef struct cls cls_t;
+typedef struct locals locals_t;
+typedef struct call_frame call_frame_t;
+typedef struct global_slot global_slot_t;
+typedef struct builtin builtin_t;
+typedef struct buf buf_t;
+typedef struct file_stamp file_stamp_t;
+typedef struct gc_kind gc_kind_t;
+typedef struct gc gc_t;
+typedef enum unwind unwind_t;
 typedef struct vm vm_t;
 typedef struct compiler_frame compiler_frame_t;
 typedef struct compiler compiler_t;
@@ -43,7 +60,13 @@ typedef cmp_result_t cmp_t(object_t *self, object_t *other, vm_t *vm);
 
 // object attributes/methods
 typedef bool getter_t(object_t *self, const char *name, vm_t *vm);
+typedef void method_t(object_t *self, int sym, vm_t *vm);
 typedef void print_t(object_t *self);
+typedef void trace_t(object_t *self);
+
+// garbage collection of allocated blocks
+typedef void gc_trace_t(void *ptr);
+typedef void gc_finalize_t(void *ptr);
 
 
 /****************
@@ -59,13 +82,120 @@ enum cmp_result {
 
 void print_tabs(int depth, FILE *file);
 void print_string_quoted(const char *s);
+void print_chars_quoted(const char *s, int len);
 char *read_file(const char *filename, bool required);
 int get_index(int i, int len, const char *type_name);
+unsigned hash_string(const char *s);
+
+// FNV-1a's parameters, for hash_string and hash_chars
+#define HASH_INIT 2166136261u
+#define HASH_PRIME 16777619u
+
+uint32_t hash_chars(uint32_t hash, const void *data, size_t len);
+
+// A growable array of bytes, e.g. a file being put together before it's
+// written
+struct buf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+void buf_push(buf_t *buf, const void *data, size_t size);
+void buf_push_i(buf_t *buf, int32_t i);
+
+// What a file cached from a source file (e.g. a .lalac file, or a
+// snapshot) remembers about it, so it's only used while that's unchanged
+struct file_stamp {
+    uint32_t hash; // hash_string of its text
+    int64_t mtime;
+    int64_t size;
+};
+
+bool file_stamp_set(file_stamp_t *stamp, const char *filename, const char *text);
+bool write_file_atomically(const char *filename, const void *header, size_t header_size, const buf_t *buf);
+const void *map_file(const char *filename, size_t min_size, size_t *size);
+void unmap_file(const void *mem, size_t size);
 
 #define MAX(_x, _y) ((_x) > (_y)? (_x): (_y))
 #define MIN(_x, _y) ((_x) < (_y)? (_x): (_y))
 
 
+/****************
+* GC
+****************/
+
+// What kind of thing a block allocated with gc_alloc is
+struct gc_kind {
+    const char *name;
+    gc_trace_t *trace; // calls gc_mark on each pointer in the block (may be NULL)
+    gc_finalize_t *finalize; // frees whatever the block owns (may be NULL)
+};
+
+#define GC_DEFAULT_THRESHOLD (4 * 1024 * 1024)
+
+// Small blocks are allocated from an arena of chunks, see gc.c
+#define GC_CHUNK_SIZE (32 * 1024)
+#define GC_N_CHUNKS 2048
+
+// Free blocks in old chunks are kept in pools by size (in steps of 16 bytes,
+// with the last pool holding everything bigger), see gc.c
+#define GC_N_POOLS (GC_CHUNK_SIZE / 16 / 16 + 2)
+
+enum {
+    GC_CHUNK_FREE,
+    GC_CHUNK_YOUNG, // part of the nursery
+    GC_CHUNK_OLD, // survived a minor collection
+};
+
+struct gc {
+    // we do a major collection once this many bytes have become old since
+    // the last one (or since startup), and at least as many as survived it
+    long threshold;
+    long allocated;
+
+    long live; // old bytes in use
+    long n_blocks; // old blocks in use
+    long collections; // major ones
+    long minor_collections;
+    long reclaimed; // total bytes freed by collections
+
+    vm_t *vms; // linked by vm->gc_next; their roots are marked by vm_gc_mark_roots
+    void *stack_base; // the C stack is scanned from here down
+
+    char *arena;
+    unsigned char chunk_states[GC_N_CHUNKS];
+
+    long pool_blocks[GC_N_POOLS]; // free blocks in each pool
+    long pool_bytes; // total size of the pooled blocks
+};
+
+extern gc_t gc;
+
+void *gc_alloc(size_t size, gc_kind_t *kind);
+char *gc_strdup(const char *s);
+void gc_mark(void *ptr);
+void gc_collect(void);
+void gc_minor_collect(void);
+void gc_add_vm(vm_t *vm);
+void gc_remember(void *ptr);
+
+static inline bool gc_is_young(void *ptr) {
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)gc.arena;
+    return offset < (uintptr_t)GC_N_CHUNKS * GC_CHUNK_SIZE &&
+        gc.chunk_states[offset / GC_CHUNK_SIZE] == GC_CHUNK_YOUNG;
+}
+
+static inline void gc_write_barrier(void *owner, void *value) {
+    // must be called when a pointer to value is stored in owner, unless
+    // owner is young (e.g. it was only just created), or is a root (e.g. the
+    // VM's stack)
+    if (gc_is_young(value) && !gc_is_young(owner)) gc_remember(owner);
+}
+
+extern gc_kind_t str_gc_kind;
+
+
 /****************
 * CODE
 ****************/
@@ -85,6 +215,49 @@ enum instruction {
     INSTR_SETTER,
     INSTR_RENAME_FUNC,
 
+    // Control flow, for the builtins which the compiler inlines (see
+    // inline_builtin_names).
+    // NOTE: a jump's offset is its last arg, and counts from the end of
+    // the jump instruction.
+    INSTR_JUMP,
+    INSTR_JUMP_IF_FALSE,
+    INSTR_CHECK_BUILTIN,
+    INSTR_ITER,
+    INSTR_FOR_ITER,
+    INSTR_POP_ITER,
+
+    // @break, @continue and @return
+    // NOTE: BREAK and CONTINUE have room for an offset, because when the
+    // loop they're in is inlined, the compiler turns them into JUMPs
+    INSTR_BREAK,
+    INSTR_CONTINUE,
+    INSTR_RETURN,
+
+    // Superinstructions, which code_optimize fuses common sequences into
+    INSTR_LOAD_LOCAL_GETTER, // LOAD_LOCAL, GETTER
+    INSTR_STORE_LOAD_LOCAL, // STORE_LOCAL, LOAD_LOCAL of the same local
+    INSTR_ADD_INT_CONST, // LOAD_INT, ADD
+    INSTR_SUB_INT_CONST, // LOAD_INT, SUB
+    INSTR_LT_INT_CONST, // LOAD_INT, LT
+    INSTR_DUP, // replaces a LOAD_LOCAL or LOAD_GLOBAL of what's on top already
+
+    // Quickened instructions, which vm_eval rewrites GETTERs (see
+    // vm_quicken_getter) and COMMAs into once they've seen the same type a
+    // few times; if they see another type, they turn back.
+    // NOTE: the order of these is important! The LOCAL versions are of
+    // LOAD_LOCAL_GETTER, and must be in the same order as the others.
+    INSTR_GETTER_METHOD, // calls the type's method directly
+    INSTR_LIST_LEN,
+    INSTR_LIST_GET,
+    INSTR_STR_LEN,
+    INSTR_STR_GET,
+    INSTR_LOCAL_GETTER_METHOD,
+    INSTR_LOCAL_LIST_LEN,
+    INSTR_LOCAL_LIST_GET,
+    INSTR_LOCAL_STR_LEN,
+    INSTR_LOCAL_STR_GET,
+    INSTR_LIST_COMMA,
+
     // OPS
     // NOTE: the order of these is important!
     // They come at the end of the enum, so that we can define N_OPS in
@@ -118,6 +291,10 @@ enum instruction {
 #define FIRST_LOCAL_INSTR INSTR_LOAD_LOCAL
 #define LAST_LOCAL_INSTR INSTR_CALL_LOCAL
 #define N_GLOBAL_INSTRS (LAST_GLOBAL_INSTR - FIRST_GLOBAL_INSTR + 1)
+#define FIRST_QUICK_GETTER INSTR_GETTER_METHOD
+#define FIRST_LOCAL_QUICK_GETTER INSTR_LOCAL_GETTER_METHOD
+#define LAST_QUICK_GETTER INSTR_LOCAL_STR_GET
+#define N_QUICK_GETTERS (FIRST_LOCAL_QUICK_GETTER - FIRST_QUICK_GETTER)
 #define FIRST_OP_INSTR INSTR_NEG
 #define FIRST_INT_OP (INSTR_NEG - FIRST_OP_INSTR)
 #define LAST_INT_OP (INSTR_MOD - FIRST_OP_INSTR)
@@ -132,13 +309,158 @@ extern int op_arities[N_OPS];
 extern const char *instruction_names[N_INSTRS];
 extern const char *operator_tokens[N_OPS];
 
+// What an instruction's arg is (see instruction_arg_kind)
+enum arg_kind {
+    ARG_INT,
+    ARG_STR, // an index into vm->str_cache
+    ARG_CODE, // an index into vm->code_cache
+    ARG_LOCAL, // a slot in code->scope's locals
+    ARG_GETTER_CACHE, // an index into code->getter_caches
+    ARG_OFFSET, // see bytecode_t
+};
+
 int instruction_args(instruction_t instruction);
+arg_kind_t instruction_arg_kind(instruction_t instruction, int j);
+bool instruction_is_jump(instruction_t instruction);
+bool instruction_has_getter_cache(instruction_t instruction);
+
+// Builtins which the compiler inlines when they're called with literal code
+// blocks, e.g. "x { a } { b } @ifelse".
+// The inlined code starts with CHECK_BUILTIN, which checks that the global
+// is still the builtin (and jumps to a regular call of it otherwise).
+// NOTE: the order of these must match that of inline_builtin_names.
+enum {
+    INLINE_IF,
+    INLINE_IFELSE,
+    INLINE_WHILE,
+    INLINE_FOR,
+    N_INLINE_BUILTINS
+};
 
-union bytecode {
-    instruction_t instruction;
-    int i;
+extern const char *inline_builtin_names[N_INLINE_BUILTINS];
+
+// Symbols are the names of built-in types' methods, which they look up in
+// their method tables (see type_t.methods) rather than comparing strings.
+// The operators come first, so an op is also its own symbol.
+// NOTE: the order of the names must match that of symbol_names.
+enum {
+    SYM_NEG,
+    SYM_ADD,
+    SYM_SUB,
+    SYM_MUL,
+    SYM_DIV,
+    SYM_MOD,
+    SYM_NOT,
+    SYM_AND,
+    SYM_OR,
+    SYM_XOR,
+    SYM_EQ,
+    SYM_NE,
+    SYM_LT,
+    SYM_LE,
+    SYM_GT,
+    SYM_GE,
+    SYM_COMMA,
+    SYM_CALL,
+
+    // names
+    SYM_ITER,
+    SYM_NEXT,
+    SYM_LEN,
+    SYM_GET,
+    SYM_SET,
+    SYM_HAS,
+    SYM_DEL,
+    SYM_COPY,
+    SYM_SLICE,
+    SYM_WRITE,
+    SYM_WRITELINE,
+    SYM_REPLACE,
+    SYM_TIMES,
+    SYM_EXTEND,
+    SYM_POP,
+    SYM_PUSH,
+    SYM_SORT,
+    SYM_REVERSE,
+    SYM_UNBUILD,
+    SYM_UNPAIR,
+    SYM_KEYS,
+    SYM_VALUES,
+    SYM_ITEMS,
+    SYM_UPDATE,
+    SYM_GET_KEY,
+    SYM_GET_VALUE,
+    SYM_GET_ITEM,
+    SYM_GET_DEFAULT,
+    SYM_NAME,
+    SYM_FILENAME,
+    SYM_TO_DICT,
+    SYM_STACK,
+    SYM_LOCALS,
+    SYM_PUSH_STACK,
+    SYM_SET_LOCAL,
+    SYM_PRINT_CODE,
+    SYM_TO_LIST,
+    SYM_TO_STR,
+    SYM_SPLIT,
+    SYM_STRIP,
+    SYM_FIND,
+    SYM_COUNT,
+    SYM_STARTSWITH,
+    SYM_ENDSWITH,
+    SYM_JOIN,
+
+    N_SYMS
 };
 
+#define FIRST_NAMED_SYM SYM_ITER
+
+extern const char *symbol_names[N_SYMS - FIRST_NAMED_SYM];
+
+int symbol_find(const char *name);
+
+// Bytecode is a string of bytes: each instruction is its opcode (one byte,
+// so N_INSTRS can't go past 256), followed by its args (see
+// instruction_args), each taking two bytes, or six if it doesn't fit in
+// an int16_t (see code_push_i), except for offsets (the last arg of a jump,
+// or of BREAK or CONTINUE), which always take CODE_OFFSET_SIZE bytes, so
+// that they can be patched.
+// NOTE: packing small args into one byte would be a bit smaller, but then
+// vm_eval has to work out each arg's size, which costs more than it saves
+typedef uint8_t bytecode_t;
+
+#define CODE_OFFSET_SIZE 4
+#define CODE_MAX_ARGS 3 // the most args an instruction has
+#define CODE_WIDE_ARG INT16_MIN // an arg which is followed by the real one
+
+// NOTE: args almost never need the wide form, and GCC needs telling that
+#ifdef __GNUC__
+#define CODE_LIKELY(x) __builtin_expect(!!(x), 1)
+#else
+#define CODE_LIKELY(x) (x)
+#endif
+
+static inline int code_read_arg(bytecode_t *bytecodes, int *i_ptr) {
+    // reads the arg at *i_ptr, and moves *i_ptr past it
+    int16_t arg;
+    memcpy(&arg, &bytecodes[*i_ptr], sizeof arg);
+    *i_ptr += sizeof arg;
+    if (CODE_LIKELY(arg != CODE_WIDE_ARG)) return arg;
+    // CODE_WIDE_ARG, then the int as 4 bytes (like an offset)
+    int32_t wide_arg;
+    memcpy(&wide_arg, &bytecodes[*i_ptr], sizeof wide_arg);
+    *i_ptr += sizeof wide_arg;
+    return wide_arg;
+}
+
+static inline int code_read_offset(bytecode_t *bytecodes, int *i_ptr) {
+    // (an offset is an int32_t, as is: see code_set_offset)
+    int32_t off;
+    memcpy(&off, &bytecodes[*i_ptr], sizeof off);
+    *i_ptr += CODE_OFFSET_SIZE;
+    return off;
+}
+
 struct code {
     // Where this code was compiled from
     const char *filename;
@@ -147,13 +469,78 @@ struct code {
 
     bool is_func; // are we a function [...] or a code block {...}?
 
+    // The function whose local variables we use: ourselves if is_func,
+    // otherwise the function we were compiled inside of (or NULL).
+    // LOAD_LOCAL, STORE_LOCAL and CALL_LOCAL take an index into
+    // scope->locals, which is also the variable's slot in a locals_t.
+    code_t *scope;
+    int n_locals;
+    int *locals; // indexes into vm->str_cache indicating local variable names
+
+    // NOTE: the compiler trims bytecodes down to len once we're compiled
     int len;
+    int size; // how many bytecodes we have room for
     bytecode_t *bytecodes;
+
+    // GETTER and SETTER take an index into vm->str_cache, and then one
+    // into getter_caches (as do LOAD_LOCAL_GETTER, after its local, and the
+    // quickened GETTERs)
+    int n_getter_caches;
+    getter_cache_t *getter_caches;
+
+    // The loops inlined into us, inner ones first
+    int n_loops;
+    loop_t *loops;
+
+    // How many times we've started (or gone round a loop), and our machine
+    // code once that's VM_JIT_THRESHOLD (see jit_compile)
+    unsigned hotness;
+    jit_t *jit;
+};
+
+// An inline cache for a GETTER or SETTER instruction: what looking up the
+// name in a class found last time, so that we only need to look in the
+// instance's attrs (see object_cached_getter)
+struct getter_cache {
+    unsigned hash; // hash_string(name)
+    int sym; // symbol_find(name)
+    int i; // where name was last found in an instance's attrs
+
+    type_t *type; // the class we looked in (NULL if none yet)
+    unsigned long version; // ...the version of its getters/setters
+    unsigned long attrs_version; // ...and of its class_attrs
+    object_t *func; // the class's getter/setter for name (or NULL)
+    object_t *attr; // the class attr, if there was no getter (or NULL)
+
+    // for quickening (see vm_quicken_getter)
+    type_t *quick_type; // the type of object we got last time
+    int hits; // ...and how many times we've got it since it changed
+    int deopts; // how many times our quickened GETTER has turned back
+    method_t *method; // quick_type's method for sym
+};
+
+// Where a @break or @continue should go, if it happens while running the
+// bytecodes from start up to end (e.g. in a code block called from there)
+struct loop {
+    int start;
+    int end;
+    int break_to;
+    int continue_to;
 };
 
 code_t *code_create(const char *filename, int row, int col, bool is_func);
-code_t *code_push_instruction(code_t *code, instruction_t instruction);
-code_t *code_push_i(code_t *code, int i);
+void code_push_instruction(code_t *code, instruction_t instruction);
+void code_push_i(code_t *code, int i);
+int code_push_offset(code_t *code, int off);
+void code_set_offset(code_t *code, int pos, int off);
+bool instruction_has_offset(instruction_t instruction);
+int code_decode(code_t *code, int i, int *args);
+void code_trim(code_t *code);
+void code_append(code_t *code, code_t *src, int *str_map, int *code_map, int first_getter_cache);
+int code_add_getter_cache(code_t *code, const char *name);
+loop_t *code_add_loop(code_t *code);
+loop_t *code_find_loop(code_t *code, int i);
+void code_optimize(code_t *code);
 
 
 /****************
@@ -175,9 +562,16 @@ struct type {
     getter_t *type_setter;
 
     // object attributes/methods
+    // A method table is indexed by symbol, and may be NULL, as may any of
+    // its entries; if so, we fall back to the getter
+    method_t **methods;
     getter_t *getter;
     getter_t *setter;
     print_t *print;
+
+    // marks whatever objects of this type point to; if NULL, data.ptr is
+    // marked
+    trace_t *trace;
 };
 
 object_t *object_create_type(type_t *type);
@@ -198,15 +592,33 @@ struct object {
     } data;
 };
 
+// Ints aren't allocated: they live in the object_t pointer itself, shifted
+// left by one with the low bit set. (Real objects are at least 2-byte
+// aligned, so their low bit is always 0.)
+// So use object_type(obj) rather than obj->type, unless obj can't be an int.
+#define OBJECT_IS_INT(_obj) ((uintptr_t)(_obj) & 1)
+#define OBJECT_FROM_INT(_i) ((object_t *)(((uintptr_t)(intptr_t)(_i) << 1) | 1))
+#define OBJECT_TO_INT(_obj) ((int)((intptr_t)(_obj) >> 1))
+
+extern type_t int_type;
+
+static inline type_t *object_type(object_t *obj) {
+    return OBJECT_IS_INT(obj)? &int_type: obj->type;
+}
+
 object_t *object_create(type_t *type);
 bool object_to_bool(object_t *self);
 int object_to_int(object_t *self);
 const char *object_to_str(object_t *self);
+const char *object_to_chars(object_t *self, int *len);
 cmp_result_t object_cmp(object_t *self, object_t *other, vm_t *vm);
 list_t *object_to_pair(object_t *self);
 char object_to_char(object_t *self);
+void object_method(object_t *self, int sym, const char *name, vm_t *vm);
 void object_getter(object_t *self, const char *name, vm_t *vm);
 void object_setter(object_t *self, const char *name, vm_t *vm);
+void object_cached_getter(object_t *self, const char *name, getter_cache_t *cache, vm_t *vm);
+void object_cached_setter(object_t *self, const char *name, getter_cache_t *cache, vm_t *vm);
 void object_print(object_t *self);
 
 
@@ -245,11 +657,64 @@ extern type_t int_type;
 * STR
 ****************/
 
+// strs are objects with a few more fields, so that e.g. their length and
+// hash aren't recomputed all the time
+// NOTE: data.ptr is still their (NUL-terminated) chars, so object_to_str
+// works the same for them as for anything else
+struct str {
+    object_t object;
+    int len;
+    unsigned hash; // hash_string of the chars, once hashed is set
+    bool hashed;
+    bool interned; // whether this is vm->str_cache's str for its chars
+};
+
+static inline int str_get_len(object_t *self) {
+    return ((str_t *)self)->len;
+}
+
 object_t *object_create_str(const char *s);
+object_t *object_create_str_len(const char *s, int len);
+unsigned str_get_hash(object_t *self);
+void str_set_hash(object_t *self, unsigned hash);
+bool str_eq(object_t *self, object_t *other);
 
 extern type_t str_type;
 
 
+/****************
+* STRVIEW
+****************/
+
+// a slice of a str (see str_t), made by .slice
+struct strview {
+    object_t object; // data.ptr is the str
+    int start;
+    int len;
+};
+
+object_t *object_create_strview(object_t *str, int start, int len);
+
+extern type_t strview_type;
+
+/****************
+* STRBUF
+****************/
+
+struct strbuf {
+    int len;
+    int size; // allocated size of chars
+    char *chars; // NUL-terminated (unless size is 0)
+};
+
+strbuf_t *strbuf_create(void);
+void strbuf_append(strbuf_t *buf, const char *s, int len);
+void strbuf_append_obj(strbuf_t *buf, object_t *obj);
+object_t *object_create_strbuf(strbuf_t *buf);
+
+extern type_t strbuf_type;
+
+
 /****************
 * LIST
 ****************/
@@ -281,20 +746,40 @@ extern type_t list_type;
 
 struct dict_item {
     const char *name;
+    unsigned hash; // hash_string(name)
     object_t *value;
 };
 
 struct dict {
+    // items are kept in insertion order, so they can be iterated over (and
+    // indexed into) directly
     int len;
+    int size; // allocated size of items
     dict_item_t *items;
+    int n_deleted; // deleted items (with a NULL name) still in items, see dict_del
+
+    // open-addressing hash table of indexes into items (-1 means empty)
+    int n_buckets; // always 0 or a power of 2
+    int *buckets;
+
+    // changes whenever the dict does, and is never reused by another dict,
+    // so caches can check whether what they found in it is still there
+    unsigned long version;
 };
 
+extern unsigned long dict_last_version;
+
 dict_t *dict_create(void);
 dict_t *dict_copy(dict_t *dict);
 object_t *object_create_dict(dict_t *dict);
 dict_item_t *dict_get_item(dict_t *dict, const char *name);
+dict_item_t *dict_get_item_hashed(dict_t *dict, const char *name, unsigned hash);
+dict_item_t *dict_get_item_hinted(dict_t *dict, const char *name, unsigned hash, int *hint);
 object_t *dict_get(dict_t *dict, const char *name);
 void dict_set(dict_t *dict, const char *name, object_t *value);
+void dict_set_hashed(dict_t *dict, const char *name, unsigned hash, object_t *value);
+void dict_set_item(dict_t *dict, dict_item_t *item, object_t *value);
+bool dict_del(dict_t *dict, const char *name);
 void dict_update(dict_t *dict, dict_t *other);
 
 extern type_t dict_type;
@@ -394,6 +879,7 @@ struct cls {
     dict_t *setters;
 };
 
+bool cls_getter(object_t *self, const char *name, vm_t *vm);
 type_t *type_create_cls(const char *name, cls_t *cls);
 object_t *object_create_cls(const char *name, vm_t *vm);
 object_t *object_copy_cls(cls_t *target_cls, const char *name);
@@ -404,27 +890,93 @@ object_t *object_copy_cls(cls_t *target_cls, const char *name);
 ****************/
 
 #define VM_STACK_SIZE (1024 * 1024)
+#define VM_SLOTS_SIZE (1024 * 1024)
+#define VM_ITERS_SIZE (64 * 1024)
+#define VM_FRAMES_SIZE (256 * 1024)
+#define VM_QUICKEN_HITS 8 // see vm_quicken_getter
+#define VM_QUICKEN_MAX_DEOPTS 4
+#define VM_JIT_THRESHOLD 100 // see jit_compile
+
+
+// The local variables of a running function
+struct locals {
+    code_t *scope;
+    object_t **slots; // scope->n_locals of them, NULL if not yet assigned
+    locals_t *prev; // the caller's locals
+    bool has_blocks; // has a code block which uses us been loaded?
+};
+
+// A running call of some code: vm_eval pushes one, and then runs its code,
+// plus that of any functions it calls, in a loop, with their own frames
+struct call_frame {
+    code_t *code;
+    int i; // where we are in code->bytecodes, while running something we called
+    locals_t *locals; // the locals we use (own_locals, or a caller's), or NULL
+    locals_t own_locals; // if we're a function, or were given locals
+    locals_t *prev_locals; // vm->locals when we started
+    object_t **prev_iters_top; // vm->iters_top when we started
+    dict_t *locals_out; // see vm_eval_to_dict
+    bool is_base; // were we pushed by vm_eval itself, rather than a call?
+};
+
+// Where a global variable was last found in vm->globals: valid as long as
+// vm->globals->items[i].name is still the same pointer
+struct global_slot {
+    int i;
+    const char *name;
+};
+
+struct builtin {
+    const char *name;
+    c_code_t *c_code;
+};
 
-#define VM_MIN_CACHED_INT (-100)
-#define VM_MAX_CACHED_INT (100)
-#define VM_INT_CACHE_SIZE (VM_MAX_CACHED_INT - VM_MIN_CACHED_INT + 1)
+extern builtin_t vm_builtins[]; // ends with {NULL, NULL}
+
+// What the VM is doing after a @break, @continue or @return which wasn't
+// just a jump, i.e. which has to leave the vm_eval it happened in
+enum unwind {
+    UNWIND_NONE,
+    UNWIND_BREAK,
+    UNWIND_CONTINUE,
+    UNWIND_RETURN
+};
 
 struct vm {
     object_t *stack[VM_STACK_SIZE];
     object_t **stack_top;
-    object_t *int_cache[VM_INT_CACHE_SIZE];
+    object_t *slots[VM_SLOTS_SIZE]; // storage for each locals_t's slots
+    object_t **slots_top; // first unused slot
+    object_t *iters[VM_ITERS_SIZE]; // iterators of running inlined @for loops
+    object_t **iters_top;
+    call_frame_t *frames; // VM_FRAMES_SIZE of them
+    call_frame_t *frames_top;
+    // the string pool: strs are never removed from it, so their indexes
+    // can be used as IDs (e.g. by bytecode), and its buckets are a hash
+    // index from contents to ID
     dict_t *str_cache;
+    int str_cache_max_len; // of the longest str in str_cache
     object_t *char_cache[256];
     list_t *code_cache;
     dict_t *globals;
-    dict_t *locals; // may be NULL
+    global_slot_t *global_slots; // indexed by vm->str_cache index
+    int n_global_slots;
+    locals_t *locals; // may be NULL
+    object_t *inline_builtins[N_INLINE_BUILTINS]; // see CHECK_BUILTIN
+    unwind_t unwind;
 
     int eval_depth;
+    long instr_count; // number of instructions evaluated so far
 
     int debug_print_tokens;
     int debug_print_code;
     int debug_print_stack;
     int debug_print_eval;
+    bool optimize; // whether the compiler runs code_optimize
+    bool jit; // whether vm_eval compiles hot code to machine code
+    bool lalac; // whether vm_include caches compiled code (see lalac_load)
+
+    vm_t *gc_next;
 };
 
 object_t *object_create_vm(vm_t *vm);
@@ -440,21 +992,56 @@ void vm_drop(vm_t *vm, int n);
 object_t *vm_pop(vm_t *vm);
 void vm_push(vm_t *vm, object_t *obj);
 int vm_get_cached_str_i(vm_t *vm, const char *s);
+int vm_intern_str_i(vm_t *vm, const char *s);
 object_t *vm_get_cached_str(vm_t *vm, const char *s);
 object_t *vm_get_or_create_str(vm_t *vm, const char *s);
+object_t *vm_get_or_create_str_len(vm_t *vm, const char *s, int len);
+object_t *vm_get_or_create_str_hashed(vm_t *vm, const char *s, unsigned hash);
 object_t *vm_get_char_str(vm_t *vm, char c);
 object_t *vm_get_or_create_int(vm_t *vm, int i);
 void vm_push_code(vm_t *vm, code_t *code);
 
 vm_t *vm_create(void);
+vm_t *vm_create_from_snapshot(const char *filename, const char *source, bool optimize);
+void vm_gc_mark_roots(vm_t *vm);
 void vm_print_stack(vm_t *vm);
 void vm_print_code(vm_t *vm, code_t *code, int depth);
 object_t *vm_iter(vm_t *vm);
+dict_item_t *vm_get_global_item(vm_t *vm, int j);
+const char *vm_get_local_name(vm_t *vm, code_t *scope, int slot);
+void vm_cmp(vm_t *vm, instruction_t instruction);
+void vm_op(vm_t *vm, instruction_t instruction);
+dict_t *locals_to_dict(locals_t *locals, vm_t *vm);
 void vm_eval(vm_t *vm, code_t *code, dict_t *locals);
-void vm_include(vm_t *vm, const char *filename);
+void vm_eval_to_dict(vm_t *vm, code_t *code, dict_t *locals);
+bool vm_include(vm_t *vm, const char *filename, bool required);
 void vm_eval_text(vm_t *vm, char *text, const char *filename);
 
 
+/****************
+* JIT
+****************/
+
+jit_t *jit_compile(code_t *code);
+int jit_run(vm_t *vm, jit_t *jit, int i);
+
+
+/****************
+* LALAC
+****************/
+
+code_t *lalac_load(vm_t *vm, const char *filename, const char *text);
+void lalac_write(vm_t *vm, const char *filename, const char *text, code_t *top, int first_code);
+
+
+/****************
+* SNAPSHOT
+****************/
+
+bool snapshot_write(vm_t *vm, const char *filename, const char *source, bool required);
+bool snapshot_load(vm_t *vm, const char *filename, const char *source, bool optimize);
+
+
 /****************
 * COMPILER
 ****************/
@@ -463,8 +1050,11 @@ void vm_eval_text(vm_t *vm, char *text, const char *filename);
 
 struct compiler_frame {
     code_t *code;
-    int n_locals;
-    int *locals; // indexes into vm->str_cache indicating local variable names
+
+    // Where the last two code blocks {...} were loaded in code, or -1
+    // (used to find the literal blocks passed to an inlined builtin)
+    int last_block;
+    int prev_block;
 };
 
 struct compiler {
@@ -1,7 +1,9 @@
+#define _GNU_SOURCE // for memmem
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "lalang.h"
 
@@ -22,14 +24,14 @@ void type_print(object_t *self) {
 }
 
 cmp_result_t type_cmp(object_t *self, object_t *other, vm_t *vm) {
-    if (other->type != &type_type) return CMP_NE;
+    if (object_type(other) != &type_type) return CMP_NE;
     else return self->data.ptr == other->data.ptr? CMP_EQ: CMP_NE;
 }
 
 bool type_getter(object_t *self, const char *name, vm_t *vm) {
     type_t *type = self->data.ptr;
-    if (type->type_getter) {
-        return type->type_getter(self, name, vm);
+    if (type->type_getter && type->type_getter(self, name, vm)) {
+        return true;
     } else if (!strcmp("name", name)) {
         vm_push(vm, vm_get_or_create_str(vm, type->name));
     } else {
@@ -63,24 +65,33 @@ object_t static_type = {
 * OBJECT
 ****************/
 
+static void object_trace(void *ptr) {
+    object_t *obj = ptr;
+    type_t *type = obj->type;
+    gc_mark(type); // class types are allocated, builtin ones are static
+    if (type->trace) type->trace(obj);
+    else gc_mark(obj->data.ptr);
+}
+
+static gc_kind_t object_gc_kind = {
+    .name = "object",
+    .trace = object_trace,
+};
+
 object_t *object_create(type_t *type) {
-    object_t *object = calloc(1, sizeof *object);
-    if (!object) {
-        fprintf(stderr, "Failed to allocate memory for object of type '%s'\n", type->name);
-        exit(1);
-    }
+    object_t *object = gc_alloc(sizeof *object, &object_gc_kind);
     object->type = type;
     return object;
 }
 
 bool object_to_bool(object_t *self) {
-    type_t *type = self->type;
+    type_t *type = object_type(self);
     if (type->to_bool) return type->to_bool(self);
     else return true;
 }
 
 int object_to_int(object_t *self) {
-    type_t *type = self->type;
+    type_t *type = object_type(self);
     if (type->to_int) return type->to_int(self);
     else {
         fprintf(stderr, "Cannot coerce '%s' to int\n", type->name);
@@ -89,7 +100,7 @@ int object_to_int(object_t *self) {
 }
 
 const char *object_to_str(object_t *self) {
-    type_t *type = self->type;
+    type_t *type = object_type(self);
     if (type->to_str) return type->to_str(self);
     else {
         fprintf(stderr, "Cannot coerce '%s' to str\n", type->name);
@@ -97,15 +108,35 @@ const char *object_to_str(object_t *self) {
     }
 }
 
+const char *object_to_chars(object_t *self, int *len) {
+    // returns the chars of a str, strview or strbuf, and sets *len, or
+    // returns NULL for anything else
+    // NOTE: unlike object_to_str, the chars aren't necessarily NUL-terminated
+    type_t *type = object_type(self);
+    if (type == &str_type) {
+        *len = str_get_len(self);
+        return self->data.ptr;
+    } else if (type == &strview_type) {
+        strview_t *view = (strview_t *)self;
+        object_t *str = self->data.ptr;
+        *len = view->len;
+        return (const char *)str->data.ptr + view->start;
+    } else if (type == &strbuf_type) {
+        strbuf_t *buf = self->data.ptr;
+        *len = buf->len;
+        return buf->chars;
+    } else return NULL;
+}
+
 cmp_result_t object_cmp(object_t *self, object_t *other, vm_t *vm) {
-    type_t *type = self->type;
+    type_t *type = object_type(self);
     if (type->cmp) return type->cmp(self, other, vm);
     else return self == other? CMP_EQ: CMP_NE;
 }
 
 list_t *object_to_pair(object_t *self) {
-    if (self->type != &list_type) {
-        fprintf(stderr, "Can't interpret '%s' as a pair\n", self->type->name);
+    if (object_type(self) != &list_type) {
+        fprintf(stderr, "Can't interpret '%s' as a pair\n", object_type(self)->name);
         exit(1);
     }
     list_t *list = self->data.ptr;
@@ -114,8 +145,9 @@ list_t *object_to_pair(object_t *self) {
 }
 
 char object_to_char(object_t *self) {
-    const char *s = object_to_str(self);
-    int len = strlen(s);
+    int len;
+    const char *s = object_to_chars(self, &len);
+    if (!s) len = strlen(s = object_to_str(self));
     if (len != 1) {
         fprintf(stderr, "Cannot coerce str of size %i to char\n", len);
         exit(1);
@@ -123,8 +155,14 @@ char object_to_char(object_t *self) {
     return s[0];
 }
 
-void object_getter(object_t *self, const char *name, vm_t *vm) {
-    type_t *type = self->type;
+void object_method(object_t *self, int sym, const char *name, vm_t *vm) {
+    // calls self's method, where sym is symbol_find(name)
+    type_t *type = object_type(self);
+    method_t *method = sym >= 0 && type->methods? type->methods[sym]: NULL;
+    if (method) {
+        method(self, sym, vm);
+        return;
+    }
     bool ok = type->getter? type->getter(self, name, vm): false;
     if (!ok) {
         fprintf(stderr, "Object of type '%s' has no getter '%s'\n", type->name, name);
@@ -132,8 +170,12 @@ void object_getter(object_t *self, const char *name, vm_t *vm) {
     }
 }
 
+void object_getter(object_t *self, const char *name, vm_t *vm) {
+    object_method(self, symbol_find(name), name, vm);
+}
+
 void object_setter(object_t *self, const char *name, vm_t *vm) {
-    type_t *type = self->type;
+    type_t *type = object_type(self);
     bool ok = type->setter? type->setter(self, name, vm): false;
     if (!ok) {
         fprintf(stderr, "Object of type '%s' has no setter '%s'\n", type->name, name);
@@ -142,7 +184,7 @@ void object_setter(object_t *self, const char *name, vm_t *vm) {
 }
 
 void object_print(object_t *self) {
-    type_t *type = self->type;
+    type_t *type = object_type(self);
     if (type->print) type->print(self);
     else printf("<'%s' object at %p>", type->name, self);
 }
@@ -191,10 +233,7 @@ bool bool_to_bool(object_t *self) {
     return self->data.i;
 }
 
-bool bool_getter(object_t *self, const char *name, vm_t *vm) {
-    int op = parse_operator(name);
-    if (op < FIRST_BOOL_OP || op > LAST_BOOL_OP) return false;
-
+static void bool_op(object_t *self, int op, vm_t *vm) {
     instruction_t instruction = FIRST_OP_INSTR + op;
     bool is_unop = op_arities[op] == 1;
 
@@ -217,14 +256,20 @@ bool bool_getter(object_t *self, const char *name, vm_t *vm) {
     }
 
     vm_push(vm, object_create_bool(i));
-    return true;
 }
 
+static method_t *bool_methods[N_SYMS] = {
+    [SYM_NOT] = bool_op,
+    [SYM_AND] = bool_op,
+    [SYM_OR] = bool_op,
+    [SYM_XOR] = bool_op,
+};
+
 type_t bool_type = {
     .name = "bool",
     .print = bool_print,
     .to_bool = bool_to_bool,
-    .getter = bool_getter,
+    .methods = bool_methods,
 };
 
 object_t static_true = {
@@ -262,57 +307,63 @@ int int_op(int op, int i, int j) {
 }
 
 object_t *object_create_int(int i) {
-    object_t *obj = object_create(&int_type);
-    obj->data.i = i;
-    return obj;
+    return OBJECT_FROM_INT(i);
 }
 
 void int_print(object_t *self) {
-    printf("%i", self->data.i);
+    printf("%i", OBJECT_TO_INT(self));
 }
 
 int int_to_int(object_t *self) {
-    return self->data.i;
+    return OBJECT_TO_INT(self);
 }
 
 cmp_result_t int_cmp(object_t *self, object_t *other, vm_t *vm) {
-    if (other->type != &int_type) return CMP_NE;
-    int i = self->data.i;
+    if (!OBJECT_IS_INT(other)) return CMP_NE;
+    int i = OBJECT_TO_INT(self);
     int j = object_to_int(other);
     if (i < j) return CMP_LT;
     else if (i > j) return CMP_GT;
     else return CMP_EQ;
 }
 
-bool int_getter(object_t *self, const char *name, vm_t *vm) {
-    int op;
-    if (
-        op = parse_operator(name),
-        op >= FIRST_INT_OP && op <= LAST_BOOL_OP
-    ) {
-        instruction_t instruction = FIRST_OP_INSTR + op;
-        bool is_unop = op_arities[op] == 1;
-        int i = self->data.i;
-        int j = 0;
-        if (!is_unop) {
-            object_t *other = vm_pop(vm);
-            j = object_to_int(other);
-        }
-        vm_push(vm, vm_get_or_create_int(vm, int_op(op, i, j)));
-    } else if (!strcmp(name, "times")) {
-        iterator_t *it = iterator_create(ITER_RANGE, self->data.i,
-            (iterator_data_t){ .range_start = 0 });
-        vm_push(vm, object_create_iterator(it));
-    } else return false;
-    return true;
-}
+static void int_op_method(object_t *self, int op, vm_t *vm) {
+    bool is_unop = op_arities[op] == 1;
+    int i = OBJECT_TO_INT(self);
+    int j = 0;
+    if (!is_unop) {
+        object_t *other = vm_pop(vm);
+        j = object_to_int(other);
+    }
+    vm_push(vm, vm_get_or_create_int(vm, int_op(op, i, j)));
+}
+
+static void int_times(object_t *self, int sym, vm_t *vm) {
+    iterator_t *it = iterator_create(ITER_RANGE, OBJECT_TO_INT(self),
+        (iterator_data_t){ .range_start = 0 });
+    vm_push(vm, object_create_iterator(it));
+}
+
+static method_t *int_methods[N_SYMS] = {
+    [SYM_NEG] = int_op_method,
+    [SYM_ADD] = int_op_method,
+    [SYM_SUB] = int_op_method,
+    [SYM_MUL] = int_op_method,
+    [SYM_DIV] = int_op_method,
+    [SYM_MOD] = int_op_method,
+    [SYM_NOT] = int_op_method,
+    [SYM_AND] = int_op_method,
+    [SYM_OR] = int_op_method,
+    [SYM_XOR] = int_op_method,
+    [SYM_TIMES] = int_times,
+};
 
 type_t int_type = {
     .name = "int",
     .print = int_print,
     .to_int = int_to_int,
     .cmp = int_cmp,
-    .getter = int_getter,
+    .methods = int_methods,
 };
 
 
@@ -321,9 +372,41 @@ type_t int_type = {
 ****************/
 
 object_t *object_create_str(const char *s) {
-    object_t *obj = object_create(&str_type);
-    obj->data.ptr = (void *)s;
-    return obj;
+    return object_create_str_len(s, strlen(s));
+}
+
+object_t *object_create_str_len(const char *s, int len) {
+    // like object_create_str, for when the caller already knows strlen(s)
+    str_t *str = gc_alloc(sizeof *str, &object_gc_kind);
+    str->object.type = &str_type;
+    str->object.data.ptr = (void *)s;
+    str->len = len;
+    return &str->object;
+}
+
+unsigned str_get_hash(object_t *self) {
+    // hash_string of self's chars, computed the first time it's needed
+    str_t *str = (str_t *)self;
+    if (!str->hashed) str_set_hash(self, hash_string(self->data.ptr));
+    return str->hash;
+}
+
+void str_set_hash(object_t *self, unsigned hash) {
+    // for when the caller already has hash_string of self's chars
+    str_t *str = (str_t *)self;
+    str->hash = hash;
+    str->hashed = true;
+}
+
+bool str_eq(object_t *self, object_t *other) {
+    // whether two strs have the same chars
+    if (self == other) return true;
+    str_t *str = (str_t *)self, *str2 = (str_t *)other;
+    // NOTE: vm->str_cache only has one str for any given chars
+    if (str->interned && str2->interned) return false;
+    if (str->len != str2->len) return false;
+    if (str->hashed && str2->hashed && str->hash != str2->hash) return false;
+    return !memcmp(self->data.ptr, other->data.ptr, str->len);
 }
 
 void str_print(object_t *self) {
@@ -336,76 +419,510 @@ const char *str_to_str(object_t *self) {
 }
 
 cmp_result_t str_cmp(object_t *self, object_t *other, vm_t *vm) {
-    if (other->type != &str_type) return CMP_NE;
-    const char *s1 = self->data.ptr;
-    const char *s2 = object_to_str(other);
-    int c = strcmp(s1, s2);
+    // (also strview_type's cmp: strs and strviews compare by their chars)
+    type_t *type = object_type(other);
+    if (type != &str_type && type != &strview_type) return CMP_NE;
+    if (self == other) return CMP_EQ;
+    int len1 = 0, len2 = 0;
+    const char *s1 = object_to_chars(self, &len1);
+    const char *s2 = object_to_chars(other, &len2);
+    int c = memcmp(s1, s2, MIN(len1, len2));
+    if (c == 0) c = len1 - len2;
     if (c < 0) return CMP_LT;
     else if (c > 0) return CMP_GT;
     else return CMP_EQ;
 }
 
-bool str_getter(object_t *self, const char *name, vm_t *vm) {
+static void str_write(object_t *self, int sym, vm_t *vm) {
+    fputs(self->data.ptr, stdout);
+    if (sym == SYM_WRITELINE) putc('\n', stdout);
+}
+
+static void str_len(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, vm_get_or_create_int(vm, str_get_len(self)));
+}
+
+static void str_iter(object_t *self, int sym, vm_t *vm) {
     const char *s = self->data.ptr;
-    if (!strcmp(name, "write")) {
-        fputs(s, stdout);
-    } else if (!strcmp(name, "writeline")) {
-        fputs(s, stdout);
-        putc('\n', stdout);
-    } else if (!strcmp(name, "len")) {
-        int len = strlen(s);
-        vm_push(vm, vm_get_or_create_int(vm, len));
-    } else if (!strcmp(name, "__iter__")) {
-        iterator_t *it = iterator_create(ITER_STR, strlen(s),
-            (iterator_data_t){ .str = s });
-        vm_push(vm, object_create_iterator(it));
-    } else if (!strcmp(name, "slice")) {
-        int len = strlen(s);
-        object_t *end_obj = vm_pop(vm);
-        int end = end_obj == &static_null? len: object_to_int(end_obj);
-        int start = object_to_int(vm_pop(vm));
-        iterator_t *it = iterator_create_slice(ITER_STR, len,
-            (iterator_data_t){ .str = s }, start, end);
-        vm_push(vm, object_create_iterator(it));
-    } else if (!strcmp(name, "get")) {
-        int len = strlen(s);
-        int i = get_index(object_to_int(vm_pop(vm)), len, "str");
-        char c = s[i];
-        vm_push(vm, vm_get_char_str(vm, c));
-    } else if (!strcmp(name, "has")) {
-        char c = object_to_char(vm_pop(vm));
-        vm_push(vm, object_create_bool(strchr(s, c)));
-    } else if (!strcmp(name, "replace")) {
-        int len = strlen(s);
-        char c2 = object_to_char(vm_pop(vm));
-        char c1 = object_to_char(vm_pop(vm));
-        char *s2 = strdup(s);
-        if (!s2) {
-            fprintf(stderr, "Couldn't allocate string of size %i for str .replace\n", len);
-            exit(1);
+    iterator_t *it = iterator_create(ITER_STR, str_get_len(self),
+        (iterator_data_t){ .str = s });
+    vm_push(vm, object_create_iterator(it));
+}
+
+static object_t *str_view(object_t *self, int start, int len) {
+    // returns a strview of len of self's chars from start, where self is a
+    // str or strview (whose view is then of the same str)
+    if (object_type(self) == &strview_type) {
+        start += ((strview_t *)self)->start;
+        self = self->data.ptr;
+    }
+    return object_create_strview(self, start, len);
+}
+
+static const char *str_arg_chars(object_t *obj, int *len) {
+    // returns the chars of a str method's argument, which must be a str (or
+    // strview, strbuf, etc), and sets *len
+    const char *s = object_to_chars(obj, len);
+    if (!s) *len = strlen(s = object_to_str(obj));
+    return s;
+}
+
+static const char *str_find_chars(const char *s, int len, const char *sub, int sub_len) {
+    // returns the first sub in s, or NULL
+    // NOTE: memchr and memmem (which are vectorized in glibc) rather than
+    // anything clever of our own
+    if (sub_len == 1) return memchr(s, sub[0], len);
+    return memmem(s, len, sub, sub_len);
+}
+
+static int str_count_chars(const char *s, int len, const char *sub, int sub_len) {
+    // returns how many (non-overlapping) subs there are in s
+    if (!sub_len) return len + 1;
+    int n = 0;
+    const char *end = s + len;
+    for (const char *p = s; (p = str_find_chars(p, end - p, sub, sub_len)); p += sub_len) n++;
+    return n;
+}
+
+static void str_slice(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's slice)
+    int len;
+    object_to_chars(self, &len);
+    object_t *end_obj = vm_pop(vm);
+    int end = end_obj == &static_null? len: object_to_int(end_obj);
+    int start = object_to_int(vm_pop(vm));
+    if (start < 0 && (start += len) < 0) start = 0;
+    if (end < 0 && (end += len) < 0) end = 0;
+    if (end > len) end = len;
+    if (start > end) start = end;
+    vm_push(vm, str_view(self, start, end - start));
+}
+
+static void str_get(object_t *self, int sym, vm_t *vm) {
+    const char *s = self->data.ptr;
+    int i = get_index(object_to_int(vm_pop(vm)), str_get_len(self), "str");
+    char c = s[i];
+    vm_push(vm, vm_get_char_str(vm, c));
+}
+
+static void str_has(object_t *self, int sym, vm_t *vm) {
+    char c = object_to_char(vm_pop(vm));
+    vm_push(vm, object_create_bool(memchr(self->data.ptr, c, str_get_len(self))));
+}
+
+static void str_replace(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's replace)
+    int len = 0, old_len, new_len;
+    const char *s = object_to_chars(self, &len);
+    const char *new = str_arg_chars(vm_pop(vm), &new_len);
+    const char *old = str_arg_chars(vm_pop(vm), &old_len);
+    if (!old_len) {
+        fprintf(stderr, "Cannot replace an empty str\n");
+        exit(1);
+    }
+    char *s2;
+    int len2;
+    if (old_len == 1 && new_len == 1) {
+        s2 = gc_alloc(len + 1, &str_gc_kind);
+        for (int i = 0; i < len; i++) s2[i] = s[i] == old[0]? new[0]: s[i];
+        s2[len] = '\0';
+        len2 = len;
+    } else {
+        int n = str_count_chars(s, len, old, old_len);
+        if (!n && object_type(self) == &str_type) {
+            vm_push(vm, self);
+            return;
         }
-        for (int i = 0; i < len; i++) if (s2[i] == c1) s2[i] = c2;
-        vm_push(vm, vm_get_or_create_str(vm, s2));
-    } else if (!strcmp(name, "+")) {
-        const char *s2 = object_to_str(vm_pop(vm));
-        int len = strlen(s) + strlen(s2);
-        char *s3 = malloc(len + 1);
-        if (!s3) {
-            fprintf(stderr, "Couldn't allocate string of size %i for str '+'\n", len);
-            exit(1);
+        s2 = gc_alloc(len + n * (new_len - old_len) + 1, &str_gc_kind);
+        char *p2 = s2;
+        const char *end = s + len;
+        for (const char *p = s, *found; p <= end; p = found + old_len) {
+            found = str_find_chars(p, end - p, old, old_len);
+            if (!found) found = end;
+            memcpy(p2, p, found - p);
+            p2 += found - p;
+            if (found == end) break;
+            memcpy(p2, new, new_len);
+            p2 += new_len;
         }
-        strcat(strcpy(s3, s), s2);
-        vm_push(vm, vm_get_or_create_str(vm, s3));
-    } else return false;
-    return true;
+        *p2 = '\0';
+        len2 = p2 - s2;
+    }
+    vm_push(vm, vm_get_or_create_str_len(vm, s2, len2));
 }
 
+static void str_split(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's split)
+    // "a,b" "," .split -> [<strview "a">, <strview "b">]
+    int len = 0, sep_len;
+    const char *s = object_to_chars(self, &len);
+    const char *sep = str_arg_chars(vm_pop(vm), &sep_len);
+    if (!sep_len) {
+        fprintf(stderr, "Cannot split by an empty str\n");
+        exit(1);
+    }
+
+    // count the pieces first, so the list's elems are allocated just once
+    int n = str_count_chars(s, len, sep, sep_len) + 1;
+    list_t *list = list_create();
+    object_t *obj = object_create_list(list);
+    list->elems = malloc(n * sizeof *list->elems);
+    if (!list->elems) {
+        fprintf(stderr, "Failed to allocate %i split strs\n", n);
+        exit(1);
+    }
+
+    const char *end = s + len, *p = s;
+    for (int i = 0; i < n; i++) {
+        const char *found = i < n - 1? str_find_chars(p, end - p, sep, sep_len): end;
+        object_t *piece = str_view(self, p - s, found - p);
+        gc_write_barrier(list, piece);
+        list->elems[list->len++] = piece;
+        p = found + sep_len;
+    }
+    vm_push(vm, obj);
+}
+
+static void str_strip(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's strip)
+    // returns a strview without the whitespace at either end
+    int len = 0;
+    const char *s = object_to_chars(self, &len);
+    int start = 0, end = len;
+    while (start < end && isspace((unsigned char)s[start])) start++;
+    while (end > start && isspace((unsigned char)s[end - 1])) end--;
+    vm_push(vm, str_view(self, start, end - start));
+}
+
+static void str_find(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's find)
+    // returns the index of the first sub in self, or -1
+    int len = 0, sub_len;
+    const char *s = object_to_chars(self, &len);
+    const char *sub = str_arg_chars(vm_pop(vm), &sub_len);
+    const char *found = str_find_chars(s, len, sub, sub_len);
+    vm_push(vm, vm_get_or_create_int(vm, found? found - s: -1));
+}
+
+static void str_count(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's count)
+    int len = 0, sub_len;
+    const char *s = object_to_chars(self, &len);
+    const char *sub = str_arg_chars(vm_pop(vm), &sub_len);
+    vm_push(vm, vm_get_or_create_int(vm, str_count_chars(s, len, sub, sub_len)));
+}
+
+static void str_startswith(object_t *self, int sym, vm_t *vm) {
+    // startswith or endswith (also strview_type's)
+    int len = 0, sub_len;
+    const char *s = object_to_chars(self, &len);
+    const char *sub = str_arg_chars(vm_pop(vm), &sub_len);
+    bool result = sub_len <= len && !memcmp(
+        sym == SYM_STARTSWITH? s: s + len - sub_len, sub, sub_len);
+    vm_push(vm, object_create_bool(result));
+}
+
+static void str_join(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's join)
+    // list .new "a" , "b" , ", " .join -> "a, b"
+    int sep_len = 0;
+    const char *sep = object_to_chars(self, &sep_len);
+    object_t *obj = vm_pop(vm);
+    if (object_type(obj) != &list_type) {
+        fprintf(stderr, "Cannot join a '%s', only a list\n", object_type(obj)->name);
+        exit(1);
+    }
+    list_t *list = obj->data.ptr;
+
+    // add up the lengths first, so the joined str is allocated just once
+    int total = list->len? (list->len - 1) * sep_len: 0, len;
+    for (int i = 0; i < list->len; i++) {
+        str_arg_chars(list->elems[i], &len);
+        total += len;
+    }
+    char *s = gc_alloc(total + 1, &str_gc_kind), *p = s;
+    for (int i = 0; i < list->len; i++) {
+        if (i) {
+            memcpy(p, sep, sep_len);
+            p += sep_len;
+        }
+        const char *s2 = str_arg_chars(list->elems[i], &len);
+        memcpy(p, s2, len);
+        p += len;
+    }
+    *p = '\0';
+    vm_push(vm, vm_get_or_create_str_len(vm, s, total));
+}
+
+static void str_add(object_t *self, int sym, vm_t *vm) {
+    // (also strview_type's "+")
+    int len = 0, len2;
+    const char *s = object_to_chars(self, &len);
+    const char *s2 = str_arg_chars(vm_pop(vm), &len2);
+    char *s3 = gc_alloc(len + len2 + 1, &str_gc_kind);
+    memcpy(s3, s, len);
+    memcpy(s3 + len, s2, len2);
+    s3[len + len2] = '\0';
+    vm_push(vm, vm_get_or_create_str_len(vm, s3, len + len2));
+}
+
+static method_t *str_methods[N_SYMS] = {
+    [SYM_WRITE] = str_write,
+    [SYM_WRITELINE] = str_write,
+    [SYM_LEN] = str_len,
+    [SYM_ITER] = str_iter,
+    [SYM_SLICE] = str_slice,
+    [SYM_GET] = str_get,
+    [SYM_HAS] = str_has,
+    [SYM_REPLACE] = str_replace,
+    [SYM_ADD] = str_add,
+    [SYM_SPLIT] = str_split,
+    [SYM_STRIP] = str_strip,
+    [SYM_FIND] = str_find,
+    [SYM_COUNT] = str_count,
+    [SYM_STARTSWITH] = str_startswith,
+    [SYM_ENDSWITH] = str_startswith,
+    [SYM_JOIN] = str_join,
+};
+
 type_t str_type = {
     .name = "str",
     .print = str_print,
     .to_str = str_to_str,
     .cmp = str_cmp,
-    .getter = str_getter,
+    .methods = str_methods,
+};
+
+
+/****************
+* STRVIEW
+****************/
+
+// A slice of a str, which points into its chars instead of copying them
+
+object_t *object_create_strview(object_t *str, int start, int len) {
+    // NOTE: str must be a str, not another strview (see str_slice)
+    strview_t *view = gc_alloc(sizeof *view, &object_gc_kind);
+    view->object.type = &strview_type;
+    view->object.data.ptr = str;
+    view->start = start;
+    view->len = len;
+    return &view->object;
+}
+
+static const char *strview_chars(strview_t *view) {
+    object_t *str = view->object.data.ptr;
+    return (const char *)str->data.ptr + view->start;
+}
+
+void strview_print(object_t *self) {
+    strview_t *view = (strview_t *)self;
+    fputs("<strview ", stdout);
+    print_chars_quoted(strview_chars(view), view->len);
+    putc('>', stdout);
+}
+
+const char *strview_to_str(object_t *self) {
+    strview_t *view = (strview_t *)self;
+    char *s = gc_alloc(view->len + 1, &str_gc_kind);
+    memcpy(s, strview_chars(view), view->len);
+    s[view->len] = '\0';
+    return s;
+}
+
+static void strview_len(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, vm_get_or_create_int(vm, ((strview_t *)self)->len));
+}
+
+static void strview_iter(object_t *self, int sym, vm_t *vm) {
+    strview_t *view = (strview_t *)self;
+    object_t *str = self->data.ptr;
+    iterator_t *it = iterator_create_slice(ITER_STR, str_get_len(str),
+        (iterator_data_t){ .str = str->data.ptr }, view->start, view->start + view->len);
+    vm_push(vm, object_create_iterator(it));
+}
+
+static void strview_get(object_t *self, int sym, vm_t *vm) {
+    strview_t *view = (strview_t *)self;
+    int i = get_index(object_to_int(vm_pop(vm)), view->len, "strview");
+    vm_push(vm, vm_get_char_str(vm, strview_chars(view)[i]));
+}
+
+static void strview_has(object_t *self, int sym, vm_t *vm) {
+    strview_t *view = (strview_t *)self;
+    char c = object_to_char(vm_pop(vm));
+    vm_push(vm, object_create_bool(memchr(strview_chars(view), c, view->len)));
+}
+
+static void strview_write(object_t *self, int sym, vm_t *vm) {
+    strview_t *view = (strview_t *)self;
+    fwrite(strview_chars(view), 1, view->len, stdout);
+    if (sym == SYM_WRITELINE) putc('\n', stdout);
+}
+
+static void strview_to_str_method(object_t *self, int sym, vm_t *vm) {
+    strview_t *view = (strview_t *)self;
+    vm_push(vm, vm_get_or_create_str_len(vm, strview_to_str(self), view->len));
+}
+
+static method_t *strview_methods[N_SYMS] = {
+    [SYM_WRITE] = strview_write,
+    [SYM_WRITELINE] = strview_write,
+    [SYM_LEN] = strview_len,
+    [SYM_ITER] = strview_iter,
+    [SYM_SLICE] = str_slice,
+    [SYM_GET] = strview_get,
+    [SYM_HAS] = strview_has,
+    [SYM_REPLACE] = str_replace,
+    [SYM_ADD] = str_add,
+    [SYM_SPLIT] = str_split,
+    [SYM_STRIP] = str_strip,
+    [SYM_FIND] = str_find,
+    [SYM_COUNT] = str_count,
+    [SYM_STARTSWITH] = str_startswith,
+    [SYM_ENDSWITH] = str_startswith,
+    [SYM_JOIN] = str_join,
+    [SYM_TO_STR] = strview_to_str_method,
+};
+
+type_t strview_type = {
+    .name = "strview",
+    .print = strview_print,
+    .to_str = strview_to_str,
+    .cmp = str_cmp,
+    .methods = strview_methods,
+};
+
+
+/****************
+* STRBUF
+****************/
+
+// A mutable str, for building up strs without copying everything built so
+// far every time (like repeated "+" would)
+
+static void strbuf_finalize(void *ptr) {
+    strbuf_t *buf = ptr;
+    free(buf->chars);
+}
+
+static gc_kind_t strbuf_gc_kind = {
+    .name = "strbuf",
+    .finalize = strbuf_finalize,
+};
+
+strbuf_t *strbuf_create(void) {
+    return gc_alloc(sizeof (strbuf_t), &strbuf_gc_kind);
+}
+
+static void strbuf_reserve(strbuf_t *buf, int len) {
+    // makes room for len more chars (and the NUL)
+    int new_len = buf->len + len;
+    if (new_len + 1 > buf->size) {
+        int new_size = MAX(new_len + 1, buf->size? buf->size * 2: 16);
+        char *new_chars = realloc(buf->chars, new_size);
+        if (!new_chars) {
+            fprintf(stderr, "Failed to grow strbuf to %i\n", new_size);
+            exit(1);
+        }
+        buf->chars = new_chars;
+        buf->size = new_size;
+    }
+}
+
+void strbuf_append(strbuf_t *buf, const char *s, int len) {
+    // NOTE: s mustn't point into buf->chars, which can move
+    strbuf_reserve(buf, len);
+    int new_len = buf->len + len;
+    memcpy(buf->chars + buf->len, s, len);
+    buf->chars[new_len] = '\0';
+    buf->len = new_len;
+}
+
+void strbuf_append_obj(strbuf_t *buf, object_t *obj) {
+    // appends obj's chars, which must be a str (or strview, strbuf, etc)
+    int len;
+    const char *s = object_to_chars(obj, &len);
+    if (!s) len = strlen(s = object_to_str(obj));
+    else if (s == buf->chars) {
+        // appending buf to itself: its chars can move when it grows, so
+        // grow it first and then copy from wherever they are
+        strbuf_reserve(buf, len);
+        s = buf->chars;
+    }
+    strbuf_append(buf, s, len);
+}
+
+object_t *object_create_strbuf(strbuf_t *buf) {
+    object_t *obj = object_create(&strbuf_type);
+    obj->data.ptr = buf? buf: strbuf_create();
+    return obj;
+}
+
+static char *strbuf_flatten(strbuf_t *buf) {
+    // returns a copy of buf's chars, so it stays the same whatever happens
+    // to buf later
+    char *s = gc_alloc(buf->len + 1, &str_gc_kind);
+    if (buf->len) memcpy(s, buf->chars, buf->len);
+    s[buf->len] = '\0';
+    return s;
+}
+
+void strbuf_print(object_t *self) {
+    strbuf_t *buf = self->data.ptr;
+    fputs("<strbuf ", stdout);
+    print_chars_quoted(buf->chars, buf->len);
+    putc('>', stdout);
+}
+
+const char *strbuf_to_str(object_t *self) {
+    return strbuf_flatten(self->data.ptr);
+}
+
+bool strbuf_type_getter(object_t *self, const char *name, vm_t *vm) {
+    if (!strcmp(name, "new")) {
+        vm_push(vm, object_create_strbuf(NULL));
+    } else return false;
+    return true;
+}
+
+static void strbuf_comma(object_t *self, int sym, vm_t *vm) {
+    // , or push
+    strbuf_append_obj(self->data.ptr, vm_pop(vm));
+    if (sym == SYM_COMMA) vm_push(vm, self);
+}
+
+static void strbuf_len(object_t *self, int sym, vm_t *vm) {
+    strbuf_t *buf = self->data.ptr;
+    vm_push(vm, vm_get_or_create_int(vm, buf->len));
+}
+
+static void strbuf_write(object_t *self, int sym, vm_t *vm) {
+    strbuf_t *buf = self->data.ptr;
+    fwrite(buf->chars, 1, buf->len, stdout);
+    if (sym == SYM_WRITELINE) putc('\n', stdout);
+}
+
+static void strbuf_to_str_method(object_t *self, int sym, vm_t *vm) {
+    strbuf_t *buf = self->data.ptr;
+    vm_push(vm, vm_get_or_create_str_len(vm, strbuf_flatten(buf), buf->len));
+}
+
+static method_t *strbuf_methods[N_SYMS] = {
+    [SYM_COMMA] = strbuf_comma,
+    [SYM_PUSH] = strbuf_comma,
+    [SYM_LEN] = strbuf_len,
+    [SYM_WRITE] = strbuf_write,
+    [SYM_WRITELINE] = strbuf_write,
+    [SYM_TO_STR] = strbuf_to_str_method,
+};
+
+type_t strbuf_type = {
+    .name = "strbuf",
+    .print = strbuf_print,
+    .to_str = strbuf_to_str,
+    .type_getter = strbuf_type_getter,
+    .methods = strbuf_methods,
 };
 
 
@@ -413,13 +930,24 @@ type_t str_type = {
 * LIST
 ****************/
 
+static void list_trace(void *ptr) {
+    list_t *list = ptr;
+    for (int i = 0; i < list->len; i++) gc_mark(list->elems[i]);
+}
+
+static void list_finalize(void *ptr) {
+    list_t *list = ptr;
+    free(list->elems);
+}
+
+static gc_kind_t list_gc_kind = {
+    .name = "list",
+    .trace = list_trace,
+    .finalize = list_finalize,
+};
+
 list_t *list_create(void) {
-    list_t *list = calloc(1, sizeof *list);
-    if (!list) {
-        fprintf(stderr, "Failed to allocate list\n");
-        exit(1);
-    }
-    return list;
+    return gc_alloc(sizeof (list_t), &list_gc_kind);
 }
 
 list_t *list_copy(list_t *list) {
@@ -451,7 +979,11 @@ void list_extend(list_t *list, list_t *other) {
     int old_len = list->len;
     int new_len = old_len + other->len;
     list_grow(list, new_len);
-    for (int i = old_len; i < new_len; i++) list->elems[i] = other->elems[i - old_len];
+    for (int i = old_len; i < new_len; i++) {
+        object_t *value = other->elems[i - old_len];
+        gc_write_barrier(list, value);
+        list->elems[i] = value;
+    }
 }
 
 vm_t *list_sort_vm;
@@ -502,6 +1034,7 @@ void list_set(list_t *list, int i, object_t *value) {
         fprintf(stderr, "Attempting to store NULL at index %i of a list\n", i);
         exit(1);
     }
+    gc_write_barrier(list, value);
     list->elems[get_index(i, list->len, "list")] = value;
 }
 
@@ -512,6 +1045,7 @@ void list_push(list_t *list, object_t *value) {
     }
     int new_len = list->len + 1;
     list_grow(list, new_len);
+    gc_write_barrier(list, value);
     list->elems[new_len - 1] = value;
 }
 
@@ -540,7 +1074,7 @@ bool list_type_getter(object_t *self, const char *name, vm_t *vm) {
     } else if (!strcmp(name, "@")) {
         list_t *list;
         object_t *obj = vm_top(vm);
-        if (obj->type == &list_type) {
+        if (object_type(obj) == &list_type) {
             list = list_copy(obj->data.ptr);
         } else {
             list = list_create();
@@ -568,69 +1102,113 @@ bool list_type_getter(object_t *self, const char *name, vm_t *vm) {
     return true;
 }
 
-bool list_getter(object_t *self, const char *name, vm_t *vm) {
+static void list_len(object_t *self, int sym, vm_t *vm) {
     list_t *list = self->data.ptr;
-    if (!strcmp(name, "len")) {
-        vm_push(vm, vm_get_or_create_int(vm, list->len));
-    } else if (!strcmp(name, ",")) {
-        object_t *obj = vm_pop(vm);
-        list_push(list, obj);
-        vm_push(vm, self);
-    } else if (!strcmp(name, "__iter__")) {
-        iterator_t *it = iterator_create(ITER_LIST, list->len,
-            (iterator_data_t){ .list = list });
-        vm_push(vm, object_create_iterator(it));
-    } else if (!strcmp(name, "slice")) {
-        object_t *end_obj = vm_pop(vm);
-        int end = end_obj == &static_null? list->len: object_to_int(end_obj);
-        int start = object_to_int(vm_pop(vm));
-        iterator_t *it = iterator_create_slice(ITER_LIST, list->len,
-            (iterator_data_t){ .list = list }, start, end);
-        vm_push(vm, object_create_iterator(it));
-    } else if (!strcmp(name, "copy")) {
-        vm_push(vm, object_create_list(list_copy(list)));
-    } else if (!strcmp(name, "extend")) {
-        object_t *other = vm_pop(vm);
-        if (other->type != &list_type) {
-            // TODO: implement iterators...
-            fprintf(stderr, "Attempted to extend a list with '%s' object\n", other->type->name);
-            exit(1);
-        }
-        list_extend(list, other->data.ptr);
-    } else if (!strcmp(name, "get")) {
-        int i = object_to_int(vm_pop(vm));
-        vm_push(vm, list_get(list, i));
-    } else if (!strcmp(name, "set")) {
-        int i = object_to_int(vm_pop(vm));
-        object_t *value = vm_pop(vm);
-        list_set(list, i, value);
-    } else if (!strcmp(name, "pop")) {
-        vm_push(vm, list_pop(list));
-    } else if (!strcmp(name, "push")) {
-        object_t *value = vm_pop(vm);
-        list_push(list, value);
-    } else if (!strcmp(name, "sort")) {
-        list_sort(list, vm);
-    } else if (!strcmp(name, "reverse")) {
-        list_reverse(list);
-    } else if (!strcmp(name, "unbuild")) {
-        // the inverse of list .build
-        for (int i = 0; i < list->len; i++) vm_push(vm, list->elems[i]);
-        vm_push(vm, vm_get_or_create_int(vm, list->len));
-    } else if (!strcmp(name, "unpair")) {
-        // the inverse of @pair
-        list_assert_pair(list);
-        vm_push(vm, list->elems[0]);
-        vm_push(vm, list->elems[1]);
-    } else return false;
-    return true;
+    vm_push(vm, vm_get_or_create_int(vm, list->len));
+}
+
+static void list_comma(object_t *self, int sym, vm_t *vm) {
+    object_t *obj = vm_pop(vm);
+    list_push(self->data.ptr, obj);
+    vm_push(vm, self);
+}
+
+static void list_iter(object_t *self, int sym, vm_t *vm) {
+    list_t *list = self->data.ptr;
+    iterator_t *it = iterator_create(ITER_LIST, list->len,
+        (iterator_data_t){ .list = list });
+    vm_push(vm, object_create_iterator(it));
+}
+
+static void list_slice(object_t *self, int sym, vm_t *vm) {
+    list_t *list = self->data.ptr;
+    object_t *end_obj = vm_pop(vm);
+    int end = end_obj == &static_null? list->len: object_to_int(end_obj);
+    int start = object_to_int(vm_pop(vm));
+    iterator_t *it = iterator_create_slice(ITER_LIST, list->len,
+        (iterator_data_t){ .list = list }, start, end);
+    vm_push(vm, object_create_iterator(it));
+}
+
+static void list_copy_method(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, object_create_list(list_copy(self->data.ptr)));
+}
+
+static void list_extend_method(object_t *self, int sym, vm_t *vm) {
+    object_t *other = vm_pop(vm);
+    if (object_type(other) != &list_type) {
+        // TODO: implement iterators...
+        fprintf(stderr, "Attempted to extend a list with '%s' object\n", object_type(other)->name);
+        exit(1);
+    }
+    list_extend(self->data.ptr, other->data.ptr);
+}
+
+static void list_get_method(object_t *self, int sym, vm_t *vm) {
+    int i = object_to_int(vm_pop(vm));
+    vm_push(vm, list_get(self->data.ptr, i));
+}
+
+static void list_set_method(object_t *self, int sym, vm_t *vm) {
+    int i = object_to_int(vm_pop(vm));
+    object_t *value = vm_pop(vm);
+    list_set(self->data.ptr, i, value);
+}
+
+static void list_pop_method(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, list_pop(self->data.ptr));
+}
+
+static void list_push_method(object_t *self, int sym, vm_t *vm) {
+    object_t *value = vm_pop(vm);
+    list_push(self->data.ptr, value);
+}
+
+static void list_sort_method(object_t *self, int sym, vm_t *vm) {
+    list_sort(self->data.ptr, vm);
+}
+
+static void list_reverse_method(object_t *self, int sym, vm_t *vm) {
+    list_reverse(self->data.ptr);
 }
 
+static void list_unbuild(object_t *self, int sym, vm_t *vm) {
+    // the inverse of list .build
+    list_t *list = self->data.ptr;
+    for (int i = 0; i < list->len; i++) vm_push(vm, list->elems[i]);
+    vm_push(vm, vm_get_or_create_int(vm, list->len));
+}
+
+static void list_unpair(object_t *self, int sym, vm_t *vm) {
+    // the inverse of @pair
+    list_t *list = self->data.ptr;
+    list_assert_pair(list);
+    vm_push(vm, list->elems[0]);
+    vm_push(vm, list->elems[1]);
+}
+
+static method_t *list_methods[N_SYMS] = {
+    [SYM_LEN] = list_len,
+    [SYM_COMMA] = list_comma,
+    [SYM_ITER] = list_iter,
+    [SYM_SLICE] = list_slice,
+    [SYM_COPY] = list_copy_method,
+    [SYM_EXTEND] = list_extend_method,
+    [SYM_GET] = list_get_method,
+    [SYM_SET] = list_set_method,
+    [SYM_POP] = list_pop_method,
+    [SYM_PUSH] = list_push_method,
+    [SYM_SORT] = list_sort_method,
+    [SYM_REVERSE] = list_reverse_method,
+    [SYM_UNBUILD] = list_unbuild,
+    [SYM_UNPAIR] = list_unpair,
+};
+
 type_t list_type = {
     .name = "list",
     .print = list_print,
     .type_getter = list_type_getter,
-    .getter = list_getter,
+    .methods = list_methods,
 };
 
 
@@ -638,26 +1216,89 @@ type_t list_type = {
 * DICT
 ****************/
 
+static void dict_trace(void *ptr) {
+    // NOTE: names are usually borrowed from str objects (or the compiler),
+    // so we need to keep them alive too
+    dict_t *dict = ptr;
+    for (int i = 0; i < dict->len; i++) {
+        dict_item_t *item = &dict->items[i];
+        gc_mark((void *)item->name);
+        gc_mark(item->value);
+    }
+}
+
+static void dict_finalize(void *ptr) {
+    dict_t *dict = ptr;
+    free(dict->items);
+    free(dict->buckets);
+}
+
+static gc_kind_t dict_gc_kind = {
+    .name = "dict",
+    .trace = dict_trace,
+    .finalize = dict_finalize,
+};
+
+unsigned long dict_last_version;
+
 dict_t *dict_create(void) {
-    dict_t *dict = calloc(1, sizeof *dict);
-    if (!dict) {
-        fprintf(stderr, "Failed to allocate dict\n");
+    dict_t *dict = gc_alloc(sizeof (dict_t), &dict_gc_kind);
+    dict->version = ++dict_last_version;
+    return dict;
+}
+
+static void dict_rehash(dict_t *dict, int n_buckets) {
+    // (re)builds dict->buckets with the given number of buckets, which must
+    // be a power of 2, and greater than dict->len
+    // NOTE: this is also where items deleted by dict_del are finally dropped,
+    // which changes the indexes of the items after them
+    if (dict->n_deleted) {
+        int len = 0;
+        for (int i = 0; i < dict->len; i++) {
+            if (dict->items[i].name) dict->items[len++] = dict->items[i];
+        }
+        dict->len = len;
+        dict->n_deleted = 0;
+        dict->version = ++dict_last_version;
+    }
+    int *buckets = realloc(dict->buckets, n_buckets * sizeof *buckets);
+    if (!buckets) {
+        fprintf(stderr, "Failed to allocate %i dict buckets\n", n_buckets);
         exit(1);
     }
-    return dict;
+    for (int i = 0; i < n_buckets; i++) buckets[i] = -1;
+    int mask = n_buckets - 1;
+    for (int i = 0; i < dict->len; i++) {
+        int j = dict->items[i].hash & mask;
+        while (buckets[j] >= 0) j = (j + 1) & mask;
+        buckets[j] = i;
+    }
+    dict->buckets = buckets;
+    dict->n_buckets = n_buckets;
 }
 
 dict_t *dict_copy(dict_t *dict) {
     dict_t *copy = dict_create();
     int len = dict->len;
+    if (!len) return copy;
     dict_item_t *items = malloc(len * sizeof *items);
     if (!items) {
         fprintf(stderr, "Failed to allocate copied dict items\n");
         exit(1);
     }
     memcpy(items, dict->items, len * sizeof *items);
-    copy->len = dict->len;
+    int *buckets = malloc(dict->n_buckets * sizeof *buckets);
+    if (!buckets) {
+        fprintf(stderr, "Failed to allocate copied dict buckets\n");
+        exit(1);
+    }
+    memcpy(buckets, dict->buckets, dict->n_buckets * sizeof *buckets);
+    copy->len = len;
+    copy->size = len;
     copy->items = items;
+    copy->n_deleted = dict->n_deleted;
+    copy->n_buckets = dict->n_buckets;
+    copy->buckets = buckets;
     return copy;
 }
 
@@ -667,12 +1308,40 @@ object_t *object_create_dict(dict_t *dict) {
     return obj;
 }
 
-dict_item_t *dict_get_item(dict_t *dict, const char *name) {
-    for (int i = 0; i < dict->len; i++) {
-        dict_item_t *item = &dict->items[i];
-        if (!strcmp(item->name, name)) return item;
+static int *dict_find_bucket(dict_t *dict, const char *name, unsigned hash) {
+    // returns the bucket holding name's index into dict->items, or the empty
+    // bucket where it would go
+    // NOTE: dict->n_buckets must be nonzero
+    int mask = dict->n_buckets - 1;
+    for (int j = hash & mask;; j = (j + 1) & mask) {
+        int *bucket = &dict->buckets[j];
+        if (*bucket < 0) return bucket;
+        dict_item_t *item = &dict->items[*bucket];
+        if (item->name && item->hash == hash && !strcmp(item->name, name)) return bucket;
     }
-    return NULL;
+}
+
+dict_item_t *dict_get_item(dict_t *dict, const char *name) {
+    return dict_get_item_hashed(dict, name, hash_string(name));
+}
+
+dict_item_t *dict_get_item_hashed(dict_t *dict, const char *name, unsigned hash) {
+    // like dict_get_item, for when the caller already has hash_string(name)
+    if (!dict->len) return NULL;
+    int i = *dict_find_bucket(dict, name, hash);
+    return i >= 0? &dict->items[i]: NULL;
+}
+
+dict_item_t *dict_get_item_hinted(dict_t *dict, const char *name, unsigned hash, int *hint) {
+    // like dict_get_item, but first checks whether name (the same pointer)
+    // is at index *hint, and if not, updates *hint to where it is
+    int i = *hint;
+    if (i < dict->len && dict->items[i].name == name) return &dict->items[i];
+    if (!dict->len) return NULL;
+    i = *dict_find_bucket(dict, name, hash);
+    if (i < 0) return NULL;
+    *hint = i;
+    return &dict->items[i];
 }
 
 object_t *dict_get(dict_t *dict, const char *name) {
@@ -681,45 +1350,106 @@ object_t *dict_get(dict_t *dict, const char *name) {
 }
 
 void dict_set(dict_t *dict, const char *name, object_t *value) {
+    dict_set_hashed(dict, name, hash_string(name), value);
+}
+
+void dict_set_hashed(dict_t *dict, const char *name, unsigned hash, object_t *value) {
+    // like dict_set, for when the caller already has hash_string(name)
     if (!value) {
         fprintf(stderr, "Attempting to store NULL in key '%s' of a dict\n", name);
         exit(1);
     }
-    dict_item_t *item = dict_get_item(dict, name);
-    if (item) item->value = value;
-    else {
-        int new_len = dict->len + 1;
-        dict_item_t *new_items = realloc(dict->items, new_len * sizeof *new_items);
+    gc_write_barrier(dict, value);
+    if (dict->n_buckets) {
+        int *bucket = dict_find_bucket(dict, name, hash);
+        if (*bucket >= 0) {
+            dict->items[*bucket].value = value;
+            dict->version = ++dict_last_version;
+            return;
+        }
+    }
+
+    // add a new item, growing the items & buckets as necessary (or first
+    // making room by dropping deleted items)
+    if (dict->n_deleted && dict->len == dict->size) dict_rehash(dict, dict->n_buckets);
+    int new_len = dict->len + 1;
+    if (new_len > dict->size) {
+        int new_size = dict->size? dict->size * 2: 4;
+        dict_item_t *new_items = realloc(dict->items, new_size * sizeof *new_items);
         if (!new_items) {
             fprintf(stderr, "Failed to allocate dict items\n");
             exit(1);
         }
-        new_items[new_len - 1].name = name;
-        new_items[new_len - 1].value = value;
         dict->items = new_items;
-        dict->len = new_len;
+        dict->size = new_size;
+    }
+    dict_item_t *item = &dict->items[new_len - 1];
+    gc_write_barrier(dict, (void *)name);
+    item->name = name;
+    item->hash = hash;
+    item->value = value;
+    dict->len = new_len;
+    dict->version = ++dict_last_version;
+
+    // keep the hash table at most half full
+    if (new_len * 2 > dict->n_buckets) {
+        dict_rehash(dict, dict->n_buckets? dict->n_buckets * 2: 8);
+    } else {
+        *dict_find_bucket(dict, name, hash) = new_len - 1;
     }
 }
 
+void dict_set_item(dict_t *dict, dict_item_t *item, object_t *value) {
+    // sets the value of one of dict's items
+    gc_write_barrier(dict, value);
+    item->value = value;
+    dict->version = ++dict_last_version;
+}
+
+bool dict_del(dict_t *dict, const char *name) {
+    // removes name from dict, returning whether it was found
+    dict_item_t *item = dict_get_item(dict, name);
+    if (!item) return false;
+
+    // NOTE: we leave the item where it is, with a NULL name, so the other
+    // items (and their buckets) don't move; dict_rehash drops it later
+    item->name = NULL;
+    item->value = NULL;
+    dict->n_deleted++;
+    dict->version = ++dict_last_version;
+    return true;
+}
+
 void dict_update(dict_t *dict, dict_t *other) {
     for (int i = 0; i < other->len; i++) {
         dict_item_t *item = &other->items[i];
-        dict_set(dict, item->name, item->value);
+        if (item->name) dict_set_hashed(dict, item->name, item->hash, item->value);
     }
 }
 
 void dict_print(object_t *self) {
     dict_t *dict = self->data.ptr;
     putc('{', stdout);
+    bool first = true;
     for (int i = 0; i < dict->len; i++) {
         dict_item_t *item = &dict->items[i];
-        if (i > 0) fputs(", ", stdout);
+        if (!item->name) continue;
+        if (!first) fputs(", ", stdout);
+        first = false;
         printf("%s: ", item->name);
         object_print(item->value);
     }
     putc('}', stdout);
 }
 
+static const char *dict_key(object_t *obj, unsigned *hash) {
+    // returns object_to_str(obj), and sets *hash to its hash, which strs
+    // keep (see str_get_hash)
+    const char *name = object_to_str(obj);
+    *hash = object_type(obj) == &str_type? str_get_hash(obj): hash_string(name);
+    return name;
+}
+
 bool dict_type_getter(object_t *self, const char *name, vm_t *vm) {
     if (!strcmp(name, "new")) {
         dict_t *dict = dict_create();
@@ -727,7 +1457,7 @@ bool dict_type_getter(object_t *self, const char *name, vm_t *vm) {
     } else if (!strcmp(name, "@")) {
         dict_t *dict;
         object_t *obj = vm_top(vm);
-        if (obj->type == &dict_type) {
+        if (object_type(obj) == &dict_type) {
             dict = dict_copy(obj->data.ptr);
         } else {
             dict = dict_create();
@@ -735,8 +1465,9 @@ bool dict_type_getter(object_t *self, const char *name, vm_t *vm) {
             object_t *next_obj;
             while (next_obj = object_next(obj_it, vm)) {
                 list_t *pair = object_to_pair(next_obj);
-                const char *name = object_to_str(pair->elems[0]);
-                dict_set(dict, name, pair->elems[1]);
+                unsigned hash;
+                const char *name = dict_key(pair->elems[0], &hash);
+                dict_set_hashed(dict, name, hash, pair->elems[1]);
             }
         }
         vm_push(vm, object_create_dict(dict));
@@ -753,8 +1484,9 @@ bool dict_type_getter(object_t *self, const char *name, vm_t *vm) {
         }
         dict_t *dict = dict_create();
         for (int i = n - 1; i >= 0; i--) {
-            const char *name = object_to_str(vm->stack_top[-i * 2 - 1]);
-            dict_set(dict, name, vm->stack_top[-i * 2]);
+            unsigned hash;
+            const char *name = dict_key(vm->stack_top[-i * 2 - 1], &hash);
+            dict_set_hashed(dict, name, hash, vm->stack_top[-i * 2]);
         }
         vm->stack_top -= n * 2;
         vm_push(vm, object_create_dict(dict));
@@ -762,85 +1494,127 @@ bool dict_type_getter(object_t *self, const char *name, vm_t *vm) {
     return true;
 }
 
-bool dict_getter(object_t *self, const char *name, vm_t *vm) {
+static void dict_len(object_t *self, int sym, vm_t *vm) {
     dict_t *dict = self->data.ptr;
-    if (!strcmp(name, "len")) {
-        vm_push(vm, vm_get_or_create_int(vm, dict->len));
-    } else if (!strcmp(name, ",")) {
-        list_t *pair = object_to_pair(vm_pop(vm));
-        const char *name = object_to_str(pair->elems[0]);
-        dict_set(dict, name, pair->elems[1]);
-        vm_push(vm, self);
-    } else if (
-        !strcmp(name, "__iter__") ||
-        !strcmp(name, "keys") ||
-        !strcmp(name, "values") ||
-        !strcmp(name, "items")
-    ) {
-        iterator_t *it = iterator_create(
-            name[0] == 'v'? ITER_DICT_VALUES:
-                name[0] == 'i'? ITER_DICT_ITEMS:
-                ITER_DICT_KEYS,
-            dict->len,
-            (iterator_data_t){ .dict = dict });
-        vm_push(vm, object_create_iterator(it));
-    } else if (!strcmp(name, "copy")) {
-        vm_push(vm, object_create_dict(dict_copy(dict)));
-    } else if (!strcmp(name, "update")) {
-        object_t *other_obj = vm_pop(vm);
-        if (other_obj->type != &dict_type) {
-            fprintf(stderr, "Can't update dict with '%s' object\n", other_obj->type->name);
-            exit(1);
-        }
-        dict_update(dict, other_obj->data.ptr);
-    } else if (
-        !strcmp(name, "get_key") ||
-        !strcmp(name, "get_value") ||
-        !strcmp(name, "get_item")
-    ) {
-        // hacky methods, but useful for old-school manual iteration
-        // (i.e. without iterators)
-        int i = object_to_int(vm_pop(vm));
-        if (i < 0 || i >= dict->len) {
-            fprintf(stderr, "Index %i out of bounds for dict of size %i\n", i, dict->len);
-            exit(1);
-        }
-        if (name[4] == 'k') vm_push(vm, vm_get_or_create_str(vm, dict->items[i].name));
-        else if (name[4] == 'v') vm_push(vm, dict->items[i].value);
-        else {
-            vm_push(vm, dict->items[i].value);
-            vm_push(vm, vm_get_or_create_str(vm, dict->items[i].name));
-        }
-    } else if (!strcmp(name, "has")) {
-        const char *name = object_to_str(vm_pop(vm));
-        object_t *obj = dict_get(dict, name);
-        vm_push(vm, object_create_bool(obj));
-    } else if (!strcmp(name, "get")) {
-        const char *name = object_to_str(vm_pop(vm));
-        object_t *obj = dict_get(dict, name);
-        if (!obj) {
-            fprintf(stderr, "Tried to get missing dict key '%s'\n", name);
-            exit(1);
-        }
-        vm_push(vm, obj);
-    } else if (!strcmp(name, "get_default")) {
-        const char *name = object_to_str(vm_pop(vm));
-        object_t *obj_default = vm_pop(vm);
-        object_t *obj = dict_get(dict, name);
-        vm_push(vm, obj? obj: obj_default);
-    } else if (!strcmp(name, "set")) {
-        const char *name = object_to_str(vm_pop(vm));
-        object_t *value = vm_pop(vm);
-        dict_set(dict, name, value);
-    } else return false;
-    return true;
+    vm_push(vm, vm_get_or_create_int(vm, dict->len - dict->n_deleted));
+}
+
+static void dict_comma(object_t *self, int sym, vm_t *vm) {
+    list_t *pair = object_to_pair(vm_pop(vm));
+    unsigned hash;
+    const char *name = dict_key(pair->elems[0], &hash);
+    dict_set_hashed(self->data.ptr, name, hash, pair->elems[1]);
+    vm_push(vm, self);
+}
+
+static void dict_iter(object_t *self, int sym, vm_t *vm) {
+    // __iter__, keys, values or items
+    dict_t *dict = self->data.ptr;
+    iterator_t *it = iterator_create(
+        sym == SYM_VALUES? ITER_DICT_VALUES:
+            sym == SYM_ITEMS? ITER_DICT_ITEMS:
+            ITER_DICT_KEYS,
+        dict->len,
+        (iterator_data_t){ .dict = dict });
+    vm_push(vm, object_create_iterator(it));
+}
+
+static void dict_copy_method(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, object_create_dict(dict_copy(self->data.ptr)));
+}
+
+static void dict_update_method(object_t *self, int sym, vm_t *vm) {
+    object_t *other_obj = vm_pop(vm);
+    if (object_type(other_obj) != &dict_type) {
+        fprintf(stderr, "Can't update dict with '%s' object\n", object_type(other_obj)->name);
+        exit(1);
+    }
+    dict_update(self->data.ptr, other_obj->data.ptr);
+}
+
+static void dict_get_at(object_t *self, int sym, vm_t *vm) {
+    // get_key, get_value or get_item: hacky methods, but useful for
+    // old-school manual iteration (i.e. without iterators)
+    dict_t *dict = self->data.ptr;
+    int i = object_to_int(vm_pop(vm));
+    if (dict->n_deleted) dict_rehash(dict, dict->n_buckets); // (so i is right)
+    if (i < 0 || i >= dict->len) {
+        fprintf(stderr, "Index %i out of bounds for dict of size %i\n", i, dict->len);
+        exit(1);
+    }
+    if (sym == SYM_GET_KEY) vm_push(vm, vm_get_or_create_str_hashed(vm, dict->items[i].name, dict->items[i].hash));
+    else if (sym == SYM_GET_VALUE) vm_push(vm, dict->items[i].value);
+    else {
+        vm_push(vm, dict->items[i].value);
+        vm_push(vm, vm_get_or_create_str_hashed(vm, dict->items[i].name, dict->items[i].hash));
+    }
+}
+
+static void dict_has(object_t *self, int sym, vm_t *vm) {
+    unsigned hash;
+    const char *name = dict_key(vm_pop(vm), &hash);
+    dict_item_t *item = dict_get_item_hashed(self->data.ptr, name, hash);
+    vm_push(vm, object_create_bool(item));
+}
+
+static void dict_get_method(object_t *self, int sym, vm_t *vm) {
+    unsigned hash;
+    const char *name = dict_key(vm_pop(vm), &hash);
+    dict_item_t *item = dict_get_item_hashed(self->data.ptr, name, hash);
+    if (!item) {
+        fprintf(stderr, "Tried to get missing dict key '%s'\n", name);
+        exit(1);
+    }
+    vm_push(vm, item->value);
+}
+
+static void dict_get_default(object_t *self, int sym, vm_t *vm) {
+    unsigned hash;
+    const char *name = dict_key(vm_pop(vm), &hash);
+    object_t *obj_default = vm_pop(vm);
+    dict_item_t *item = dict_get_item_hashed(self->data.ptr, name, hash);
+    vm_push(vm, item? item->value: obj_default);
+}
+
+static void dict_set_method(object_t *self, int sym, vm_t *vm) {
+    unsigned hash;
+    const char *name = dict_key(vm_pop(vm), &hash);
+    object_t *value = vm_pop(vm);
+    dict_set_hashed(self->data.ptr, name, hash, value);
+}
+
+static void dict_del_method(object_t *self, int sym, vm_t *vm) {
+    const char *name = object_to_str(vm_pop(vm));
+    if (!dict_del(self->data.ptr, name)) {
+        fprintf(stderr, "Tried to delete missing dict key '%s'\n", name);
+        exit(1);
+    }
 }
 
+static method_t *dict_methods[N_SYMS] = {
+    [SYM_LEN] = dict_len,
+    [SYM_COMMA] = dict_comma,
+    [SYM_ITER] = dict_iter,
+    [SYM_KEYS] = dict_iter,
+    [SYM_VALUES] = dict_iter,
+    [SYM_ITEMS] = dict_iter,
+    [SYM_COPY] = dict_copy_method,
+    [SYM_UPDATE] = dict_update_method,
+    [SYM_GET_KEY] = dict_get_at,
+    [SYM_GET_VALUE] = dict_get_at,
+    [SYM_GET_ITEM] = dict_get_at,
+    [SYM_HAS] = dict_has,
+    [SYM_GET] = dict_get_method,
+    [SYM_GET_DEFAULT] = dict_get_default,
+    [SYM_SET] = dict_set_method,
+    [SYM_DEL] = dict_del_method,
+};
+
 type_t dict_type = {
     .name = "dict",
     .print = dict_print,
     .type_getter = dict_type_getter,
-    .getter = dict_getter,
+    .methods = dict_methods,
 };
 
 
@@ -863,14 +1637,24 @@ const char *get_iteration_name(iteration_t iteration) {
     return iteration_names[iteration];
 }
 
+static void iterator_trace(void *ptr) {
+    iterator_t *it = ptr;
+    iteration_t iteration = it->iteration;
+    if (iteration == ITER_STR) gc_mark((void *)it->data.str);
+    else if (iteration == ITER_LIST) gc_mark(it->data.list);
+    else if (iteration >= FIRST_DICT_ITER && iteration <= LAST_DICT_ITER) gc_mark(it->data.dict);
+    else if (iteration == ITER_CUSTOM) gc_mark(it->data.custom.data);
+}
+
+static gc_kind_t iterator_gc_kind = {
+    .name = "iterator",
+    .trace = iterator_trace,
+};
+
 iterator_t *iterator_create_slice(iteration_t iteration, int len, iterator_data_t data,
     int start, int end
 ) {
-    iterator_t *it = calloc(1, sizeof *it);
-    if (!it) {
-        fprintf(stderr, "Failed to allocate %s iterator\n", get_iteration_name(iteration));
-        exit(1);
-    }
+    iterator_t *it = gc_alloc(sizeof *it, &iterator_gc_kind);
     if (start < 0) if ((start += len) < 0) start = 0;
     if (end < 0) if ((end += len) < 0) end = 0;
     else if (end > len) end = len;
@@ -892,7 +1676,7 @@ object_t *object_create_iterator(iterator_t *it) {
 }
 
 object_t *object_next(object_t *obj, vm_t *vm) {
-    object_getter(obj, "__next__", vm);
+    object_method(obj, SYM_NEXT, "__next__", vm);
     if (object_to_bool(vm_pop(vm))) {
         return vm_pop(vm);
     } else return NULL; // iteration finished
@@ -903,57 +1687,70 @@ void iterator_print(object_t *self) {
     printf("<%s iterator at %p>", get_iteration_name(it->iteration), self);
 }
 
-bool iterator_getter(object_t *self, const char *name, vm_t *vm) {
+static void iterator_iter(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, self);
+}
+
+static void iterator_next(object_t *self, int sym, vm_t *vm) {
     iterator_t *it = self->data.ptr;
-    if (!strcmp(name, "__iter__")) {
-        vm_push(vm, self);
-    } else if (!strcmp(name, "__next__")) {
-        if (it->i >= it->end) vm_push(vm, &static_false);
-        else {
-            iteration_t iteration = it->iteration;
-            if (iteration == ITER_RANGE) {
-                vm_push(vm, vm_get_or_create_int(vm, it->data.range_start + it->i));
-            } else if (iteration == ITER_STR) {
-                vm_push(vm, vm_get_char_str(vm, it->data.str[it->i]));
-            } else if (iteration == ITER_LIST) {
-                list_t *list = it->data.list;
-                vm_push(vm, list->elems[it->i]);
-            } else if (iteration >= FIRST_DICT_ITER && iteration <= LAST_DICT_ITER) {
-                dict_t *dict = it->data.dict;
-                dict_item_t *item = &dict->items[it->i];
-                if (iteration == ITER_DICT_KEYS) {
-                    vm_push(vm, vm_get_or_create_str(vm, item->name));
-                } else if (iteration == ITER_DICT_VALUES) {
-                    vm_push(vm, item->value);
-                } else if (iteration == ITER_DICT_ITEMS) {
-                    list_t *pair = list_create();
-                    list_grow(pair, 2);
-                    pair->elems[0] = vm_get_or_create_str(vm, item->name);
-                    pair->elems[1] = item->value;
-                    vm_push(vm, object_create_list(pair));
-                } else {
-                    // we should never get here...
-                    fprintf(stderr, "Unknown dict iteration tag: %i\n", iteration);
-                    exit(1);
-                }
-            } else if (iteration == ITER_CUSTOM) {
-                vm_push(vm, it->data.custom.next(it, vm));
-            } else {
-                // we should never get here...
-                fprintf(stderr, "Unknown iteration tag: %i\n", iteration);
-                exit(1);
-            }
-            vm_push(vm, &static_true);
-            it->i++;
+    if (it->i >= it->end) {
+        vm_push(vm, &static_false);
+        return;
+    }
+
+    iteration_t iteration = it->iteration;
+    if (iteration == ITER_RANGE) {
+        vm_push(vm, vm_get_or_create_int(vm, it->data.range_start + it->i));
+    } else if (iteration == ITER_STR) {
+        vm_push(vm, vm_get_char_str(vm, it->data.str[it->i]));
+    } else if (iteration == ITER_LIST) {
+        list_t *list = it->data.list;
+        vm_push(vm, list->elems[it->i]);
+    } else if (iteration >= FIRST_DICT_ITER && iteration <= LAST_DICT_ITER) {
+        dict_t *dict = it->data.dict;
+        // skip items which were deleted (see dict_del)
+        while (it->i < dict->len && !dict->items[it->i].name) it->i++;
+        if (it->i >= dict->len || it->i >= it->end) {
+            // keys were deleted from the dict during iteration
+            vm_push(vm, &static_false);
+            return;
         }
-    } else return false;
-    return true;
+        dict_item_t *item = &dict->items[it->i];
+        if (iteration == ITER_DICT_KEYS) {
+            vm_push(vm, vm_get_or_create_str_hashed(vm, item->name, item->hash));
+        } else if (iteration == ITER_DICT_VALUES) {
+            vm_push(vm, item->value);
+        } else if (iteration == ITER_DICT_ITEMS) {
+            list_t *pair = list_create();
+            list_grow(pair, 2);
+            pair->elems[0] = vm_get_or_create_str_hashed(vm, item->name, item->hash);
+            pair->elems[1] = item->value;
+            vm_push(vm, object_create_list(pair));
+        } else {
+            // we should never get here...
+            fprintf(stderr, "Unknown dict iteration tag: %i\n", iteration);
+            exit(1);
+        }
+    } else if (iteration == ITER_CUSTOM) {
+        vm_push(vm, it->data.custom.next(it, vm));
+    } else {
+        // we should never get here...
+        fprintf(stderr, "Unknown iteration tag: %i\n", iteration);
+        exit(1);
+    }
+    vm_push(vm, &static_true);
+    it->i++;
 }
 
+static method_t *iterator_methods[N_SYMS] = {
+    [SYM_ITER] = iterator_iter,
+    [SYM_NEXT] = iterator_next,
+};
+
 type_t iterator_type = {
     .name = "iterator",
     .print = iterator_print,
-    .getter = iterator_getter,
+    .methods = iterator_methods,
 };
 
 
@@ -961,12 +1758,21 @@ type_t iterator_type = {
 * FUNC
 ****************/
 
+static void func_trace(void *ptr) {
+    // NOTE: code is never freed, it's kept alive by vm->code_cache
+    func_t *func = ptr;
+    gc_mark((void *)func->name);
+    gc_mark(func->stack);
+    gc_mark(func->locals);
+}
+
+static gc_kind_t func_gc_kind = {
+    .name = "func",
+    .trace = func_trace,
+};
+
 func_t *func_create(const char *name) {
-    func_t *func = calloc(1, sizeof *func);
-    if (!func) {
-        fprintf(stderr, "Failed to allocate func: %s\n", name? name: "(no name)");
-        exit(1);
-    }
+    func_t *func = gc_alloc(sizeof *func, &func_gc_kind);
     func->name = name;
     return func;
 }
@@ -1008,88 +1814,129 @@ void func_print(object_t *self) {
         name, self);
 }
 
-bool func_getter(object_t *self, const char *name, vm_t *vm) {
+static void func_call(object_t *self, int sym, vm_t *vm) {
     func_t *func = self->data.ptr;
-    if (!strcmp(name, "@")) {
-        if (func->is_c_code && func->locals) {
-            fprintf(stderr, "Tried to call a C function (%s) with locals\n", func->name);
-            exit(1);
-        }
-        if (func->stack) for (int i = func->stack->len - 1; i >= 0; i--) {
-            vm_push(vm, func->stack->elems[i]);
-        }
-        if (func->is_c_code) {
-            func->u.c_code(vm);
-        } else {
-            dict_t *locals = func->locals? dict_copy(func->locals): NULL;
-            vm_eval(vm, func->u.code, locals);
-        }
-    } else if (!strcmp(name, "filename")) {
-        vm_push(vm, func->is_c_code?
-            &static_null:
-            vm_get_or_create_str(vm, func->u.code->filename));
-    } else if (!strcmp(name, "to_dict")) {
-        // run the function, and return its locals as a dict...
-        // kinda hacky, but super useful for metaprogramming
-        if (func->is_c_code) {
-            fprintf(stderr, "Tried to call a C function (%s) with locals\n", func->name);
-            exit(1);
-        }
-        if (func->stack) for (int i = func->stack->len - 1; i >= 0; i--) {
-            vm_push(vm, func->stack->elems[i]);
-        }
-        dict_t *locals = func->locals? dict_copy(func->locals): dict_create();
-        vm_eval(vm, func->u.code, locals);
-        vm_push(vm, object_create_dict(locals));
-    } else if (!strcmp(name, "name")) {
-        vm_push(vm, func->name? vm_get_or_create_str(vm, func->name): &static_null);
-    } else if (!strcmp(name, "copy")) {
-        vm_push(vm, object_create_func(func_copy(func)));
-    } else if (!strcmp(name, "stack")) {
-        vm_push(vm, func->stack? object_create_list(func->stack): &static_null);
-    } else if (!strcmp(name, "locals")) {
-        vm_push(vm, func->locals? object_create_dict(func->locals): &static_null);
-    } else if (!strcmp(name, "push_stack")) {
-        object_t *obj = vm_pop(vm);
-        if (!func->stack) func->stack = list_create();
-        list_push(func->stack, obj);
-    } else if (!strcmp(name, "set_local")) {
-        const char *name = object_to_str(vm_pop(vm));
-        object_t *obj = vm_pop(vm);
-        if (!func->locals) func->locals = dict_create();
-        dict_set(func->locals, name, obj);
-    } else if (!strcmp(name, "print_code")) {
-        if (func->is_c_code) printf("Can't print code of built-in function!\n");
-        else vm_print_code(vm, func->u.code, 0);
-    } else return false;
-    return true;
+    if (func->is_c_code && func->locals) {
+        fprintf(stderr, "Tried to call a C function (%s) with locals\n", func->name);
+        exit(1);
+    }
+    if (func->stack) for (int i = func->stack->len - 1; i >= 0; i--) {
+        vm_push(vm, func->stack->elems[i]);
+    }
+    if (func->is_c_code) func->u.c_code(vm);
+    else vm_eval(vm, func->u.code, func->locals);
+}
+
+static void func_filename(object_t *self, int sym, vm_t *vm) {
+    func_t *func = self->data.ptr;
+    vm_push(vm, func->is_c_code?
+        &static_null:
+        vm_get_or_create_str(vm, func->u.code->filename));
+}
+
+static void func_to_dict(object_t *self, int sym, vm_t *vm) {
+    // run the function, and return its locals as a dict...
+    // kinda hacky, but super useful for metaprogramming
+    func_t *func = self->data.ptr;
+    if (func->is_c_code) {
+        fprintf(stderr, "Tried to call a C function (%s) with locals\n", func->name);
+        exit(1);
+    }
+    if (func->stack) for (int i = func->stack->len - 1; i >= 0; i--) {
+        vm_push(vm, func->stack->elems[i]);
+    }
+    dict_t *locals = func->locals? dict_copy(func->locals): dict_create();
+    vm_eval_to_dict(vm, func->u.code, locals);
+    vm_push(vm, object_create_dict(locals));
+}
+
+static void func_name(object_t *self, int sym, vm_t *vm) {
+    func_t *func = self->data.ptr;
+    vm_push(vm, func->name? vm_get_or_create_str(vm, func->name): &static_null);
+}
+
+static void func_copy_method(object_t *self, int sym, vm_t *vm) {
+    vm_push(vm, object_create_func(func_copy(self->data.ptr)));
+}
+
+static void func_stack(object_t *self, int sym, vm_t *vm) {
+    func_t *func = self->data.ptr;
+    vm_push(vm, func->stack? object_create_list(func->stack): &static_null);
+}
+
+static void func_locals(object_t *self, int sym, vm_t *vm) {
+    func_t *func = self->data.ptr;
+    vm_push(vm, func->locals? object_create_dict(func->locals): &static_null);
 }
 
+static void func_push_stack(object_t *self, int sym, vm_t *vm) {
+    func_t *func = self->data.ptr;
+    object_t *obj = vm_pop(vm);
+    if (!func->stack) {
+        func->stack = list_create();
+        gc_write_barrier(func, func->stack);
+    }
+    list_push(func->stack, obj);
+}
+
+static void func_set_local(object_t *self, int sym, vm_t *vm) {
+    func_t *func = self->data.ptr;
+    const char *name = object_to_str(vm_pop(vm));
+    object_t *obj = vm_pop(vm);
+    if (!func->locals) {
+        func->locals = dict_create();
+        gc_write_barrier(func, func->locals);
+    }
+    dict_set(func->locals, name, obj);
+}
+
+static void func_print_code(object_t *self, int sym, vm_t *vm) {
+    func_t *func = self->data.ptr;
+    if (func->is_c_code) printf("Can't print code of built-in function!\n");
+    else vm_print_code(vm, func->u.code, 0);
+}
+
+static method_t *func_methods[N_SYMS] = {
+    [SYM_CALL] = func_call,
+    [SYM_FILENAME] = func_filename,
+    [SYM_TO_DICT] = func_to_dict,
+    [SYM_NAME] = func_name,
+    [SYM_COPY] = func_copy_method,
+    [SYM_STACK] = func_stack,
+    [SYM_LOCALS] = func_locals,
+    [SYM_PUSH_STACK] = func_push_stack,
+    [SYM_SET_LOCAL] = func_set_local,
+    [SYM_PRINT_CODE] = func_print_code,
+};
+
 bool func_setter(object_t *self, const char *name, vm_t *vm) {
     func_t *func = self->data.ptr;
     if (!strcmp(name, "name")) {
         const char *name = object_to_str(vm_pop(vm));
+        gc_write_barrier(func, (void *)name);
         func->name = name;
     } else if (!strcmp(name, "stack")) {
         object_t *obj = vm_pop(vm);
         if (obj == &static_null) func->stack = NULL;
         else {
-            if (obj->type != &list_type) {
+            if (object_type(obj) != &list_type) {
                 fprintf(stderr, "Tried to assign '%s' object to stack of func: %s\n",
-                    obj->type->name, func->name? func->name: "(no name)");
+                    object_type(obj)->name, func->name? func->name: "(no name)");
                 exit(1);
             }
+            gc_write_barrier(func, obj->data.ptr);
             func->stack = obj->data.ptr;
         }
     } else if (!strcmp(name, "locals")) {
         object_t *obj = vm_pop(vm);
         if (obj == &static_null) func->locals = NULL;
         else {
-            if (obj->type != &dict_type) {
+            if (object_type(obj) != &dict_type) {
                 fprintf(stderr, "Tried to assign '%s' object to locals of func: %s\n",
-                    obj->type->name, func->name? func->name: "(no name)");
+                    object_type(obj)->name, func->name? func->name: "(no name)");
                 exit(1);
             }
+            gc_write_barrier(func, obj->data.ptr);
             func->locals = obj->data.ptr;
         }
     } else return false;
@@ -1099,7 +1946,7 @@ bool func_setter(object_t *self, const char *name, vm_t *vm) {
 type_t func_type = {
     .name = "func",
     .print = func_print,
-    .getter = func_getter,
+    .methods = func_methods,
     .setter = func_setter,
 };
 
@@ -1114,7 +1961,7 @@ void cls_print(object_t *self) {
     object_t *print_obj = dict_get(cls->getters, "__print__");
     if (print_obj) {
         vm_push(vm, self);
-        object_getter(print_obj, "@", vm);
+        object_method(print_obj, SYM_CALL, "@", vm);
     } else printf("<'%s' object at %p>", self->type->name, self);
 }
 
@@ -1124,7 +1971,7 @@ cmp_result_t cls_cmp(object_t *self, object_t *other, vm_t *vm) {
     if (cmp_obj) {
         vm_push(vm, self);
         vm_push(vm, other);
-        object_getter(cmp_obj, "@", vm);
+        object_method(cmp_obj, SYM_CALL, "@", vm);
         object_t *result_obj = vm_pop(vm);
         if (result_obj == &static_null) return CMP_NE;
         int result_i = object_to_int(result_obj);
@@ -1142,7 +1989,7 @@ bool cls_type_getter(object_t *self, const char *name, vm_t *vm) {
         obj->data.ptr = dict_create(); // instance attrs, i.e. __dict__
         vm_push(vm, obj);
         object_t *init_obj = dict_get(cls->getters, "__init__");
-        if (init_obj) object_getter(init_obj, "@", vm);
+        if (init_obj) object_method(init_obj, SYM_CALL, "@", vm);
     } else if (!strcmp(name, "copy")) {
         const char *name = object_to_str(vm_pop(vm));
         vm_push(vm, object_copy_cls(cls, name));
@@ -1174,7 +2021,7 @@ bool cls_type_getter(object_t *self, const char *name, vm_t *vm) {
         }
 
         object_t *obj = vm_pop(vm);
-        object_getter(obj, "name", vm);
+        object_method(obj, SYM_NAME, "name", vm);
         const char *name = object_to_str(vm_pop(vm));
         dict_set(dict, name, obj);
     } else {
@@ -1186,7 +2033,7 @@ bool cls_type_getter(object_t *self, const char *name, vm_t *vm) {
             object_t *getter_obj = dict_get(cls->class_getters, name);
             if (getter_obj) {
                 vm_push(vm, self);
-                object_getter(getter_obj, "@", vm);
+                object_method(getter_obj, SYM_CALL, "@", vm);
             } else return false;
         }
     }
@@ -1202,7 +2049,7 @@ bool cls_type_setter(object_t *self, const char *name, vm_t *vm) {
     if (setter_obj) {
         // lookup name in class setters
         vm_push(vm, self);
-        object_getter(setter_obj, "@", vm);
+        object_method(setter_obj, SYM_CALL, "@", vm);
     } else {
         // update class attrs
         object_t *obj = vm_pop(vm);
@@ -1226,7 +2073,7 @@ bool cls_getter(object_t *self, const char *name, vm_t *vm) {
             object_t *getter_obj = dict_get(cls->getters, name);
             if (getter_obj) {
                 vm_push(vm, self);
-                object_getter(getter_obj, "@", vm);
+                object_method(getter_obj, SYM_CALL, "@", vm);
             } else {
                 // lookup name in class attrs
                 object_t *obj = dict_get(cls->class_attrs, name);
@@ -1247,7 +2094,7 @@ bool cls_setter(object_t *self, const char *name, vm_t *vm) {
     if (setter_obj) {
         // lookup name in instance setters
         vm_push(vm, self);
-        object_getter(setter_obj, "@", vm);
+        object_method(setter_obj, SYM_CALL, "@", vm);
     } else {
         // update instance attrs
         object_t *obj = vm_pop(vm);
@@ -1256,12 +2103,108 @@ bool cls_setter(object_t *self, const char *name, vm_t *vm) {
     return true;
 }
 
-type_t *type_create_cls(const char *name, cls_t *cls) {
-    type_t *type = calloc(1, sizeof *type);
-    if (!type) {
-        fprintf(stderr, "Failed to allocate class type '%s'\n", name);
+static bool cls_cached_getter(object_t *self, const char *name, getter_cache_t *cache, vm_t *vm) {
+    // like cls_getter, but remembers what it found in the class
+    type_t *type = self->type;
+    cls_t *cls = type->data;
+    if (
+        cache->type != type ||
+        cache->version != cls->getters->version ||
+        cache->attrs_version != cls->class_attrs->version
+    ) {
+        if (!strcmp(name, "__dict__")) return cls_getter(self, name, vm);
+        cache->type = type;
+        cache->version = cls->getters->version;
+        cache->attrs_version = cls->class_attrs->version;
+        cache->func = dict_get(cls->getters, name);
+        cache->attr = cache->func? NULL: dict_get(cls->class_attrs, name);
+    }
+
+    // instance attrs come first
+    dict_item_t *item = dict_get_item_hinted(self->data.ptr, name, cache->hash, &cache->i);
+    if (item) vm_push(vm, item->value);
+    else if (cache->func) {
+        vm_push(vm, self);
+        object_method(cache->func, SYM_CALL, "@", vm);
+    } else if (cache->attr) vm_push(vm, cache->attr);
+    else return false;
+    return true;
+}
+
+static bool cls_cached_setter(object_t *self, const char *name, getter_cache_t *cache, vm_t *vm) {
+    // like cls_setter, but remembers what it found in the class
+    type_t *type = self->type;
+    cls_t *cls = type->data;
+    if (cache->type != type || cache->version != cls->setters->version) {
+        cache->type = type;
+        cache->version = cls->setters->version;
+        cache->func = dict_get(cls->setters, name);
+        cache->attr = NULL;
+    }
+
+    if (cache->func) {
+        vm_push(vm, self);
+        object_method(cache->func, SYM_CALL, "@", vm);
+    } else {
+        object_t *obj = vm_pop(vm);
+        dict_t *attrs = self->data.ptr;
+        dict_item_t *item = dict_get_item_hinted(attrs, name, cache->hash, &cache->i);
+        if (item) dict_set_item(attrs, item, obj);
+        else dict_set(attrs, name, obj);
+    }
+    return true;
+}
+
+void object_cached_getter(object_t *self, const char *name, getter_cache_t *cache, vm_t *vm) {
+    // like object_getter, for a GETTER instruction with its own cache
+    type_t *type = object_type(self);
+    if (type->getter != cls_getter) {
+        object_method(self, cache->sym, name, vm);
+    } else if (!cls_cached_getter(self, name, cache, vm)) {
+        fprintf(stderr, "Object of type '%s' has no getter '%s'\n", type->name, name);
+        exit(1);
+    }
+}
+
+void object_cached_setter(object_t *self, const char *name, getter_cache_t *cache, vm_t *vm) {
+    // like object_setter, for a SETTER instruction with its own cache
+    type_t *type = object_type(self);
+    bool ok = type->setter == cls_setter? cls_cached_setter(self, name, cache, vm):
+        type->setter? type->setter(self, name, vm): false;
+    if (!ok) {
+        fprintf(stderr, "Object of type '%s' has no setter '%s'\n", type->name, name);
         exit(1);
     }
+}
+
+static void type_trace(void *ptr) {
+    type_t *type = ptr;
+    gc_mark((void *)type->name);
+    gc_mark(type->data);
+}
+
+static gc_kind_t type_gc_kind = {
+    .name = "type",
+    .trace = type_trace,
+};
+
+static void cls_trace(void *ptr) {
+    cls_t *cls = ptr;
+    gc_mark(cls->type);
+    gc_mark(cls->class_attrs);
+    gc_mark(cls->class_getters);
+    gc_mark(cls->class_setters);
+    gc_mark(cls->getters);
+    gc_mark(cls->setters);
+}
+
+static gc_kind_t cls_gc_kind = {
+    .name = "class",
+    .trace = cls_trace,
+};
+
+type_t *type_create_cls(const char *name, cls_t *cls) {
+    type_t *type = gc_alloc(sizeof *type, &type_gc_kind);
     type->name = name;
     type->data = cls;
     type->print = cls_print;
@@ -1274,11 +2217,7 @@ type_t *type_create_cls(const char *name, cls_t *cls) {
 }
 
 object_t *object_create_cls(const char *name, vm_t *vm) {
-    cls_t *cls = calloc(1, sizeof *cls);
-    if (!cls) {
-        fprintf(stderr, "Failed to allocate class '%s'\n", name);
-        exit(1);
-    }
+    cls_t *cls = gc_alloc(sizeof *cls, &cls_gc_kind);
     cls->type = type_create_cls(name, cls);
     cls->vm = vm;
     cls->class_attrs = dict_create();
@@ -1290,11 +2229,7 @@ object_t *object_create_cls(const char *name, vm_t *vm) {
 }
 
 object_t *object_copy_cls(cls_t *target_cls, const char *name) {
-    cls_t *cls = calloc(1, sizeof *cls);
-    if (!cls) {
-        fprintf(stderr, "Failed to allocate class '%s' (copy of '%s')\n", name, target_cls->type->name);
-        exit(1);
-    }
+    cls_t *cls = gc_alloc(sizeof *cls, &cls_gc_kind);
     cls->type = type_create_cls(name, cls);
     cls->vm = target_cls->vm;
     cls->class_attrs = dict_copy(target_cls->class_attrs);
@@ -0,0 +1,870 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lalang.h"
+
+
+/****************
+* SNAPSHOT
+****************/
+
+// A snapshot of a VM's heap: everything reachable from its globals, caches
+// and stack, so that a later process can pick up where it left off (e.g.
+// with the stdlib already loaded) instead of running vm_init & co.
+// The file is:
+//   * a snapshot_header
+//   * the roots (see snapshot_header)
+//   * n_nodes nodes, i.e. everything the roots point at: each is an int32_t
+//     snapshot_kind_t, then whatever that kind of thing has in it
+//   * an int32_t offset of each node from the start of the file
+// Pointers are written as the index of the node they point at (or -1 for
+// NULL), and objects as an int64_t: twice their index, or an int's tagged
+// value, which is odd (see OBJECT_FROM_INT).
+// Pointers into the interpreter itself (the builtin types, null, true &
+// false, and the C functions in vm_builtins) are written as an index into
+// snapshot_statics or vm_builtins, so they get fixed up when loading.
+// Loading maps the file in, creates an empty one of each node, and then
+// fills them in; strs stay where they are in the mapping, which is never
+// unmapped.
+// NOTE: like .lalac files, snapshots are native-endian, and are only any
+// use to the same build of the interpreter
+
+#define SNAPSHOT_MAGIC "LALASNAP"
+#define SNAPSHOT_VERSION 6
+
+typedef enum snapshot_kind {
+    SNAPSHOT_STATIC, // one of snapshot_statics
+    SNAPSHOT_STR, // a const char *
+    SNAPSHOT_OBJECT,
+    SNAPSHOT_STR_OBJECT, // a str_t
+    SNAPSHOT_STRVIEW_OBJECT, // a strview_t
+    SNAPSHOT_STRBUF,
+    SNAPSHOT_LIST,
+    SNAPSHOT_DICT,
+    SNAPSHOT_FUNC,
+    SNAPSHOT_CODE,
+    SNAPSHOT_CLASS, // a class's type_t (and its cls_t)
+    SNAPSHOT_ITERATOR,
+    SNAPSHOT_VM, // the VM being snapshotted, e.g. the "vm" global's data
+    N_SNAPSHOT_KINDS
+} snapshot_kind_t;
+
+// NOTE: the types come first
+static void *snapshot_statics[] = {
+    &type_type, &null_type, &bool_type, &int_type, &str_type, &list_type,
+    &dict_type, &iterator_type, &func_type, &vm_type, &strview_type,
+    &strbuf_type,
+    &static_type, &static_null, &static_true, &static_false,
+};
+
+#define N_SNAPSHOT_STATIC_TYPES 12
+#define N_SNAPSHOT_STATICS (int)(sizeof snapshot_statics / sizeof *snapshot_statics)
+
+struct snapshot_header {
+    char magic[8];
+    int32_t version;
+    int32_t n_instrs; // N_INSTRS, i.e. the build of the interpreter...
+    int32_t n_syms; // N_SYMS
+    uint32_t builtins_hash; // see snapshot_builtins_hash
+    int32_t optimize; // vm->optimize (only checked if there's a source)
+
+    // the source file the snapshot was made from, if any (so it's only
+    // loaded if that hasn't changed)
+    file_stamp_t source;
+
+    int32_t n_nodes;
+    int32_t nodes_offset; // where the nodes' offsets are
+    uint32_t checksum; // of the rest of the file
+
+    // NOTE: the roots come next: globals and str_cache (dicts), code_cache
+    // (a list), the 256 objects of char_cache, the stack's size and then
+    // its objects, and instr_count (an int64_t, so that it's the same as if
+    // we'd run whatever the snapshot skips)
+};
+
+static uint32_t snapshot_builtins_hash(void) {
+    // so that a snapshot's indexes into vm_builtins still mean the same
+    // functions
+    uint32_t hash = HASH_INIT;
+    for (builtin_t *builtin = vm_builtins; builtin->name; builtin++) {
+        hash = (hash ^ hash_string(builtin->name)) * HASH_PRIME;
+    }
+    return hash;
+}
+
+static bool snapshot_set_header(struct snapshot_header *header, const char *source, bool optimize) {
+    // fills in header's checks, returning false if source couldn't be read
+    // NOTE: headers get memcmp'd, so zero any padding too
+    memset(header, 0, sizeof *header);
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof header->magic);
+    header->version = SNAPSHOT_VERSION;
+    header->n_instrs = N_INSTRS;
+    header->n_syms = N_SYMS;
+    header->builtins_hash = snapshot_builtins_hash();
+    if (source) {
+        header->optimize = optimize;
+        return file_stamp_set(&header->source, source, NULL);
+    }
+    return true;
+}
+
+
+/****************
+* SNAPSHOT WRITE
+****************/
+
+typedef struct snapshot_writer {
+    vm_t *vm;
+    bool required; // exit on errors, rather than giving up quietly
+    bool ok;
+
+    int n_nodes;
+    int nodes_size;
+    void **nodes;
+    snapshot_kind_t *kinds;
+
+    // open-addressing hash table of indexes into nodes (-1 means empty),
+    // at most half full
+    int n_buckets;
+    int *buckets;
+
+    buf_t buf;
+} snapshot_writer_t;
+
+static void snapshot_push_i(snapshot_writer_t *w, int32_t i) {
+    buf_push_i(&w->buf, i);
+}
+
+static void snapshot_fail(snapshot_writer_t *w, const char *what, const char *name) {
+    if (w->required) {
+        fprintf(stderr, "Can't snapshot %s: %s\n", what, name);
+        exit(1);
+    }
+    w->ok = false;
+}
+
+static unsigned snapshot_hash_ptr(void *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    return (unsigned)((p >> 4) ^ (p >> 20)) * 2654435761u;
+}
+
+static void snapshot_grow_buckets(snapshot_writer_t *w) {
+    int n_buckets = w->n_buckets? w->n_buckets * 2: 1024;
+    int *buckets = malloc(n_buckets * sizeof *buckets);
+    if (!buckets) {
+        fprintf(stderr, "Failed to allocate snapshot buckets\n");
+        exit(1);
+    }
+    for (int j = 0; j < n_buckets; j++) buckets[j] = -1;
+    for (int i = 0; i < w->n_nodes; i++) {
+        unsigned j = snapshot_hash_ptr(w->nodes[i]) & (n_buckets - 1);
+        while (buckets[j] >= 0) j = (j + 1) & (n_buckets - 1);
+        buckets[j] = i;
+    }
+    free(w->buckets);
+    w->buckets = buckets;
+    w->n_buckets = n_buckets;
+}
+
+static int32_t snapshot_ref(snapshot_writer_t *w, snapshot_kind_t kind, void *ptr) {
+    // returns ptr's node, adding it if it's new
+    if (!ptr) return -1;
+    if ((w->n_nodes + 1) * 2 > w->n_buckets) snapshot_grow_buckets(w);
+    unsigned j = snapshot_hash_ptr(ptr) & (w->n_buckets - 1);
+    for (int i; (i = w->buckets[j]) >= 0; j = (j + 1) & (w->n_buckets - 1)) {
+        if (w->nodes[i] == ptr) return i;
+    }
+
+    if (w->n_nodes == w->nodes_size) {
+        int new_size = w->nodes_size? w->nodes_size * 2: 1024;
+        void **nodes = realloc(w->nodes, new_size * sizeof *nodes);
+        snapshot_kind_t *kinds = realloc(w->kinds, new_size * sizeof *kinds);
+        if (!nodes || !kinds) {
+            fprintf(stderr, "Failed to allocate snapshot nodes\n");
+            exit(1);
+        }
+        w->nodes = nodes;
+        w->kinds = kinds;
+        w->nodes_size = new_size;
+    }
+    int i = w->n_nodes++;
+    w->nodes[i] = ptr;
+    w->kinds[i] = kind;
+    w->buckets[j] = i;
+    return i;
+}
+
+static int snapshot_static_i(void *ptr) {
+    for (int k = 0; k < N_SNAPSHOT_STATICS; k++) {
+        if (snapshot_statics[k] == ptr) return k;
+    }
+    return -1;
+}
+
+static int32_t snapshot_type_ref(snapshot_writer_t *w, type_t *type) {
+    if (snapshot_static_i(type) >= 0) return snapshot_ref(w, SNAPSHOT_STATIC, type);
+    if (type->getter == cls_getter) return snapshot_ref(w, SNAPSHOT_CLASS, type);
+    snapshot_fail(w, "type", type->name);
+    return -1;
+}
+
+static void snapshot_push_obj(snapshot_writer_t *w, object_t *obj) {
+    int64_t ref = OBJECT_IS_INT(obj)? (int64_t)OBJECT_TO_INT(obj) * 2 + 1:
+        2 * (int64_t)snapshot_ref(w,
+            snapshot_static_i(obj) >= 0? SNAPSHOT_STATIC:
+            obj->type == &str_type? SNAPSHOT_STR_OBJECT:
+            obj->type == &strview_type? SNAPSHOT_STRVIEW_OBJECT:
+            SNAPSHOT_OBJECT, obj);
+    buf_push(&w->buf, &ref, sizeof ref);
+}
+
+static void snapshot_push_dict(snapshot_writer_t *w, dict_t *dict) {
+    snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_DICT, dict));
+}
+
+static void snapshot_write_object(snapshot_writer_t *w, object_t *obj) {
+    type_t *type = obj->type;
+    snapshot_push_i(w, snapshot_type_ref(w, type));
+    // what data.ptr is depends on the type
+    void *ptr = obj->data.ptr;
+    int32_t ref =
+        type == &strbuf_type? snapshot_ref(w, SNAPSHOT_STRBUF, ptr):
+        type == &list_type? snapshot_ref(w, SNAPSHOT_LIST, ptr):
+        type == &dict_type? snapshot_ref(w, SNAPSHOT_DICT, ptr):
+        type == &func_type? snapshot_ref(w, SNAPSHOT_FUNC, ptr):
+        type == &iterator_type? snapshot_ref(w, SNAPSHOT_ITERATOR, ptr):
+        type == &type_type? snapshot_type_ref(w, ptr):
+        type == &vm_type && ptr == w->vm? snapshot_ref(w, SNAPSHOT_VM, ptr):
+        type->getter == cls_getter? snapshot_ref(w, SNAPSHOT_DICT, ptr): // instance attrs
+        -2;
+    if (ref == -2) snapshot_fail(w, "object of type", type->name);
+    snapshot_push_i(w, ref);
+}
+
+static void snapshot_write_code(snapshot_writer_t *w, code_t *code) {
+    snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_STR, (void *)code->filename));
+    snapshot_push_i(w, code->row);
+    snapshot_push_i(w, code->col);
+    snapshot_push_i(w, code->is_func);
+    snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_CODE, code->scope));
+
+    // NOTE: args and locals are indexes into vm->str_cache and
+    // vm->code_cache, which are loaded in the same order, so they stay as
+    // they are
+    snapshot_push_i(w, code->n_locals);
+    for (int j = 0; j < code->n_locals; j++) snapshot_push_i(w, code->locals[j]);
+    snapshot_push_i(w, code->len);
+    buf_push(&w->buf, code->bytecodes, code->len);
+    snapshot_push_i(w, code->n_getter_caches);
+    for (int j = 0; j < code->n_getter_caches; j++) {
+        // whatever the caches found is forgotten, which turns any quickened
+        // GETTER_METHODs back into GETTERs the first time they run
+        snapshot_push_i(w, code->getter_caches[j].hash);
+        snapshot_push_i(w, code->getter_caches[j].sym);
+    }
+    snapshot_push_i(w, code->n_loops);
+    for (int j = 0; j < code->n_loops; j++) {
+        loop_t *loop = &code->loops[j];
+        snapshot_push_i(w, loop->start);
+        snapshot_push_i(w, loop->end);
+        snapshot_push_i(w, loop->break_to);
+        snapshot_push_i(w, loop->continue_to);
+    }
+}
+
+static void snapshot_write_node(snapshot_writer_t *w, int i) {
+    void *ptr = w->nodes[i];
+    snapshot_kind_t kind = w->kinds[i];
+    snapshot_push_i(w, kind);
+    switch (kind) {
+        case SNAPSHOT_STATIC:
+            snapshot_push_i(w, snapshot_static_i(ptr));
+            break;
+        case SNAPSHOT_STR: {
+            int32_t len = strlen(ptr);
+            snapshot_push_i(w, len);
+            buf_push(&w->buf, ptr, len + 1);
+            break;
+        }
+        case SNAPSHOT_OBJECT:
+            snapshot_write_object(w, ptr);
+            break;
+        case SNAPSHOT_STR_OBJECT: {
+            // NOTE: its other fields are worked out again when loading
+            object_t *obj = ptr;
+            snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_STR, obj->data.ptr));
+            break;
+        }
+        case SNAPSHOT_STRVIEW_OBJECT: {
+            strview_t *view = ptr;
+            snapshot_push_obj(w, view->object.data.ptr);
+            snapshot_push_i(w, view->start);
+            snapshot_push_i(w, view->len);
+            break;
+        }
+        case SNAPSHOT_STRBUF: {
+            strbuf_t *buf = ptr;
+            snapshot_push_i(w, buf->len);
+            buf_push(&w->buf, buf->chars, buf->len);
+            break;
+        }
+        case SNAPSHOT_LIST: {
+            list_t *list = ptr;
+            snapshot_push_i(w, list->len);
+            for (int j = 0; j < list->len; j++) snapshot_push_obj(w, list->elems[j]);
+            break;
+        }
+        case SNAPSHOT_DICT: {
+            dict_t *dict = ptr;
+            snapshot_push_i(w, dict->len - dict->n_deleted);
+            for (int j = 0; j < dict->len; j++) {
+                if (!dict->items[j].name) continue;
+                snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_STR, (void *)dict->items[j].name));
+                snapshot_push_obj(w, dict->items[j].value);
+            }
+            break;
+        }
+        case SNAPSHOT_FUNC: {
+            func_t *func = ptr;
+            snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_STR, (void *)func->name));
+            snapshot_push_i(w, func->is_c_code);
+            if (func->is_c_code) {
+                int k = 0;
+                while (vm_builtins[k].name && vm_builtins[k].c_code != func->u.c_code) k++;
+                if (!vm_builtins[k].name) snapshot_fail(w, "C function", func->name? func->name: "(no name)");
+                snapshot_push_i(w, k);
+            } else snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_CODE, func->u.code));
+            snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_LIST, func->stack));
+            snapshot_push_dict(w, func->locals);
+            break;
+        }
+        case SNAPSHOT_CODE:
+            snapshot_write_code(w, ptr);
+            break;
+        case SNAPSHOT_CLASS: {
+            type_t *type = ptr;
+            cls_t *cls = type->data;
+            if (cls->vm != w->vm) snapshot_fail(w, "another VM's class", type->name);
+            snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_STR, (void *)type->name));
+            snapshot_push_dict(w, cls->class_attrs);
+            snapshot_push_dict(w, cls->class_getters);
+            snapshot_push_dict(w, cls->class_setters);
+            snapshot_push_dict(w, cls->getters);
+            snapshot_push_dict(w, cls->setters);
+            break;
+        }
+        case SNAPSHOT_ITERATOR: {
+            iterator_t *it = ptr;
+            snapshot_push_i(w, it->iteration);
+            snapshot_push_i(w, it->i);
+            snapshot_push_i(w, it->end);
+            switch (it->iteration) {
+                case ITER_RANGE: snapshot_push_i(w, it->data.range_start); break;
+                case ITER_STR: snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_STR, (void *)it->data.str)); break;
+                case ITER_LIST: snapshot_push_i(w, snapshot_ref(w, SNAPSHOT_LIST, it->data.list)); break;
+                case ITER_DICT_KEYS:
+                case ITER_DICT_VALUES:
+                case ITER_DICT_ITEMS: snapshot_push_dict(w, it->data.dict); break;
+                default: snapshot_fail(w, "iterator", get_iteration_name(it->iteration)); break;
+            }
+            break;
+        }
+        case SNAPSHOT_VM:
+        default:
+            break;
+    }
+}
+
+bool snapshot_write(vm_t *vm, const char *filename, const char *source, bool required) {
+    // Writes a snapshot of vm to filename, returning whether it could (if
+    // !required; otherwise, exits if it couldn't).
+    // If source is given, the snapshot is only loaded as long as that file
+    // is unchanged (see vm_create_from_snapshot).
+    struct snapshot_header header;
+    if (!snapshot_set_header(&header, source, vm->optimize)) {
+        if (required) {
+            fprintf(stderr, "Could not read snapshot source '%s'\n", source);
+            exit(1);
+        }
+        return false;
+    }
+
+    snapshot_writer_t w = { .vm = vm, .required = required, .ok = true };
+
+    // roots
+    snapshot_push_dict(&w, vm->globals);
+    snapshot_push_dict(&w, vm->str_cache);
+    snapshot_push_i(&w, snapshot_ref(&w, SNAPSHOT_LIST, vm->code_cache));
+    for (int i = 0; i < 256; i++) snapshot_push_obj(&w, vm->char_cache[i]);
+    int stack_size = vm_get_size(vm);
+    snapshot_push_i(&w, stack_size);
+    for (int i = 0; i < stack_size; i++) snapshot_push_obj(&w, vm->stack[i]);
+
+    int64_t instr_count = vm->instr_count;
+    buf_push(&w.buf, &instr_count, sizeof instr_count);
+
+    // nodes (NOTE: which add any nodes they point at as they go)
+    buf_t offsets = {0};
+    for (int i = 0; w.ok && i < w.n_nodes; i++) {
+        int32_t offset = sizeof header + w.buf.len;
+        buf_push(&offsets, &offset, sizeof offset);
+        snapshot_write_node(&w, i);
+    }
+    header.n_nodes = w.n_nodes;
+    header.nodes_offset = sizeof header + w.buf.len;
+    if (w.n_nodes) buf_push(&w.buf, offsets.data, offsets.len);
+    header.checksum = hash_chars(HASH_INIT, w.buf.data, w.buf.len);
+
+    bool ok = w.ok && write_file_atomically(filename, &header, sizeof header, &w.buf);
+    if (w.ok && !ok && required) {
+        fprintf(stderr, "Could not write snapshot '%s': ", filename);
+        perror(NULL);
+        exit(1);
+    }
+    free(offsets.data);
+    free(w.nodes);
+    free(w.kinds);
+    free(w.buckets);
+    free(w.buf.data);
+    return ok;
+}
+
+
+/****************
+* SNAPSHOT LOAD
+****************/
+
+// The nodes being loaded, which are kept alive by being in here until
+// they're reachable from the VM's roots
+typedef struct snapshot_nodes {
+    int n;
+    void *ptrs[];
+} snapshot_nodes_t;
+
+static void snapshot_nodes_trace(void *ptr) {
+    snapshot_nodes_t *nodes = ptr;
+    for (int i = 0; i < nodes->n; i++) gc_mark(nodes->ptrs[i]);
+}
+
+static gc_kind_t snapshot_nodes_gc_kind = {
+    .name = "snapshot nodes",
+    .trace = snapshot_nodes_trace,
+};
+
+typedef struct snapshot_loader {
+    vm_t *vm;
+    const char *mem;
+    const char *pos;
+    const char *end;
+    bool ok;
+    snapshot_nodes_t *nodes;
+    const snapshot_kind_t *kinds;
+} snapshot_loader_t;
+
+static int32_t snapshot_read_i(snapshot_loader_t *l) {
+    int32_t i = 0;
+    if ((size_t)(l->end - l->pos) < sizeof i) l->ok = false;
+    else {
+        memcpy(&i, l->pos, sizeof i);
+        l->pos += sizeof i;
+    }
+    return i;
+}
+
+static const void *snapshot_read(snapshot_loader_t *l, size_t size) {
+    // returns the next size bytes, or NULL if we ran out
+    if ((size_t)(l->end - l->pos) < size) {
+        l->ok = false;
+        return NULL;
+    }
+    const void *data = l->pos;
+    l->pos += size;
+    return data;
+}
+
+static void *snapshot_read_ref(snapshot_loader_t *l, snapshot_kind_t kind) {
+    // returns the node of the given kind which the next ref is to (or NULL)
+    int32_t i = snapshot_read_i(l);
+    if (i == -1) return NULL;
+    if (i < 0 || i >= l->nodes->n || l->kinds[i] != kind) {
+        l->ok = false;
+        return NULL;
+    }
+    return l->nodes->ptrs[i];
+}
+
+static bool snapshot_is_type(snapshot_loader_t *l, int i) {
+    // whether node i is a type_t
+    if (l->kinds[i] == SNAPSHOT_CLASS) return true;
+    if (l->kinds[i] != SNAPSHOT_STATIC) return false;
+    for (int k = 0; k < N_SNAPSHOT_STATIC_TYPES; k++) {
+        if (snapshot_statics[k] == l->nodes->ptrs[i]) return true;
+    }
+    return false;
+}
+
+static type_t *snapshot_read_type(snapshot_loader_t *l) {
+    int32_t i = snapshot_read_i(l);
+    if (i < 0 || i >= l->nodes->n || !snapshot_is_type(l, i)) {
+        l->ok = false;
+        return &null_type;
+    }
+    return l->nodes->ptrs[i];
+}
+
+static object_t *snapshot_read_obj(snapshot_loader_t *l) {
+    int64_t ref = 0;
+    const void *data = snapshot_read(l, sizeof ref);
+    if (data) memcpy(&ref, data, sizeof ref);
+    if (ref & 1) return OBJECT_FROM_INT((int)(ref >> 1));
+    int64_t i = ref / 2;
+    if (i < 0 || i >= l->nodes->n || (l->kinds[i] != SNAPSHOT_OBJECT &&
+        l->kinds[i] != SNAPSHOT_STR_OBJECT && l->kinds[i] != SNAPSHOT_STRVIEW_OBJECT &&
+        (l->kinds[i] != SNAPSHOT_STATIC || snapshot_is_type(l, i)))) {
+        l->ok = false;
+        return &static_null;
+    }
+    return l->nodes->ptrs[i];
+}
+
+static void *snapshot_create_node(snapshot_loader_t *l, snapshot_kind_t kind) {
+    // returns an empty node of the given kind, to be filled in by
+    // snapshot_load_node
+    switch (kind) {
+        case SNAPSHOT_STATIC: {
+            int k = snapshot_read_i(l);
+            if (k < 0 || k >= N_SNAPSHOT_STATICS) break;
+            return snapshot_statics[k];
+        }
+        case SNAPSHOT_STR: {
+            int32_t len = snapshot_read_i(l);
+            const char *s = len >= 0? snapshot_read(l, len + 1): NULL;
+            if (!s || s[len] != '\0') break;
+            return (void *)s;
+        }
+        case SNAPSHOT_OBJECT: return object_create(&null_type);
+        case SNAPSHOT_STR_OBJECT: return object_create_str("");
+        case SNAPSHOT_STRVIEW_OBJECT: return object_create_strview(NULL, 0, 0);
+        case SNAPSHOT_STRBUF: return strbuf_create();
+        case SNAPSHOT_LIST: return list_create();
+        case SNAPSHOT_DICT: return dict_create();
+        case SNAPSHOT_FUNC: return func_create(NULL);
+        case SNAPSHOT_CODE: return code_create(NULL, 0, 0, false);
+        case SNAPSHOT_CLASS: return object_create_cls(NULL, l->vm)->data.ptr;
+        case SNAPSHOT_ITERATOR: return iterator_create(ITER_RANGE, 0, (iterator_data_t){0});
+        case SNAPSHOT_VM: return l->vm;
+        default: break;
+    }
+    l->ok = false;
+    return NULL;
+}
+
+static void snapshot_load_code(snapshot_loader_t *l, code_t *code) {
+    code->filename = snapshot_read_ref(l, SNAPSHOT_STR);
+    code->row = snapshot_read_i(l);
+    code->col = snapshot_read_i(l);
+    code->is_func = snapshot_read_i(l);
+    code->scope = snapshot_read_ref(l, SNAPSHOT_CODE);
+
+    int n_locals = snapshot_read_i(l);
+    const void *locals = n_locals >= 0? snapshot_read(l, n_locals * sizeof(int32_t)): NULL;
+    int len = snapshot_read_i(l);
+    const void *bytecodes = len >= 0? snapshot_read(l, len): NULL;
+    int n_getter_caches = snapshot_read_i(l);
+    const char *caches = n_getter_caches >= 0? snapshot_read(l, n_getter_caches * 2 * sizeof(int32_t)): NULL;
+    int n_loops = snapshot_read_i(l);
+    const void *loops = n_loops >= 0? snapshot_read(l, n_loops * 4 * sizeof(int32_t)): NULL;
+    if (!locals || !bytecodes || !caches || !loops) {
+        l->ok = false;
+        return;
+    }
+
+    code->locals = malloc((n_locals + 1) * sizeof *code->locals);
+    code->bytecodes = malloc(len + 1);
+    code->getter_caches = calloc(n_getter_caches + 1, sizeof *code->getter_caches);
+    code->loops = malloc((n_loops + 1) * sizeof *code->loops);
+    if (!code->locals || !code->bytecodes || !code->getter_caches || !code->loops) {
+        fprintf(stderr, "Failed to allocate snapshot code\n");
+        exit(1);
+    }
+    code->n_locals = n_locals;
+    memcpy(code->locals, locals, n_locals * sizeof *code->locals);
+    code->len = code->size = len;
+    memcpy(code->bytecodes, bytecodes, len);
+    code->n_getter_caches = n_getter_caches;
+    for (int j = 0; j < n_getter_caches; j++) {
+        int32_t hash_sym[2];
+        memcpy(hash_sym, caches + j * sizeof hash_sym, sizeof hash_sym);
+        code->getter_caches[j].hash = hash_sym[0];
+        code->getter_caches[j].sym = hash_sym[1];
+    }
+    code->n_loops = n_loops;
+    memcpy(code->loops, loops, n_loops * sizeof *code->loops);
+}
+
+static void snapshot_load_node(snapshot_loader_t *l, snapshot_kind_t kind, void *ptr) {
+    // fills in the node created by snapshot_create_node
+    // NOTE: a collection can happen while we're doing this, so anything we
+    // make point at a young block needs a write barrier
+    switch (kind) {
+        case SNAPSHOT_OBJECT: {
+            object_t *obj = ptr;
+            type_t *type = snapshot_read_type(l);
+            snapshot_kind_t data_kind =
+                type == &str_type || type == &strview_type? N_SNAPSHOT_KINDS: // (see SNAPSHOT_STR_OBJECT)
+                type == &strbuf_type? SNAPSHOT_STRBUF:
+                type == &list_type? SNAPSHOT_LIST:
+                type == &func_type? SNAPSHOT_FUNC:
+                type == &iterator_type? SNAPSHOT_ITERATOR:
+                type == &vm_type? SNAPSHOT_VM:
+                type == &type_type? SNAPSHOT_CLASS: // (or a static type, see below)
+                SNAPSHOT_DICT; // dicts & class instances
+            int32_t i = snapshot_read_i(l);
+            if (i < 0 || i >= l->nodes->n || (data_kind == SNAPSHOT_CLASS?
+                !snapshot_is_type(l, i): l->kinds[i] != data_kind)) {
+                l->ok = false;
+                break;
+            }
+            gc_write_barrier(obj, l->nodes->ptrs[i]);
+            obj->data.ptr = l->nodes->ptrs[i];
+            gc_write_barrier(obj, type);
+            obj->type = type;
+            break;
+        }
+        case SNAPSHOT_STR_OBJECT: {
+            int32_t i = snapshot_read_i(l);
+            if (i < 0 || i >= l->nodes->n || l->kinds[i] != SNAPSHOT_STR) {
+                l->ok = false;
+                break;
+            }
+            str_t *str = ptr;
+            str->object.data.ptr = l->nodes->ptrs[i];
+            str->len = strlen(l->nodes->ptrs[i]);
+            break;
+        }
+        case SNAPSHOT_STRVIEW_OBJECT: {
+            // NOTE: start and len get checked once the str is loaded too
+            strview_t *view = ptr;
+            object_t *str = snapshot_read_obj(l);
+            if (OBJECT_IS_INT(str) || str->type != &str_type) {
+                l->ok = false;
+                break;
+            }
+            gc_write_barrier(view, str);
+            view->object.data.ptr = str;
+            view->start = snapshot_read_i(l);
+            view->len = snapshot_read_i(l);
+            break;
+        }
+        case SNAPSHOT_STRBUF: {
+            // NOTE: copied out of the mapping, since strbufs get changed
+            int len = snapshot_read_i(l);
+            const char *chars = len >= 0? snapshot_read(l, len): NULL;
+            if (!chars) {
+                l->ok = false;
+                break;
+            }
+            strbuf_append(ptr, chars, len);
+            break;
+        }
+        case SNAPSHOT_LIST: {
+            int len = snapshot_read_i(l);
+            for (int j = 0; l->ok && j < len; j++) list_push(ptr, snapshot_read_obj(l));
+            break;
+        }
+        case SNAPSHOT_DICT: {
+            int len = snapshot_read_i(l);
+            for (int j = 0; l->ok && j < len; j++) {
+                const char *name = snapshot_read_ref(l, SNAPSHOT_STR);
+                object_t *value = snapshot_read_obj(l);
+                if (name) dict_set(ptr, name, value);
+                else l->ok = false;
+            }
+            break;
+        }
+        case SNAPSHOT_FUNC: {
+            func_t *func = ptr;
+            func->name = snapshot_read_ref(l, SNAPSHOT_STR);
+            func->is_c_code = snapshot_read_i(l);
+            if (func->is_c_code) {
+                int k = snapshot_read_i(l);
+                int n_builtins = 0;
+                while (vm_builtins[n_builtins].name) n_builtins++;
+                if (k >= 0 && k < n_builtins) func->u.c_code = vm_builtins[k].c_code;
+                else l->ok = false;
+            } else {
+                func->u.code = snapshot_read_ref(l, SNAPSHOT_CODE);
+                if (!func->u.code) l->ok = false;
+            }
+            list_t *stack = snapshot_read_ref(l, SNAPSHOT_LIST);
+            dict_t *locals = snapshot_read_ref(l, SNAPSHOT_DICT);
+            gc_write_barrier(func, stack);
+            func->stack = stack;
+            gc_write_barrier(func, locals);
+            func->locals = locals;
+            break;
+        }
+        case SNAPSHOT_CODE:
+            snapshot_load_code(l, ptr);
+            break;
+        case SNAPSHOT_CLASS: {
+            type_t *type = ptr;
+            cls_t *cls = type->data;
+            type->name = snapshot_read_ref(l, SNAPSHOT_STR);
+            dict_t **dicts[] = {
+                &cls->class_attrs, &cls->class_getters, &cls->class_setters,
+                &cls->getters, &cls->setters,
+            };
+            for (int j = 0; j < 5; j++) {
+                dict_t *dict = snapshot_read_ref(l, SNAPSHOT_DICT);
+                if (!dict) l->ok = false;
+                else {
+                    gc_write_barrier(cls, dict);
+                    *dicts[j] = dict;
+                }
+            }
+            break;
+        }
+        case SNAPSHOT_ITERATOR: {
+            iterator_t *it = ptr;
+            iteration_t iteration = snapshot_read_i(l);
+            it->i = snapshot_read_i(l);
+            it->end = snapshot_read_i(l);
+            void *data = NULL;
+            switch (iteration) {
+                case ITER_RANGE: it->data.range_start = snapshot_read_i(l); break;
+                case ITER_STR: data = snapshot_read_ref(l, SNAPSHOT_STR); break;
+                case ITER_LIST: data = snapshot_read_ref(l, SNAPSHOT_LIST); break;
+                case ITER_DICT_KEYS:
+                case ITER_DICT_VALUES:
+                case ITER_DICT_ITEMS: data = snapshot_read_ref(l, SNAPSHOT_DICT); break;
+                default: l->ok = false; break;
+            }
+            if (iteration != ITER_RANGE) {
+                if (!data) l->ok = false;
+                gc_write_barrier(it, data);
+                if (iteration == ITER_STR) it->data.str = data;
+                else if (iteration == ITER_LIST) it->data.list = data;
+                else it->data.dict = data;
+            }
+            it->iteration = iteration;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+bool snapshot_load(vm_t *vm, const char *filename, const char *source, bool optimize) {
+    // Loads vm's globals, caches and stack from a snapshot written by
+    // snapshot_write, returning false if it doesn't exist, or if source
+    // was given and has changed since (or optimize has).
+    struct snapshot_header expected;
+    if (!snapshot_set_header(&expected, source, optimize)) return false;
+    size_t size;
+    const char *mem = map_file(filename, sizeof expected, &size);
+    if (!mem) return false;
+
+    struct snapshot_header header;
+    memcpy(&header, mem, sizeof header);
+    expected.n_nodes = header.n_nodes;
+    expected.nodes_offset = header.nodes_offset;
+    expected.checksum = hash_chars(HASH_INIT, mem + sizeof header, size - sizeof header);
+    if (
+        memcmp(&header, &expected, sizeof header) ||
+        header.n_nodes < 0 || header.nodes_offset < (int32_t)sizeof header ||
+        (int64_t)size - header.nodes_offset != (int64_t)header.n_nodes * (int64_t)sizeof(int32_t)
+    ) {
+        unmap_file(mem, size);
+        return false;
+    }
+
+    snapshot_loader_t l = {
+        .vm = vm,
+        .mem = mem,
+        .end = mem + header.nodes_offset,
+        .ok = true,
+    };
+    int n_nodes = header.n_nodes;
+    snapshot_nodes_t *nodes = gc_alloc(sizeof *nodes + n_nodes * sizeof *nodes->ptrs, &snapshot_nodes_gc_kind);
+    snapshot_kind_t *kinds = malloc((n_nodes + 1) * sizeof *kinds);
+    if (!kinds) {
+        fprintf(stderr, "Failed to allocate snapshot kinds\n");
+        exit(1);
+    }
+    l.nodes = nodes;
+    l.kinds = kinds;
+
+    // create them all first, since they can point at each other in any
+    // order...
+    const char *offsets = mem + header.nodes_offset;
+    for (int i = 0; l.ok && i < n_nodes; i++) {
+        int32_t offset;
+        memcpy(&offset, offsets + i * sizeof offset, sizeof offset);
+        if (offset < (int32_t)sizeof header || offset >= header.nodes_offset) {
+            l.ok = false;
+            break;
+        }
+        l.pos = l.mem + offset;
+        kinds[i] = snapshot_read_i(&l);
+        if (kinds[i] < 0 || kinds[i] >= N_SNAPSHOT_KINDS) l.ok = false;
+        if (!l.ok) break;
+        void *ptr = snapshot_create_node(&l, kinds[i]);
+        nodes->ptrs[i] = ptr;
+        nodes->n = i + 1;
+        gc_write_barrier(nodes, ptr);
+    }
+
+    // ...then fill them in
+    for (int i = 0; l.ok && i < n_nodes; i++) {
+        int32_t offset;
+        memcpy(&offset, offsets + i * sizeof offset, sizeof offset);
+        l.pos = l.mem + offset + sizeof(int32_t);
+        if (kinds[i] == SNAPSHOT_STATIC || kinds[i] == SNAPSHOT_STR) continue;
+        snapshot_load_node(&l, kinds[i], nodes->ptrs[i]);
+    }
+
+    // roots
+    if (l.ok) {
+        l.pos = l.mem + sizeof header;
+        vm->globals = snapshot_read_ref(&l, SNAPSHOT_DICT);
+        vm->str_cache = snapshot_read_ref(&l, SNAPSHOT_DICT);
+        vm->code_cache = snapshot_read_ref(&l, SNAPSHOT_LIST);
+        for (int i = 0; i < 256; i++) vm->char_cache[i] = snapshot_read_obj(&l);
+        int stack_size = snapshot_read_i(&l);
+        for (int i = 0; l.ok && i < stack_size; i++) vm_push(vm, snapshot_read_obj(&l));
+        const void *instr_count = snapshot_read(&l, sizeof(int64_t));
+        if (instr_count) memcpy(&vm->instr_count, instr_count, sizeof(int64_t));
+        if (!vm->globals || !vm->str_cache || !vm->code_cache) l.ok = false;
+    }
+    for (int i = 0; l.ok && i < n_nodes; i++) {
+        if (kinds[i] != SNAPSHOT_STRVIEW_OBJECT) continue;
+        strview_t *view = nodes->ptrs[i];
+        int len = str_get_len(view->object.data.ptr);
+        if (view->start < 0 || view->len < 0 || view->start > len - view->len) l.ok = false;
+    }
+    for (int i = 0; l.ok && i < vm->str_cache->len; i++) {
+        // (see str_t)
+        object_t *obj = vm->str_cache->items[i].value;
+        if (OBJECT_IS_INT(obj) || obj->type != &str_type ||
+            obj->data.ptr != vm->str_cache->items[i].name
+        ) {
+            l.ok = false;
+            break;
+        }
+        str_set_hash(obj, vm->str_cache->items[i].hash);
+        ((str_t *)obj)->interned = true;
+        vm->str_cache_max_len = MAX(vm->str_cache_max_len, str_get_len(obj));
+    }
+
+    free(kinds);
+    if (!l.ok) {
+        unmap_file(mem, size);
+        vm->stack_top = vm->stack - 1;
+    }
+    // NOTE: otherwise, the mapping stays, since our strs are in it
+    return l.ok;
+}
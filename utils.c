@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lalang.h"
 
@@ -13,10 +18,14 @@ void print_tabs(int depth, FILE *file) {
 
 
 void print_string_quoted(const char *s) {
-    int len = strlen(s);
+    print_chars_quoted(s, strlen(s));
+}
+
+void print_chars_quoted(const char *s, int len) {
+    // like print_string_quoted, for chars which aren't NUL-terminated
     putc('"', stdout);
-    const char *s1 = s;
-    for (char c; c = *s; s++) {
+    for (int i = 0; i < len; i++) {
+        char c = s[i];
         if (c == '"') fputs("\\\"", stdout);
         else if (c == '\n') fputs("\\n", stdout);
         else putc(c, stdout);
@@ -88,3 +97,106 @@ int get_index(int i, int len, const char *type_name) {
     }
     return i;
 }
+
+
+unsigned hash_string(const char *s) {
+    // FNV-1a
+    unsigned hash = HASH_INIT;
+    for (unsigned char c; c = *s; s++) {
+        hash ^= c;
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+uint32_t hash_chars(uint32_t hash, const void *data, size_t len) {
+    // like hash_string, for len bytes which aren't NUL-terminated, carrying
+    // on from hash (so start with HASH_INIT)
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+
+void buf_push(buf_t *buf, const void *data, size_t size) {
+    if (buf->len + size > buf->size) {
+        size_t new_size = MAX(buf->len + size, buf->size? buf->size * 2: 1024);
+        char *new_data = realloc(buf->data, new_size);
+        if (!new_data) {
+            fprintf(stderr, "Failed to grow buffer to %zu bytes\n", new_size);
+            exit(1);
+        }
+        buf->data = new_data;
+        buf->size = new_size;
+    }
+    memcpy(buf->data + buf->len, data, size);
+    buf->len += size;
+}
+
+void buf_push_i(buf_t *buf, int32_t i) {
+    buf_push(buf, &i, sizeof i);
+}
+
+
+bool file_stamp_set(file_stamp_t *stamp, const char *filename, const char *text) {
+    // fills in stamp for filename, whose contents are text (or are read in,
+    // if text is NULL), returning false if filename can't be read
+    struct stat st;
+    if (stat(filename, &st)) return false;
+    char *read = NULL;
+    if (!text && !(text = read = read_file(filename, false))) return false;
+    stamp->hash = hash_string(text);
+    stamp->mtime = st.st_mtime;
+    stamp->size = st.st_size;
+    free(read);
+    return true;
+}
+
+bool write_file_atomically(const char *filename, const void *header, size_t header_size, const buf_t *buf) {
+    // writes header and then buf to filename, returning false (with errno
+    // set) if it couldn't
+    // NOTE: it's written to a temporary file which is then renamed, so that
+    // nobody ever reads half of it
+    char *tmp_path = malloc(strlen(filename) + 32);
+    if (!tmp_path) {
+        fprintf(stderr, "Failed to allocate temporary path for '%s'\n", filename);
+        exit(1);
+    }
+    sprintf(tmp_path, "%s.%i.tmp", filename, (int)getpid());
+    FILE *file = fopen(tmp_path, "wb");
+    bool ok = file
+        && fwrite(header, header_size, 1, file) == 1
+        && fwrite(buf->data, 1, buf->len, file) == buf->len;
+    if (file && fclose(file)) ok = false;
+    if (ok && rename(tmp_path, filename)) ok = false;
+    if (!ok && file) {
+        int err = errno;
+        remove(tmp_path);
+        errno = err;
+    }
+    free(tmp_path);
+    return ok;
+}
+
+const void *map_file(const char *filename, size_t min_size, size_t *size) {
+    // maps filename in read-only, returning NULL if it doesn't exist or is
+    // smaller than min_size, and otherwise setting *size
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size >= (off_t)min_size && st.st_size > 0) {
+        mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) return NULL;
+    *size = st.st_size;
+    return mem;
+}
+
+void unmap_file(const void *mem, size_t size) {
+    munmap((void *)mem, size);
+}
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #ifndef _NO_DLOPEN_
 #include <dlfcn.h>
@@ -25,7 +26,7 @@ void builtin_if(vm_t *vm) {
     object_t *if_obj = vm_pop(vm);
     object_t *cond_obj = vm_pop(vm);
     if (object_to_bool(cond_obj)) {
-        object_getter(if_obj, "@", vm);
+        object_method(if_obj, SYM_CALL, "@", vm);
     }
 }
 
@@ -34,42 +35,54 @@ void builtin_ifelse(vm_t *vm) {
     object_t *if_obj = vm_pop(vm);
     object_t *cond_obj = vm_pop(vm);
     if (object_to_bool(cond_obj)) {
-        object_getter(if_obj, "@", vm);
+        object_method(if_obj, SYM_CALL, "@", vm);
     } else {
-        object_getter(else_obj, "@", vm);
+        object_method(else_obj, SYM_CALL, "@", vm);
     }
 }
 
+static bool vm_loop_unwind(vm_t *vm) {
+    // called by loops after running code which may have done @break,
+    // @continue or @return: handles the first two, and returns whether to
+    // stop looping
+    unwind_t unwind = vm->unwind;
+    if (unwind == UNWIND_BREAK || unwind == UNWIND_CONTINUE) vm->unwind = UNWIND_NONE;
+    return unwind == UNWIND_BREAK || unwind == UNWIND_RETURN;
+}
+
 void builtin_while(vm_t *vm) {
     object_t *body_obj = vm_pop(vm);
     object_t *cond_func_obj = vm_pop(vm);
     while (true) {
-        object_getter(cond_func_obj, "@", vm);
+        object_method(cond_func_obj, SYM_CALL, "@", vm);
+        if (vm->unwind && vm_loop_unwind(vm)) break;
         object_t *cond_obj = vm_pop(vm);
         if (!object_to_bool(cond_obj)) break;
-        object_getter(body_obj, "@", vm);
+        object_method(body_obj, SYM_CALL, "@", vm);
+        if (vm->unwind && vm_loop_unwind(vm)) break;
     }
 }
 
 void builtin_iter(vm_t *vm) {
     object_t *obj = vm_pop(vm);
-    object_getter(obj, "__iter__", vm);
+    object_method(obj, SYM_ITER, "__iter__", vm);
 }
 
 void builtin_next(vm_t *vm) {
     object_t *obj = vm_pop(vm);
-    object_getter(obj, "__next__", vm);
+    object_method(obj, SYM_NEXT, "__next__", vm);
 }
 
 void builtin_for(vm_t *vm) {
     object_t *obj_it = vm_pop(vm);
     object_t *body_obj = vm_pop(vm);
-    object_getter(obj_it, "__iter__", vm);
+    object_method(obj_it, SYM_ITER, "__iter__", vm);
     obj_it = vm_pop(vm);
     object_t *next_obj;
     while (next_obj = object_next(obj_it, vm)) {
         vm_push(vm, next_obj);
-        object_getter(body_obj, "@", vm);
+        object_method(body_obj, SYM_CALL, "@", vm);
+        if (vm->unwind && vm_loop_unwind(vm)) break;
     }
 }
 
@@ -96,12 +109,12 @@ void builtin_globals(vm_t *vm) {
 }
 
 void builtin_locals(vm_t *vm) {
-    vm_push(vm, vm->locals? object_create_dict(vm->locals): &static_null);
+    vm_push(vm, vm->locals? object_create_dict(locals_to_dict(vm->locals, vm)): &static_null);
 }
 
 void builtin_typeof(vm_t *vm) {
     object_t *self = vm_pop(vm);
-    vm_push(vm, object_create_type(self->type));
+    vm_push(vm, object_create_type(object_type(self)));
 }
 
 void builtin_print(vm_t *vm) {
@@ -153,13 +166,17 @@ void builtin_readline(vm_t *vm) {
         perror(NULL);
         exit(1);
     }
-    vm_push(vm, vm_get_or_create_str(vm, line));
+    vm_push(vm, vm_get_or_create_str(vm, gc_strdup(line)));
+    free(line);
 }
 
 void builtin_readfile(vm_t *vm) {
     const char *filename = object_to_str(vm_pop(vm));
     char *text = read_file(filename, false);
-    vm_push(vm, text? vm_get_or_create_str(vm, text): &static_null);
+    if (text) {
+        vm_push(vm, vm_get_or_create_str(vm, gc_strdup(text)));
+        free(text);
+    } else vm_push(vm, &static_null);
 }
 
 void builtin_eval(vm_t *vm) {
@@ -183,6 +200,22 @@ void builtin_eval2(vm_t *vm) {
     vm_eval_text(vm, text, filename);
 }
 
+void builtin_includefile(vm_t *vm) {
+    const char *const_filename = object_to_str(vm_pop(vm));
+    // NOTE: our code keeps pointing at its filename
+    char *filename = strdup(const_filename);
+    if (!filename) {
+        fprintf(stderr, "Couldn't duplicate filename for includefile\n");
+        exit(1);
+    }
+    vm_push(vm, vm_include(vm, filename, false)? &static_true: &static_false);
+}
+
+void builtin_snapshot(vm_t *vm) {
+    const char *const_filename = object_to_str(vm_pop(vm));
+    snapshot_write(vm, const_filename, NULL, true);
+}
+
 void builtin_dlsym(vm_t *vm) {
     const char *sym_name = object_to_str(vm_pop(vm));
     const char *filename = object_to_str(vm_pop(vm));
@@ -223,11 +256,11 @@ void builtin_dlsym(vm_t *vm) {
 
 void builtin_error(vm_t *vm) {
     object_t *obj = vm_pop(vm);
-    if (obj->type == &str_type) {
+    if (object_type(obj) == &str_type) {
         const char *s = obj->data.ptr;
         printf("ERROR: %s\n", s);
     } else {
-        printf("ERROR: <'%s' object at %p>\n", obj->type->name, obj);
+        printf("ERROR: <'%s' object at %p>\n", object_type(obj)->name, obj);
     }
     exit(1);
 }
@@ -266,6 +299,44 @@ bool vm_getter(object_t *self, const char *name, vm_t *vm) {
         vm_push(vm, object_create_bool(self_vm->debug_print_stack));
     } else if (!strcmp(name, "print_eval")) {
         vm_push(vm, object_create_bool(self_vm->debug_print_eval));
+    } else if (!strcmp(name, "jit")) {
+        vm_push(vm, object_create_bool(self_vm->jit));
+    } else if (!strcmp(name, "instr_count")) {
+        // NOTE: our ints are only 32 bits, so this sticks at INT_MAX rather
+        // than wrapping around
+        long instr_count = MIN(self_vm->instr_count, INT_MAX);
+        vm_push(vm, vm_get_or_create_int(vm, instr_count));
+    } else if (!strcmp(name, "collect")) {
+        gc_collect();
+    } else if (!strcmp(name, "gc_threshold")) {
+        vm_push(vm, vm_get_or_create_int(vm, gc.threshold));
+    } else if (!strcmp(name, "gc_collections")) {
+        vm_push(vm, vm_get_or_create_int(vm, gc.collections));
+    } else if (!strcmp(name, "gc_minor_collections")) {
+        vm_push(vm, vm_get_or_create_int(vm, gc.minor_collections));
+    } else if (!strcmp(name, "gc_reclaimed")) {
+        vm_push(vm, vm_get_or_create_int(vm, gc.reclaimed));
+    } else if (!strcmp(name, "gc_live")) {
+        vm_push(vm, vm_get_or_create_int(vm, gc.live));
+    } else if (!strcmp(name, "gc_blocks")) {
+        vm_push(vm, vm_get_or_create_int(vm, gc.n_blocks));
+    } else if (!strcmp(name, "gc_pools")) {
+        // [size count] pairs for each pool with free blocks in it
+        // NOTE: we copy the counts first, since creating the list may take
+        // blocks from the pools
+        long pool_blocks[GC_N_POOLS];
+        memcpy(pool_blocks, gc.pool_blocks, sizeof pool_blocks);
+        list_t *list = list_create();
+        for (int i = 0; i < GC_N_POOLS; i++) {
+            if (!pool_blocks[i]) continue;
+            list_t *pair = list_create();
+            list_push(pair, vm_get_or_create_int(vm, i * 16));
+            list_push(pair, vm_get_or_create_int(vm, pool_blocks[i]));
+            list_push(list, object_create_list(pair));
+        }
+        vm_push(vm, object_create_list(list));
+    } else if (!strcmp(name, "gc_pool_bytes")) {
+        vm_push(vm, vm_get_or_create_int(vm, gc.pool_bytes));
     } else return false;
     return true;
 }
@@ -281,6 +352,10 @@ bool vm_setter(object_t *self, const char *name, vm_t *vm) {
         self_vm->debug_print_stack = object_to_bool(vm_pop(vm));
     } else if (!strcmp(name, "print_eval")) {
         self_vm->debug_print_eval = object_to_bool(vm_pop(vm));
+    } else if (!strcmp(name, "jit")) {
+        self_vm->jit = object_to_bool(vm_pop(vm));
+    } else if (!strcmp(name, "gc_threshold")) {
+        gc.threshold = object_to_int(vm_pop(vm));
     } else return false;
     return true;
 }
@@ -357,17 +432,76 @@ void vm_push(vm_t *vm, object_t *obj) {
     *(++vm->stack_top) = obj;
 }
 
+static void vm_grow_global_slots(vm_t *vm, int n) {
+    // make sure there's a global slot for each of the first n strings in
+    // vm->str_cache
+    if (n <= vm->n_global_slots) return;
+    int new_n = MAX(n, vm->n_global_slots * 2);
+    global_slot_t *new_slots = realloc(vm->global_slots, new_n * sizeof *new_slots);
+    if (!new_slots) {
+        fprintf(stderr, "Failed to allocate %i global slots\n", new_n);
+        exit(1);
+    }
+    for (int i = vm->n_global_slots; i < new_n; i++) {
+        new_slots[i] = (global_slot_t){ .i = -1, .name = NULL };
+    }
+    vm->global_slots = new_slots;
+    vm->n_global_slots = new_n;
+}
+
+dict_item_t *vm_get_global_item(vm_t *vm, int j) {
+    // returns the item of vm->globals named by vm->str_cache index j, or NULL
+    dict_t *globals = vm->globals;
+    global_slot_t *slot = &vm->global_slots[j];
+    int i = slot->i;
+    if (i >= 0 && i < globals->len && globals->items[i].name == slot->name) {
+        return &globals->items[i];
+    }
+    dict_item_t *name_item = &vm->str_cache->items[j];
+    dict_item_t *item = dict_get_item_hashed(globals, name_item->name, name_item->hash);
+    if (item) {
+        slot->i = item - globals->items;
+        slot->name = item->name;
+    }
+    return item;
+}
+
+static int vm_add_cached_str(vm_t *vm, const char *s, unsigned hash) {
+    // adds s, which mustn't be cached yet, to vm->str_cache, returning its
+    // index
+    dict_t *dict = vm->str_cache;
+    object_t *obj = object_create_str(s);
+    str_set_hash(obj, hash);
+    ((str_t *)obj)->interned = true;
+    vm->str_cache_max_len = MAX(vm->str_cache_max_len, str_get_len(obj));
+    dict_set_hashed(dict, s, hash, obj);
+    vm_grow_global_slots(vm, dict->len);
+    return dict->len - 1;
+}
+
 int vm_get_cached_str_i(vm_t *vm, const char *s) {
-    // returns the index of a cached str object, creating it if necessary
+    // returns the index of a cached str object, creating it (and keeping s)
+    // if necessary
     dict_t *dict = vm->str_cache;
-    dict_item_t *item = dict_get_item(dict, s);
-    if (item) {
-        return item - dict->items;
-    } else {
-        object_t *obj = object_create_str(s);
-        dict_set(dict, s, obj);
-        return dict->len - 1;
+    unsigned hash = hash_string(s);
+    dict_item_t *item = dict_get_item_hashed(dict, s, hash);
+    if (item) return item - dict->items;
+    return vm_add_cached_str(vm, s, hash);
+}
+
+int vm_intern_str_i(vm_t *vm, const char *s) {
+    // like vm_get_cached_str_i, except that s is copied if it needs to be
+    // cached, so e.g. it can point into text being compiled
+    dict_t *dict = vm->str_cache;
+    unsigned hash = hash_string(s);
+    dict_item_t *item = dict_get_item_hashed(dict, s, hash);
+    if (item) return item - dict->items;
+    char *s2 = strdup(s);
+    if (!s2) {
+        fprintf(stderr, "Failed to allocate cached string: %s\n", s);
+        exit(1);
     }
+    return vm_add_cached_str(vm, s2, hash);
 }
 
 object_t *vm_get_cached_str(vm_t *vm, const char *s) {
@@ -376,16 +510,32 @@ object_t *vm_get_cached_str(vm_t *vm, const char *s) {
     return vm->str_cache->items[i].value;
 }
 
-// Only bother caching strings of this length or less
-#define MAX_CACHED_STR_LEN 16
-
 object_t *vm_get_or_create_str(vm_t *vm, const char *s) {
     // returns a cached str object, or a fresh (uncached) one
-    if (strlen(s) < MAX_CACHED_STR_LEN) {
-        object_t *obj = dict_get(vm->str_cache, s);
-        if (obj) return obj;
-    }
-    return object_create_str(s);
+    return vm_get_or_create_str_len(vm, s, strlen(s));
+}
+
+object_t *vm_get_or_create_str_len(vm_t *vm, const char *s, int len) {
+    // like vm_get_or_create_str, for when the caller already knows strlen(s)
+    // NOTE: a str longer than everything in vm->str_cache can't be in it,
+    // so we don't bother hashing it (e.g. the results of lots of "+")
+    if (len > vm->str_cache_max_len) return object_create_str_len(s, len);
+    unsigned hash = hash_string(s);
+    dict_item_t *item = dict_get_item_hashed(vm->str_cache, s, hash);
+    if (item) return item->value;
+    object_t *obj = object_create_str_len(s, len);
+    str_set_hash(obj, hash);
+    return obj;
+}
+
+object_t *vm_get_or_create_str_hashed(vm_t *vm, const char *s, unsigned hash) {
+    // like vm_get_or_create_str, for when the caller already has
+    // hash_string(s)
+    dict_item_t *item = dict_get_item_hashed(vm->str_cache, s, hash);
+    if (item) return item->value;
+    object_t *obj = object_create_str(s);
+    str_set_hash(obj, hash);
+    return obj;
 }
 
 object_t *vm_get_char_str(vm_t *vm, char c) {
@@ -393,13 +543,8 @@ object_t *vm_get_char_str(vm_t *vm, char c) {
 }
 
 object_t *vm_get_or_create_int(vm_t *vm, int i) {
-    if (i >= VM_MIN_CACHED_INT && i <= VM_MAX_CACHED_INT) {
-        return vm->int_cache[i - VM_MIN_CACHED_INT];
-    } else {
-        object_t *obj = object_create(&int_type);
-        obj->data.i = i;
-        return obj;
-    }
+    // ints are never allocated, see OBJECT_FROM_INT
+    return OBJECT_FROM_INT(i);
 }
 
 void vm_set_builtin(vm_t *vm, const char *name, c_code_t *c_code) {
@@ -412,12 +557,63 @@ void vm_push_code(vm_t *vm, code_t *code) {
     list_push(vm->code_cache, object_create_func(func));
 }
 
-void vm_init(vm_t *vm) {
+// The builtins, i.e. C function globals (NOTE: snapshots refer to these by
+// index, see snapshot.c)
+builtin_t vm_builtins[] = {
+    {"is", &builtin_is},
+    {"if", &builtin_if},
+    {"ifelse", &builtin_ifelse},
+    {"while", &builtin_while},
+    {"iter", &builtin_iter},
+    {"next", &builtin_next},
+    {"for", &builtin_for},
+    {"range", &builtin_range},
+    {"pair", &builtin_pair},
+    {"globals", &builtin_globals},
+    {"locals", &builtin_locals},
+    {"typeof", &builtin_typeof},
+    {"print", &builtin_print},
+    {"print_inline", &builtin_print_inline},
+    {"dup", &builtin_dup},
+    {"drop", &builtin_drop},
+    {"swap", &builtin_swap},
+    {"get", &builtin_get},
+    {"set", &builtin_set},
+    {"clear", &builtin_clear},
+    {"print_stack", &vm_print_stack},
+    {"readline", &builtin_readline},
+    {"readfile", &builtin_readfile},
+    {"eval", &builtin_eval},
+    {"eval2", &builtin_eval2},
+    {"includefile", &builtin_includefile},
+    {"snapshot", &builtin_snapshot},
+    {"dlsym", &builtin_dlsym},
+    {"error", &builtin_error},
+    {"class", &builtin_class},
+    {NULL, NULL},
+};
+
+static void vm_init_stacks(vm_t *vm) {
     // initialize stack
     vm->stack_top = vm->stack - 1;
+    vm->slots_top = vm->slots;
+    vm->iters_top = vm->iters - 1;
+    vm->optimize = true;
+    vm->jit = false;
+    vm->lalac = false;
+    vm->frames = malloc(VM_FRAMES_SIZE * sizeof *vm->frames);
+    if (!vm->frames) {
+        fprintf(stderr, "Failed to allocate VM frames\n");
+        exit(1);
+    }
+    vm->frames_top = vm->frames - 1;
 
     // initialize locals
     vm->locals = NULL;
+}
+
+void vm_init(vm_t *vm) {
+    vm_init_stacks(vm);
 
     // initialize globals
     vm->globals = dict_create();
@@ -429,6 +625,8 @@ void vm_init(vm_t *vm) {
     dict_set(vm->globals, "bool", object_create_type(&bool_type));
     dict_set(vm->globals, "int", object_create_type(&int_type));
     dict_set(vm->globals, "str", object_create_type(&str_type));
+    dict_set(vm->globals, "strview", object_create_type(&strview_type));
+    dict_set(vm->globals, "strbuf", object_create_type(&strbuf_type));
     dict_set(vm->globals, "list", object_create_type(&list_type));
     dict_set(vm->globals, "dict", object_create_type(&dict_type));
     dict_set(vm->globals, "iterator", object_create_type(&iterator_type));
@@ -436,38 +634,11 @@ void vm_init(vm_t *vm) {
     dict_set(vm->globals, "vm", object_create_vm(vm));
 
     // initialize builtins (i.e. C function globals)
-    vm_set_builtin(vm, "is", &builtin_is);
-    vm_set_builtin(vm, "if", &builtin_if);
-    vm_set_builtin(vm, "ifelse", &builtin_ifelse);
-    vm_set_builtin(vm, "while", &builtin_while);
-    vm_set_builtin(vm, "iter", &builtin_iter);
-    vm_set_builtin(vm, "next", &builtin_next);
-    vm_set_builtin(vm, "for", &builtin_for);
-    vm_set_builtin(vm, "range", &builtin_range);
-    vm_set_builtin(vm, "pair", &builtin_pair);
-    vm_set_builtin(vm, "globals", &builtin_globals);
-    vm_set_builtin(vm, "locals", &builtin_locals);
-    vm_set_builtin(vm, "typeof", &builtin_typeof);
-    vm_set_builtin(vm, "print", &builtin_print);
-    vm_set_builtin(vm, "print_inline", &builtin_print_inline);
-    vm_set_builtin(vm, "dup", &builtin_dup);
-    vm_set_builtin(vm, "drop", &builtin_drop);
-    vm_set_builtin(vm, "swap", &builtin_swap);
-    vm_set_builtin(vm, "get", &builtin_get);
-    vm_set_builtin(vm, "set", &builtin_set);
-    vm_set_builtin(vm, "clear", &builtin_clear);
-    vm_set_builtin(vm, "print_stack", &vm_print_stack);
-    vm_set_builtin(vm, "readline", &builtin_readline);
-    vm_set_builtin(vm, "readfile", &builtin_readfile);
-    vm_set_builtin(vm, "eval", &builtin_eval);
-    vm_set_builtin(vm, "eval2", &builtin_eval2);
-    vm_set_builtin(vm, "dlsym", &builtin_dlsym);
-    vm_set_builtin(vm, "error", &builtin_error);
-    vm_set_builtin(vm, "class", &builtin_class);
-
-    // initialize int cache
-    for (int i = VM_MIN_CACHED_INT; i <= VM_MAX_CACHED_INT; i++) {
-        vm->int_cache[i - VM_MIN_CACHED_INT] = object_create_int(i);
+    for (builtin_t *builtin = vm_builtins; builtin->name; builtin++) {
+        vm_set_builtin(vm, builtin->name, builtin->c_code);
+    }
+    for (int i = 0; i < N_INLINE_BUILTINS; i++) {
+        vm->inline_builtins[i] = dict_get(vm->globals, inline_builtin_names[i]);
     }
 
     // initialize str cache (i.e. the "string pool")
@@ -499,9 +670,56 @@ vm_t *vm_create(void) {
         exit(1);
     }
     vm_init(vm);
+    gc_add_vm(vm);
+    return vm;
+}
+
+vm_t *vm_create_from_snapshot(const char *filename, const char *source, bool optimize) {
+    // returns a VM restored from a snapshot written by vm_snapshot instead
+    // of by vm_init, or NULL if the snapshot doesn't exist or is out of
+    // date (see snapshot_load)
+    vm_t *vm = calloc(1, sizeof *vm);
+    if (!vm) {
+        fprintf(stderr, "Failed to allocate memory for VM\n");
+        exit(1);
+    }
+    vm_init_stacks(vm);
+    if (!snapshot_load(vm, filename, source, optimize)) {
+        free(vm->frames);
+        free(vm);
+        return NULL;
+    }
+    for (int i = 0; i < N_INLINE_BUILTINS; i++) {
+        vm->inline_builtins[i] = dict_get(vm->globals, inline_builtin_names[i]);
+    }
+    vm_grow_global_slots(vm, vm->str_cache->len);
+    gc_add_vm(vm);
     return vm;
 }
 
+void vm_gc_mark_roots(vm_t *vm) {
+    for (object_t **obj_ptr = vm->stack; obj_ptr <= vm->stack_top; obj_ptr++) {
+        gc_mark(*obj_ptr);
+    }
+    for (object_t **obj_ptr = vm->slots; obj_ptr < vm->slots_top; obj_ptr++) {
+        gc_mark(*obj_ptr);
+    }
+    for (object_t **obj_ptr = vm->iters; obj_ptr <= vm->iters_top; obj_ptr++) {
+        gc_mark(*obj_ptr);
+    }
+    for (int i = 0; i < N_INLINE_BUILTINS; i++) gc_mark(vm->inline_builtins[i]);
+    gc_mark(vm->str_cache);
+    for (int i = 0; i < 256; i++) gc_mark(vm->char_cache[i]);
+    gc_mark(vm->code_cache);
+    gc_mark(vm->globals);
+
+    // the names of globals may be freed by this collection, and reused as
+    // the names of new ones, so forget where we found them
+    for (int i = 0; i < vm->n_global_slots; i++) {
+        vm->global_slots[i] = (global_slot_t){ .i = -1, .name = NULL };
+    }
+}
+
 void vm_print_stack(vm_t *vm) {
     for (object_t **obj_ptr = vm->stack; obj_ptr <= vm->stack_top; obj_ptr++) {
         object_print(*obj_ptr);
@@ -509,39 +727,77 @@ void vm_print_stack(vm_t *vm) {
     }
 }
 
+const char *vm_get_local_name(vm_t *vm, code_t *scope, int slot) {
+    return vm->str_cache->items[scope->locals[slot]].name;
+}
+
+dict_t *locals_to_dict(locals_t *locals, vm_t *vm) {
+    dict_t *dict = dict_create();
+    code_t *scope = locals->scope;
+    for (int i = 0; i < scope->n_locals; i++) {
+        object_t *obj = locals->slots[i];
+        if (obj) dict_set(dict, vm_get_local_name(vm, scope, i), obj);
+    }
+    return dict;
+}
+
 void vm_print_instruction(vm_t *vm, code_t *code, int *i_ptr) {
+    // prints the instruction at *i_ptr, and moves *i_ptr to the next one
     int i = *i_ptr;
 
-    instruction_t instruction = code->bytecodes[i].instruction;
+    instruction_t instruction = code->bytecodes[i];
+    int args[CODE_MAX_ARGS];
+    *i_ptr = code_decode(code, i, args);
     fputs(instruction_names[instruction], stdout);
     if (instruction == INSTR_LOAD_INT) {
-        printf(" %i", code->bytecodes[++i].i);
+        printf(" %i", args[0]);
     } else if (instruction == INSTR_LOAD_STR) {
-        int j = code->bytecodes[++i].i;
         putc(' ', stdout);
-        print_string_quoted(vm->str_cache->items[j].name);
+        print_string_quoted(vm->str_cache->items[args[0]].name);
     } else if (instruction == INSTR_LOAD_FUNC) {
-        int j = code->bytecodes[++i].i;
+        int j = args[0];
         func_t *func = vm->code_cache->elems[j]->data.ptr;
         printf(" %i (code compiled from %s, row %i, col %i)", j,
             func->u.code->filename, func->u.code->row + 1, func->u.code->col + 1);
+    } else if (
+        (instruction >= FIRST_LOCAL_INSTR && instruction <= LAST_LOCAL_INSTR) ||
+        instruction == INSTR_STORE_LOAD_LOCAL
+    ) {
+        printf(" %s", vm_get_local_name(vm, code->scope, args[0]));
+    } else if (
+        instruction == INSTR_LOAD_LOCAL_GETTER ||
+        (instruction >= FIRST_LOCAL_QUICK_GETTER && instruction <= LAST_QUICK_GETTER)
+    ) {
+        printf(" %s %s (cache %i)", vm_get_local_name(vm, code->scope, args[0]),
+            vm->str_cache->items[args[1]].name, args[2]);
+    } else if (instruction >= INSTR_ADD_INT_CONST && instruction <= INSTR_LT_INT_CONST) {
+        printf(" %i", args[0]);
     } else if (
         instruction == INSTR_GETTER || instruction == INSTR_SETTER ||
-        instruction >= FIRST_GLOBAL_INSTR && instruction <= LAST_LOCAL_INSTR ||
+        (instruction >= FIRST_QUICK_GETTER && instruction < FIRST_LOCAL_QUICK_GETTER)
+    ) {
+        printf(" %s (cache %i)", vm->str_cache->items[args[0]].name, args[1]);
+    } else if (instruction >= INSTR_JUMP && instruction <= INSTR_FOR_ITER) {
+        int n_args = instruction_args(instruction);
+        if (instruction == INSTR_CHECK_BUILTIN) {
+            printf(" %s", vm->str_cache->items[args[0]].name);
+        } else if (instruction == INSTR_ITER) {
+            printf(" %i", args[0]);
+        }
+        printf(" %+i", args[n_args - 1]);
+    } else if (
+        (instruction >= FIRST_GLOBAL_INSTR && instruction <= LAST_GLOBAL_INSTR) ||
         instruction == INSTR_RENAME_FUNC
     ) {
-        int j = code->bytecodes[++i].i;
-        printf(" %s", vm->str_cache->items[j].name);
+        printf(" %s", vm->str_cache->items[args[0]].name);
     }
     putc('\n', stdout);
-
-    *i_ptr = i;
 }
 
 void vm_print_code(vm_t *vm, code_t *code, int depth) {
     print_tabs(depth, stdout);
     printf("Code compiled from %s, row %i, col %i:\n", code->filename, code->row + 1, code->col + 1);
-    for (int i = 0; i < code->len; i++) {
+    for (int i = 0; i < code->len;) {
         print_tabs(depth, stdout);
         vm_print_instruction(vm, code, &i);
     }
@@ -549,11 +805,60 @@ void vm_print_code(vm_t *vm, code_t *code, int depth) {
 
 object_t *vm_iter(vm_t *vm) {
     object_t *obj_it = vm_pop(vm);
-    object_getter(obj_it, "__iter__", vm);
+    object_method(obj_it, SYM_ITER, "__iter__", vm);
     return vm_pop(vm);
 }
 
-void vm_eval(vm_t *vm, code_t *code, dict_t *locals) {
+static void vm_eval_debug_stack(vm_t *vm) {
+    printf("=== STACK:");
+    vm_print_stack(vm);
+    printf("=== END STACK");
+}
+
+static void vm_eval_debug(vm_t *vm, code_t *code, int i) {
+    // Called before evaluating each instruction, if any of the debug flags
+    // are set.
+    // So the stack we print here is the one left by the previous instruction.
+    if (vm->debug_print_stack && i > 0) vm_eval_debug_stack(vm);
+    if (vm->debug_print_eval) {
+        print_tabs(vm->eval_depth, stderr);
+        vm_print_instruction(vm, code, &i);
+    }
+}
+
+// Threaded dispatch: when the compiler supports labels-as-values (GCC and
+// clang do), every instruction jumps straight to the handler of the next
+// one through a table of labels, instead of going back around a loop and
+// through a switch.
+// Compile with -D_NO_COMPUTED_GOTO_ to get the plain switch instead.
+#if defined(__GNUC__) && !defined(_NO_COMPUTED_GOTO_)
+#define VM_COMPUTED_GOTO
+#endif
+
+static locals_t *vm_find_locals(vm_t *vm, code_t *scope) {
+    // find the innermost running call of the function scope
+    for (locals_t *locals = vm->locals; locals; locals = locals->prev) {
+        if (locals->scope == scope) return locals;
+    }
+    return NULL;
+}
+
+static call_frame_t *vm_push_frame(vm_t *vm, code_t *code, dict_t *locals, dict_t *locals_out) {
+    // If locals is given, it's used to initialize the local variables.
+    // If locals_out is given, the local variables are written to it when
+    // the frame is popped.
+
+    if (vm->frames_top >= vm->frames + VM_FRAMES_SIZE - 1) {
+        fprintf(stderr, "Too many nested calls!\n");
+        exit(1);
+    }
+    call_frame_t *call = ++vm->frames_top;
+    call->code = code;
+    call->i = 0;
+    call->prev_locals = vm->locals;
+    call->prev_iters_top = vm->iters_top;
+    call->locals_out = locals_out;
+    call->is_base = false;
 
     if (vm->debug_print_eval) {
         print_tabs(vm->eval_depth, stderr);
@@ -562,141 +867,770 @@ void vm_eval(vm_t *vm, code_t *code, dict_t *locals) {
     }
 
     // Set up locals
-    dict_t *prev_locals;
-    if (!locals && code->is_func) locals = dict_create();
-    if (locals) {
-        prev_locals = vm->locals;
-        vm->locals = locals;
+    // A function gets fresh slots for its local variables, and so does a
+    // code block if we were given locals for it; otherwise a code block uses
+    // the slots of the running function it was compiled inside of.
+    code_t *scope = code->scope;
+    call->locals = NULL;
+    if (scope && (code->is_func || locals || locals_out)) {
+        int n_locals = scope->n_locals;
+        if (vm->slots_top + n_locals > vm->slots + VM_SLOTS_SIZE) {
+            fprintf(stderr, "Out of space for local variables!\n");
+            exit(1);
+        }
+        locals_t *new_locals = &call->own_locals;
+        new_locals->scope = scope;
+        new_locals->slots = vm->slots_top;
+        new_locals->prev = vm->locals;
+        new_locals->has_blocks = false;
+        vm->slots_top += n_locals;
+        for (int j = 0; j < n_locals; j++) {
+            new_locals->slots[j] = locals?
+                dict_get(locals, vm_get_local_name(vm, scope, j)): NULL;
+        }
+        call->locals = vm->locals = new_locals;
+    } else if (scope) {
+        call->locals = vm_find_locals(vm, scope);
     }
 
     vm->eval_depth++;
+    return call;
+}
 
-    for (int i = 0; i < code->len; i++) {
-
-        if (vm->debug_print_eval) {
-            print_tabs(vm->eval_depth, stderr);
-            // print instruction, but don't increment i if it takes an argument
-            int j = i;
-            vm_print_instruction(vm, code, &j);
+static void vm_pop_frame(vm_t *vm) {
+    call_frame_t *call = vm->frames_top--;
+    locals_t *locals = call->locals;
+    if (locals && locals == &call->own_locals) {
+        code_t *scope = locals->scope;
+        if (call->locals_out) {
+            for (int j = 0; j < scope->n_locals; j++) {
+                object_t *obj = locals->slots[j];
+                if (obj) dict_set(call->locals_out, vm_get_local_name(vm, scope, j), obj);
+            }
         }
+        vm->slots_top = locals->slots;
+    }
+    vm->locals = call->prev_locals;
+    vm->iters_top = call->prev_iters_top;
+    vm->eval_depth--;
+}
+
+static inline void vm_quicken_getter(bytecode_t *op, object_t *obj, getter_cache_t *cache) {
+    // Counts how many times in a row a GETTER (or LOAD_LOCAL_GETTER) has got
+    // the same type of object, and once it's VM_QUICKEN_HITS, rewrites it
+    // into the quickened version for that type's method, if it has one.
+    // That only works with that type: see vm_deopt_getter.
+    type_t *type = object_type(obj);
+    method_t *method = cache->sym >= 0 && type->methods? type->methods[cache->sym]: NULL;
+    if (!method || cache->deopts >= VM_QUICKEN_MAX_DEOPTS) return;
+    if (type != cache->quick_type) {
+        cache->quick_type = type;
+        cache->hits = 0;
+        return;
+    }
+    if (++cache->hits < VM_QUICKEN_HITS) return;
+    instruction_t instruction =
+        type == &list_type && cache->sym == SYM_LEN? INSTR_LIST_LEN:
+        type == &list_type && cache->sym == SYM_GET? INSTR_LIST_GET:
+        type == &str_type && cache->sym == SYM_LEN? INSTR_STR_LEN:
+        type == &str_type && cache->sym == SYM_GET? INSTR_STR_GET:
+        INSTR_GETTER_METHOD;
+    if (*op == INSTR_LOAD_LOCAL_GETTER) instruction += N_QUICK_GETTERS;
+    *op = instruction;
+    cache->method = method;
+}
+
+static void vm_deopt_getter(bytecode_t *op, getter_cache_t *cache) {
+    // turns a quickened GETTER which got the wrong type of object back into
+    // what it was (which may quicken it again, but not too many times)
+    *op = *op >= FIRST_LOCAL_QUICK_GETTER?
+        INSTR_LOAD_LOCAL_GETTER: INSTR_GETTER;
+    cache->quick_type = NULL;
+    cache->hits = 0;
+    cache->deopts++;
+}
+
+void vm_cmp(vm_t *vm, instruction_t instruction) {
+    // a comparison of anything but two ints (see vm_eval)
+    object_t *other = vm_pop(vm);
+    object_t *self = vm_pop(vm);
+    if ((instruction == INSTR_EQ || instruction == INSTR_NE) &&
+        object_type(self) == &str_type && object_type(other) == &str_type
+    ) {
+        // NOTE: no need to know which str is "less" (see str_eq)
+        bool eq = str_eq(self, other);
+        vm_push(vm, object_create_bool(instruction == INSTR_EQ? eq: !eq));
+        return;
+    }
+    cmp_result_t cmp = object_cmp(self, other, vm);
+    bool b;
+    switch (instruction) {
+        case INSTR_EQ: b = cmp == CMP_EQ; break;
+        case INSTR_NE: b = cmp != CMP_EQ; break;
+        case INSTR_LT: b = cmp == CMP_LT; break;
+        case INSTR_LE: b = cmp == CMP_LT || cmp == CMP_EQ; break;
+        case INSTR_GT: b = cmp == CMP_GT; break;
+        case INSTR_GE: b = cmp == CMP_GT || cmp == CMP_EQ; break;
+        default:
+            // should never happen...
+            fprintf(stderr, "Unknown instruction in vm_eval: %i\n", instruction);
+            exit(1);
+    }
+    vm_push(vm, object_create_bool(b));
+}
+
+void vm_op(vm_t *vm, instruction_t instruction) {
+    // an operator, on anything but ints (or bools) (see vm_eval)
+    int op = instruction - FIRST_OP_INSTR;
+    const char *name = operator_tokens[op];
+    int arity = op_arities[op];
+    int n_args = arity - 1;
+    // remove obj from underneath its arguments on the stack
+    object_t *obj = vm_pluck(vm, n_args);
+    object_method(obj, op, name, vm);
+}
 
-        instruction_t instruction = code->bytecodes[i].instruction;
-        if (instruction == INSTR_LOAD_INT) {
-            int j = code->bytecodes[++i].i;
+static bool code_is_done_at(code_t *code, int i) {
+    // whether running code from bytecode i onwards would do nothing but
+    // finish (following forward JUMPs, e.g. out of the end of an inlined
+    // @ifelse)
+    bytecode_t *bytecodes = code->bytecodes;
+    while (i < code->len && bytecodes[i] == INSTR_JUMP) {
+        int off;
+        int next = code_decode(code, i, &off);
+        if (off < 0) break;
+        i = next + off;
+    }
+    return i >= code->len || (code->is_func && bytecodes[i] == INSTR_RETURN);
+}
+
+static void _vm_eval(vm_t *vm, code_t *code, dict_t *locals, dict_t *locals_out) {
+    // Runs code in a new frame, and any code it calls (which doesn't go
+    // through C) in frames above that, until our frame is popped.
+    call_frame_t *call = vm_push_frame(vm, code, locals, locals_out);
+    call->is_base = true;
+    locals_t *frame = call->locals;
+
+    bytecode_t *bytecodes = code->bytecodes;
+    int len = code->len;
+    int i = 0;
+    instruction_t instruction;
+    object_t *callee;
+
+    // switch to the code of the (new) top frame
+    #define LOAD_FRAME() { \
+        call = vm->frames_top; \
+        code = call->code; \
+        bytecodes = code->bytecodes; \
+        len = code->len; \
+        i = call->i; \
+        frame = call->locals; \
+    }
+
+    // after anything which may have run a code block doing @break,
+    // @continue or @return
+    #define CHECK_UNWIND() if (vm->unwind) goto unwind
+
+    // where code starts (or carries on), or goes round a loop (see jit below)
+    #define NEXT_OR_JIT() if (vm->jit) goto jit; NEXT()
+
+    if (vm->jit) goto jit;
+
+#ifdef VM_COMPUTED_GOTO
+    static void *labels[N_INSTRS] = {
+        [INSTR_LOAD_INT] = &&do_LOAD_INT,
+        [INSTR_LOAD_STR] = &&do_LOAD_STR,
+        [INSTR_LOAD_FUNC] = &&do_LOAD_FUNC,
+        [INSTR_LOAD_GLOBAL] = &&do_LOAD_GLOBAL,
+        [INSTR_STORE_GLOBAL] = &&do_STORE_GLOBAL,
+        [INSTR_CALL_GLOBAL] = &&do_CALL_GLOBAL,
+        [INSTR_LOAD_LOCAL] = &&do_LOAD_LOCAL,
+        [INSTR_STORE_LOCAL] = &&do_STORE_LOCAL,
+        [INSTR_CALL_LOCAL] = &&do_CALL_LOCAL,
+        [INSTR_GETTER] = &&do_GETTER,
+        [INSTR_SETTER] = &&do_SETTER,
+        [INSTR_RENAME_FUNC] = &&do_RENAME_FUNC,
+        [INSTR_JUMP] = &&do_JUMP,
+        [INSTR_JUMP_IF_FALSE] = &&do_JUMP_IF_FALSE,
+        [INSTR_CHECK_BUILTIN] = &&do_CHECK_BUILTIN,
+        [INSTR_ITER] = &&do_ITER,
+        [INSTR_FOR_ITER] = &&do_FOR_ITER,
+        [INSTR_POP_ITER] = &&do_POP_ITER,
+        [INSTR_BREAK] = &&do_BREAK,
+        [INSTR_CONTINUE] = &&do_CONTINUE,
+        [INSTR_RETURN] = &&do_RETURN,
+        [INSTR_LOAD_LOCAL_GETTER] = &&do_LOAD_LOCAL_GETTER,
+        [INSTR_STORE_LOAD_LOCAL] = &&do_STORE_LOAD_LOCAL,
+        [INSTR_ADD_INT_CONST] = &&do_ADD_INT_CONST,
+        [INSTR_SUB_INT_CONST] = &&do_SUB_INT_CONST,
+        [INSTR_LT_INT_CONST] = &&do_LT_INT_CONST,
+        [INSTR_DUP] = &&do_DUP,
+        [INSTR_GETTER_METHOD] = &&do_GETTER_METHOD,
+        [INSTR_LIST_LEN] = &&do_LIST_LEN,
+        [INSTR_LIST_GET] = &&do_LIST_GET,
+        [INSTR_STR_LEN] = &&do_STR_LEN,
+        [INSTR_STR_GET] = &&do_STR_GET,
+        [INSTR_LOCAL_GETTER_METHOD] = &&do_LOCAL_GETTER_METHOD,
+        [INSTR_LOCAL_LIST_LEN] = &&do_LOCAL_LIST_LEN,
+        [INSTR_LOCAL_LIST_GET] = &&do_LOCAL_LIST_GET,
+        [INSTR_LOCAL_STR_LEN] = &&do_LOCAL_STR_LEN,
+        [INSTR_LOCAL_STR_GET] = &&do_LOCAL_STR_GET,
+        [INSTR_LIST_COMMA] = &&do_LIST_COMMA,
+        [INSTR_NEG] = &&do_NEG,
+        [INSTR_ADD] = &&do_ADD,
+        [INSTR_SUB] = &&do_SUB,
+        [INSTR_MUL] = &&do_MUL,
+        [INSTR_DIV] = &&do_DIV,
+        [INSTR_MOD] = &&do_MOD,
+        [INSTR_NOT] = &&do_NOT,
+        [INSTR_AND] = &&do_AND,
+        [INSTR_OR] = &&do_OR,
+        [INSTR_XOR] = &&do_XOR,
+        [INSTR_EQ] = &&do_EQ,
+        [INSTR_NE] = &&do_NE,
+        [INSTR_LT] = &&do_LT,
+        [INSTR_LE] = &&do_LE,
+        [INSTR_GT] = &&do_GT,
+        [INSTR_GE] = &&do_GE,
+        [INSTR_COMMA] = &&do_COMMA,
+        [INSTR_CALL] = &&do_CALL,
+    };
+    #define CASE(X) do_##X
+    #define NEXT() goto next
+    next:
+    if (i >= len) goto ret;
+    if (vm->debug_print_eval || vm->debug_print_stack) vm_eval_debug(vm, code, i);
+    vm->instr_count++;
+    instruction = bytecodes[i++];
+    goto *labels[instruction];
+#else
+    #define CASE(X) case INSTR_##X
+    #define NEXT() continue
+    while (true) {
+    if (i >= len) goto ret;
+    if (vm->debug_print_eval || vm->debug_print_stack) vm_eval_debug(vm, code, i);
+    vm->instr_count++;
+    instruction = bytecodes[i++];
+    switch (instruction) {
+#endif
+
+        CASE(LOAD_INT): {
+            int j = code_read_arg(bytecodes, &i);
             vm_push(vm, vm_get_or_create_int(vm, j));
-        } else if (instruction == INSTR_LOAD_STR) {
-            int j = code->bytecodes[++i].i;
+            NEXT();
+        }
+        CASE(LOAD_STR): {
+            int j = code_read_arg(bytecodes, &i);
             vm_push(vm, vm->str_cache->items[j].value);
-        } else if (instruction == INSTR_LOAD_FUNC) {
-            int j = code->bytecodes[++i].i;
-            vm_push(vm, vm->code_cache->elems[j]);
-        } else if (instruction == INSTR_GETTER || instruction == INSTR_SETTER) {
-            int j = code->bytecodes[++i].i;
+            NEXT();
+        }
+        CASE(LOAD_FUNC): {
+            int j = code_read_arg(bytecodes, &i);
+            object_t *obj = vm->code_cache->elems[j];
+            func_t *func = obj->data.ptr;
+            // a code block uses our locals, and may get called after we
+            // finish with a tail call (see call below)
+            if (frame && !func->u.code->is_func) frame->has_blocks = true;
+            vm_push(vm, obj);
+            NEXT();
+        }
+        CASE(GETTER): {
+            int op_i = i - 1;
+            int j = code_read_arg(bytecodes, &i);
+            getter_cache_t *cache = &code->getter_caches[code_read_arg(bytecodes, &i)];
             const char *name = vm->str_cache->items[j].name;
             object_t *obj = vm_pop(vm);
-            if (instruction == INSTR_GETTER) object_getter(obj, name, vm);
-            if (instruction == INSTR_SETTER) object_setter(obj, name, vm);
-        } else if (
-            instruction == INSTR_LOAD_GLOBAL || instruction == INSTR_CALL_GLOBAL ||
-            instruction == INSTR_LOAD_LOCAL || instruction == INSTR_CALL_LOCAL
-        ) {
-            int j = code->bytecodes[++i].i;
+            vm_quicken_getter(&bytecodes[op_i], obj, cache);
+            object_cached_getter(obj, name, cache, vm);
+            CHECK_UNWIND();
+            NEXT();
+        }
+        CASE(SETTER): {
+            int j = code_read_arg(bytecodes, &i);
+            getter_cache_t *cache = &code->getter_caches[code_read_arg(bytecodes, &i)];
             const char *name = vm->str_cache->items[j].name;
-            object_t *obj;
-            bool local = instruction == INSTR_LOAD_LOCAL || instruction == INSTR_CALL_LOCAL;
-            dict_t *vars = local? vm->locals: vm->globals;
-            if (!vars) {
-                fprintf(stderr, "Tried to store to local variable '%s', but there are no locals\n", name);
+            object_t *obj = vm_pop(vm);
+            object_cached_setter(obj, name, cache, vm);
+            CHECK_UNWIND();
+            NEXT();
+        }
+        CASE(LOAD_GLOBAL):
+        CASE(CALL_GLOBAL): {
+            int j = code_read_arg(bytecodes, &i);
+            dict_item_t *item = vm_get_global_item(vm, j);
+            if (!item) {
+                fprintf(stderr, "Global variable not found: %s\n", vm->str_cache->items[j].name);
+                exit(1);
+            }
+            if (instruction == INSTR_CALL_GLOBAL) {
+                callee = item->value;
+                goto call;
+            }
+            vm_push(vm, item->value);
+            NEXT();
+        }
+        CASE(LOAD_LOCAL):
+        CASE(CALL_LOCAL): {
+            int j = code_read_arg(bytecodes, &i);
+            if (!frame) {
+                fprintf(stderr, "Tried to load local variable '%s', but there are no locals\n",
+                    vm_get_local_name(vm, code->scope, j));
                 exit(1);
             }
-            obj = dict_get(vars, name);
+            object_t *obj = frame->slots[j];
             if (!obj) {
-                fprintf(stderr, "%s variable not found: %s\n", local? "Local": "Global", name);
+                fprintf(stderr, "Local variable not found: %s\n", vm_get_local_name(vm, code->scope, j));
                 exit(1);
             }
-            if (instruction == INSTR_CALL_GLOBAL || instruction == INSTR_CALL_LOCAL) {
-                object_getter(obj, "@", vm);
-            } else {
-                vm_push(vm, obj);
+            if (instruction == INSTR_CALL_LOCAL) {
+                callee = obj;
+                goto call;
             }
-        } else if (instruction == INSTR_RENAME_FUNC) {
-            int j = code->bytecodes[++i].i;
+            vm_push(vm, obj);
+            NEXT();
+        }
+        CASE(RENAME_FUNC): {
+            int j = code_read_arg(bytecodes, &i);
             const char *name = vm->str_cache->items[j].name;
             object_t *obj = vm_top(vm);
-            if (obj->type != &func_type) {
-                fprintf(stderr, "Can't use '$' with object of type '%s'\n", obj->type->name);
+            if (object_type(obj) != &func_type) {
+                fprintf(stderr, "Can't use '$' with object of type '%s'\n", object_type(obj)->name);
                 exit(1);
             }
             func_t *func = obj->data.ptr;
             func->name = name;
-        } else if (instruction == INSTR_STORE_GLOBAL || instruction == INSTR_STORE_LOCAL) {
-            int j = code->bytecodes[++i].i;
-            const char *name = vm->str_cache->items[j].name;
+            NEXT();
+        }
+        CASE(STORE_GLOBAL): {
+            int j = code_read_arg(bytecodes, &i);
             object_t *obj = vm_pop(vm);
-            bool local = instruction == INSTR_STORE_LOCAL;
-            dict_t *vars = local? vm->locals: vm->globals;
-            if (!vars) {
-                fprintf(stderr, "Tried to store to local variable '%s', but there are no locals\n", name);
+            dict_item_t *item = vm_get_global_item(vm, j);
+            if (item) dict_set_item(vm->globals, item, obj);
+            else dict_set(vm->globals, vm->str_cache->items[j].name, obj);
+            NEXT();
+        }
+        CASE(STORE_LOCAL): {
+            int j = code_read_arg(bytecodes, &i);
+            if (!frame) {
+                fprintf(stderr, "Tried to store to local variable '%s', but there are no locals\n",
+                    vm_get_local_name(vm, code->scope, j));
                 exit(1);
             }
-            dict_set(vars, name, obj);
-        } else {
-            // operator
-            int op = instruction - FIRST_OP_INSTR;
-            if (op >= FIRST_CMP_OP && op <= LAST_CMP_OP) {
-                object_t *other = vm_pop(vm);
-                object_t *self = vm_pop(vm);
-                cmp_result_t cmp = object_cmp(self, other, vm);
-                bool b;
-                switch (instruction) {
-                    case INSTR_EQ: b = cmp == CMP_EQ; break;
-                    case INSTR_NE: b = cmp != CMP_EQ; break;
-                    case INSTR_LT: b = cmp == CMP_LT; break;
-                    case INSTR_LE: b = cmp == CMP_LT || cmp == CMP_EQ; break;
-                    case INSTR_GT: b = cmp == CMP_GT; break;
-                    case INSTR_GE: b = cmp == CMP_GT || cmp == CMP_EQ; break;
-                    default:
-                        // should never happen...
-                        fprintf(stderr, "Unknown instruction in vm_eval: %i\n", instruction);
-                        exit(1);
-                }
-                vm_push(vm, object_create_bool(b));
-            } else {
-                const char *name = operator_tokens[op];
-                int arity = op_arities[op];
-                int n_args = arity - 1;
-                // remove obj from underneath its arguments on the stack
-                object_t *obj = vm_pluck(vm, n_args);
-                object_getter(obj, name, vm);
+            frame->slots[j] = vm_pop(vm);
+            NEXT();
+        }
+        CASE(JUMP): {
+            int off = code_read_offset(bytecodes, &i);
+            i += off;
+            if (off < 0) NEXT_OR_JIT();
+            NEXT();
+        }
+        CASE(JUMP_IF_FALSE): {
+            int off = code_read_offset(bytecodes, &i);
+            object_t *cond_obj = vm_pop(vm);
+            if (!object_to_bool(cond_obj)) i += off;
+            NEXT();
+        }
+        CASE(CHECK_BUILTIN): {
+            // skip over the fallback, which calls the global, if it's
+            // still the builtin whose code blocks the compiler inlined
+            int j = code_read_arg(bytecodes, &i);
+            int builtin = code_read_arg(bytecodes, &i);
+            int off = code_read_offset(bytecodes, &i);
+            dict_item_t *item = vm_get_global_item(vm, j);
+            if (item && item->value == vm->inline_builtins[builtin]) i += off;
+            NEXT();
+        }
+        CASE(ITER): {
+            // start an inlined @for loop, whose body should be the code
+            // block underneath the iterable on the stack (if it isn't, jump
+            // back to the fallback, which calls @for)
+            int j = code_read_arg(bytecodes, &i);
+            int off = code_read_offset(bytecodes, &i);
+            if (vm->stack_top <= vm->stack || vm->stack_top[-1] != vm->code_cache->elems[j]) {
+                i += off;
+                NEXT();
+            }
+            object_t *obj = vm_pop(vm);
+            vm->stack_top--; // drop the body
+            object_method(obj, SYM_ITER, "__iter__", vm);
+            CHECK_UNWIND();
+            if (vm->iters_top >= vm->iters + VM_ITERS_SIZE - 1) {
+                fprintf(stderr, "Too many nested @for loops!\n");
+                exit(1);
+            }
+            *++vm->iters_top = vm_pop(vm);
+            NEXT();
+        }
+        CASE(FOR_ITER): {
+            int off = code_read_offset(bytecodes, &i);
+            object_t *next_obj = object_next(*vm->iters_top, vm);
+            CHECK_UNWIND();
+            if (next_obj) vm_push(vm, next_obj);
+            else {
+                vm->iters_top--;
+                i += off;
+            }
+            NEXT();
+        }
+        CASE(POP_ITER): {
+            vm->iters_top--;
+            NEXT();
+        }
+        CASE(BREAK):
+        CASE(CONTINUE): {
+            // we weren't inlined into the loop we're breaking out of, so
+            // we have to unwind (see below)
+            i += CODE_OFFSET_SIZE; // room for an offset, unused
+            vm->unwind = instruction == INSTR_BREAK? UNWIND_BREAK: UNWIND_CONTINUE;
+            goto unwind;
+        }
+        CASE(RETURN): {
+            vm->unwind = UNWIND_RETURN;
+            goto unwind;
+        }
+
+        // Superinstructions (see code_optimize)
+        CASE(LOAD_LOCAL_GETTER): {
+            int op_i = i - 1;
+            int j = code_read_arg(bytecodes, &i);
+            int k = code_read_arg(bytecodes, &i);
+            getter_cache_t *cache = &code->getter_caches[code_read_arg(bytecodes, &i)];
+            if (!frame) {
+                fprintf(stderr, "Tried to load local variable '%s', but there are no locals\n",
+                    vm_get_local_name(vm, code->scope, j));
+                exit(1);
             }
+            object_t *obj = frame->slots[j];
+            if (!obj) {
+                fprintf(stderr, "Local variable not found: %s\n", vm_get_local_name(vm, code->scope, j));
+                exit(1);
+            }
+            vm_quicken_getter(&bytecodes[op_i], obj, cache);
+            object_cached_getter(obj, vm->str_cache->items[k].name, cache, vm);
+            CHECK_UNWIND();
+            NEXT();
+        }
+        CASE(STORE_LOAD_LOCAL): {
+            int j = code_read_arg(bytecodes, &i);
+            if (!frame) {
+                fprintf(stderr, "Tried to store to local variable '%s', but there are no locals\n",
+                    vm_get_local_name(vm, code->scope, j));
+                exit(1);
+            }
+            frame->slots[j] = vm_top(vm);
+            NEXT();
+        }
+        CASE(DUP): {
+            vm_push(vm, vm_top(vm));
+            NEXT();
         }
 
-        if (vm->debug_print_stack) {
-            printf("=== STACK:");
-            vm_print_stack(vm);
-            printf("=== END STACK");
+        // Quickened GETTERs (see vm_quicken_getter)
+        // The LOCAL version loads its local first, like LOAD_LOCAL_GETTER.
+        #define QUICK_GETTER_BODY(OP_I, GUARD, BODY) { \
+            int j = code_read_arg(bytecodes, &i); \
+            getter_cache_t *cache = &code->getter_caches[code_read_arg(bytecodes, &i)]; \
+            if (!(GUARD)) { \
+                vm_deopt_getter(&bytecodes[OP_I], cache); \
+                object_cached_getter(obj, vm->str_cache->items[j].name, cache, vm); \
+                CHECK_UNWIND(); \
+                NEXT(); \
+            } \
+            BODY \
+            NEXT(); \
+        }
+        #define QUICK_GETTER(X, GUARD, BODY) \
+        CASE(X): { \
+            int op_i = i - 1; \
+            object_t *obj = vm_pop(vm); \
+            QUICK_GETTER_BODY(op_i, GUARD, BODY) \
+        } \
+        CASE(LOCAL_##X): { \
+            int op_i = i - 1; \
+            int j = code_read_arg(bytecodes, &i); \
+            object_t *obj = frame? frame->slots[j]: NULL; \
+            if (!obj) { \
+                fprintf(stderr, "Local variable not found: %s\n", vm_get_local_name(vm, code->scope, j)); \
+                exit(1); \
+            } \
+            QUICK_GETTER_BODY(op_i, GUARD, BODY) \
+        }
+        QUICK_GETTER(GETTER_METHOD, object_type(obj) == cache->quick_type, {
+            cache->method(obj, cache->sym, vm);
+            CHECK_UNWIND();
+        })
+        QUICK_GETTER(LIST_LEN, object_type(obj) == &list_type, {
+            list_t *list = obj->data.ptr;
+            vm_push(vm, vm_get_or_create_int(vm, list->len));
+        })
+        QUICK_GETTER(LIST_GET, object_type(obj) == &list_type, {
+            int k = object_to_int(vm_pop(vm));
+            vm_push(vm, list_get(obj->data.ptr, k));
+        })
+        QUICK_GETTER(STR_LEN, object_type(obj) == &str_type, {
+            vm_push(vm, vm_get_or_create_int(vm, str_get_len(obj)));
+        })
+        QUICK_GETTER(STR_GET, object_type(obj) == &str_type, {
+            const char *s = obj->data.ptr;
+            int k = get_index(object_to_int(vm_pop(vm)), str_get_len(obj), "str");
+            vm_push(vm, vm_get_char_str(vm, s[k]));
+        })
+        #undef QUICK_GETTER_BODY
+        #undef QUICK_GETTER
+        CASE(LIST_COMMA): {
+            // a COMMA which has had a list (see COMMA below)
+            object_t **top = vm->stack_top;
+            if (top > vm->stack && object_type(top[-1]) == &list_type) {
+                list_push(top[-1]->data.ptr, top[0]);
+                vm->stack_top = top - 1;
+                NEXT();
+            }
+            bytecodes[i - 1] = instruction = INSTR_COMMA;
+            goto op;
         }
 
-    }
+        // Operators and comparisons on two ints (or two bools) are computed
+        // right here; anything else goes to the generic code below, which
+        // asks the operand's type (see object_method and object_cmp).
+        #define BOTH_INTS(a, b) (OBJECT_IS_INT(a) && OBJECT_IS_INT(b))
+        #define BOTH_BOOLS(a, b) (((a) == &static_true || (a) == &static_false) && \
+            ((b) == &static_true || (b) == &static_false))
+        #define INT_CMP(OP) { \
+            object_t **top = vm->stack_top; \
+            if (top > vm->stack && BOTH_INTS(top[-1], top[0])) { \
+                top[-1] = object_create_bool(OBJECT_TO_INT(top[-1]) OP OBJECT_TO_INT(top[0])); \
+                vm->stack_top = top - 1; \
+                NEXT(); \
+            } \
+            goto cmp; \
+        }
+        #define INT_UNOP(EXPR) { \
+            object_t **top = vm->stack_top; \
+            if (top >= vm->stack && OBJECT_IS_INT(top[0])) { \
+                int i = OBJECT_TO_INT(top[0]); \
+                top[0] = OBJECT_FROM_INT(EXPR); \
+                NEXT(); \
+            } \
+            goto op; \
+        }
+        #define INT_BINOP(OP) { \
+            object_t **top = vm->stack_top; \
+            if (top > vm->stack && BOTH_INTS(top[-1], top[0])) { \
+                top[-1] = OBJECT_FROM_INT(OBJECT_TO_INT(top[-1]) OP OBJECT_TO_INT(top[0])); \
+                vm->stack_top = top - 1; \
+                NEXT(); \
+            } \
+            goto op; \
+        }
+        #define INT_OR_BOOL_BINOP(OP) { \
+            object_t **top = vm->stack_top; \
+            if (top > vm->stack && BOTH_INTS(top[-1], top[0])) { \
+                top[-1] = OBJECT_FROM_INT(OBJECT_TO_INT(top[-1]) OP OBJECT_TO_INT(top[0])); \
+                vm->stack_top = top - 1; \
+                NEXT(); \
+            } \
+            if (top > vm->stack && BOTH_BOOLS(top[-1], top[0])) { \
+                top[-1] = object_create_bool(top[-1]->data.i OP top[0]->data.i); \
+                vm->stack_top = top - 1; \
+                NEXT(); \
+            } \
+            goto op; \
+        }
+
+        // An op with an int constant for its right operand, e.g. "x 1 +"
+        #define INT_CONST_OP(INSTRUCTION, EXPR, GENERIC) { \
+            int j = code_read_arg(bytecodes, &i); \
+            object_t **top = vm->stack_top; \
+            if (top >= vm->stack && OBJECT_IS_INT(top[0])) { \
+                int i = OBJECT_TO_INT(top[0]); \
+                top[0] = EXPR; \
+                NEXT(); \
+            } \
+            vm_push(vm, vm_get_or_create_int(vm, j)); \
+            instruction = INSTRUCTION; \
+            goto GENERIC; \
+        }
+        CASE(ADD_INT_CONST): INT_CONST_OP(INSTR_ADD, OBJECT_FROM_INT(i + j), op)
+        CASE(SUB_INT_CONST): INT_CONST_OP(INSTR_SUB, OBJECT_FROM_INT(i - j), op)
+        CASE(LT_INT_CONST): INT_CONST_OP(INSTR_LT, object_create_bool(i < j), cmp)
+
+        CASE(EQ): INT_CMP(==)
+        CASE(NE): INT_CMP(!=)
+        CASE(LT): INT_CMP(<)
+        CASE(LE): INT_CMP(<=)
+        CASE(GT): INT_CMP(>)
+        CASE(GE): INT_CMP(>=)
+        cmp: {
+            vm_cmp(vm, instruction);
+            CHECK_UNWIND();
+            NEXT();
+        }
+        CASE(NEG): INT_UNOP(-i)
+        CASE(ADD): INT_BINOP(+)
+        CASE(SUB): INT_BINOP(-)
+        CASE(MUL): INT_BINOP(*)
+        CASE(DIV): INT_BINOP(/)
+        CASE(MOD): INT_BINOP(%)
+        CASE(NOT): {
+            object_t **top = vm->stack_top;
+            if (top >= vm->stack && (*top == &static_true || *top == &static_false)) {
+                *top = object_create_bool(!(*top)->data.i);
+                NEXT();
+            }
+            INT_UNOP(~i)
+        }
+        CASE(AND): INT_OR_BOOL_BINOP(&)
+        CASE(OR): INT_OR_BOOL_BINOP(|)
+        CASE(XOR): INT_OR_BOOL_BINOP(^)
+        CASE(CALL): {
+            callee = vm_pop(vm);
+            goto call;
+        }
+        CASE(COMMA): {
+            // quicken for lists, since that's what it's usually used with
+            object_t **top = vm->stack_top;
+            if (top > vm->stack && object_type(top[-1]) == &list_type) {
+                bytecodes[i - 1] = INSTR_LIST_COMMA;
+            }
+            goto op;
+        }
+        op: {
+            vm_op(vm, instruction);
+            CHECK_UNWIND();
+            NEXT();
+        }
+        #undef BOTH_INTS
+        #undef BOTH_BOOLS
+        #undef INT_CMP
+        #undef INT_UNOP
+        #undef INT_BINOP
+        #undef INT_OR_BOOL_BINOP
+        #undef INT_CONST_OP
+
+        unwind: {
+            // a @break, @continue or @return which isn't just a JUMP, so
+            // happened in this code, or in code we called: it's for the
+            // innermost loop we inlined around that point, if any;
+            // otherwise this frame is done, and it's handled further up (see
+            // ret below, and vm_loop_unwind)
+            if (vm->unwind != UNWIND_RETURN) {
+                loop_t *loop = code_find_loop(code, i - 1);
+                if (loop) {
+                    i = vm->unwind == UNWIND_BREAK? loop->break_to: loop->continue_to;
+                    vm->unwind = UNWIND_NONE;
+                    NEXT_OR_JIT();
+                }
+            }
+            goto ret;
+        }
+        call: {
+            // A function (or code block) gets a new frame, and we carry on
+            // with its code; anything else is up to its type (see func_call)
+            if (object_type(callee) == &func_type) {
+                func_t *func = callee->data.ptr;
+                if (!func->is_c_code) {
+                    if (func->stack) for (int j = func->stack->len - 1; j >= 0; j--) {
+                        vm_push(vm, func->stack->elems[j]);
+                    }
+                    code_t *callee_code = func->u.code;
+                    bool is_base = false;
+                    if (
+                        callee_code->is_func && code_is_done_at(code, i) && !call->locals_out &&
+                        !(frame == &call->own_locals && frame->has_blocks)
+                    ) {
+                        // tail call: there's nothing left for us to do, so
+                        // the function can have our frame
+                        is_base = call->is_base;
+                        vm_pop_frame(vm);
+                    } else call->i = i;
+                    vm_push_frame(vm, callee_code, func->locals, NULL)->is_base = is_base;
+                    LOAD_FRAME();
+                    NEXT_OR_JIT();
+                }
+            }
+            object_method(callee, SYM_CALL, "@", vm);
+            CHECK_UNWIND();
+            NEXT();
+        }
+        ret: {
+            // the top frame's code is done (or is being unwound)
+            if (vm->unwind && (code->is_func || call == vm->frames)) {
+                // nothing to unwind past a function, or the top level
+                if (vm->unwind != UNWIND_RETURN) {
+                    fprintf(stderr, "Used @%s outside of a loop\n",
+                        vm->unwind == UNWIND_BREAK? "break": "continue");
+                    exit(1);
+                }
+                vm->unwind = UNWIND_NONE;
+            }
+            if (vm->debug_print_stack && len) vm_eval_debug_stack(vm);
+            bool is_base = call->is_base;
+            vm_pop_frame(vm);
+            if (is_base) return;
+            LOAD_FRAME();
+            CHECK_UNWIND();
+            NEXT_OR_JIT();
+        }
+        jit: {
+            // Once code has started (or gone round a loop) VM_JIT_THRESHOLD
+            // times, we compile it to machine code, and from then on run that
+            // instead, until it gets to something only we can do (see
+            // jit_compile); but not while printing what we evaluate.
+            if (!code->jit && ++code->hotness == VM_JIT_THRESHOLD) code->jit = jit_compile(code);
+            if (code->jit && !vm->debug_print_eval && !vm->debug_print_stack) {
+                i = jit_run(vm, code->jit, i);
+                CHECK_UNWIND();
+            }
+            NEXT();
+        }
 
-    // Restore locals
-    if (locals) {
-        vm->locals = prev_locals;
+#ifndef VM_COMPUTED_GOTO
+        default:
+            // should never happen...
+            fprintf(stderr, "Unknown instruction in vm_eval: %i\n", instruction);
+            exit(1);
+    }
     }
+#endif
+    #undef CASE
+    #undef NEXT
+    #undef CHECK_UNWIND
+    #undef NEXT_OR_JIT
+    #undef LOAD_FRAME
+}
 
-    vm->eval_depth--;
+void vm_eval(vm_t *vm, code_t *code, dict_t *locals) {
+    _vm_eval(vm, code, locals, NULL);
 }
 
-void vm_include(vm_t *vm, const char *filename) {
-    char *text = read_file(filename, true);
-    compiler_t *compiler = compiler_create(vm, filename);
-    compiler_compile(compiler, text);
-    code_t *code = compiler_pop_runnable_code(compiler);
+void vm_eval_to_dict(vm_t *vm, code_t *code, dict_t *locals) {
+    // evaluates code, and writes its local variables to locals
+    _vm_eval(vm, code, locals, locals);
+}
+
+bool vm_include(vm_t *vm, const char *filename, bool required) {
+    // evaluates a file, returning false if !required and it didn't exist
+    char *text = read_file(filename, required);
+    if (!text) return false;
+
+    // NOTE: loading from the cache would skip the debug printing
+    bool use_lalac = vm->lalac && !vm->debug_print_tokens && !vm->debug_print_code;
+    code_t *code = use_lalac? lalac_load(vm, filename, text): NULL;
     if (!code) {
-        fprintf(stderr, "Code included from '%s' had an unterminated block\n", filename);
-        exit(1);
+        int first_code = vm->code_cache->len;
+        compiler_t *compiler = compiler_create(vm, filename);
+        compiler_compile(compiler, text);
+        code = compiler_pop_runnable_code(compiler);
+        if (!code) {
+            fprintf(stderr, "Code included from '%s' had an unterminated block\n", filename);
+            exit(1);
+        }
+        if (use_lalac) lalac_write(vm, filename, text, code, first_code);
     }
+    free(text);
     vm_eval(vm, code, NULL);
+    return true;
 }
 
 void vm_eval_text(vm_t *vm, char *text, const char *filename) {